@@ -1,3 +1,7 @@
+#include "include/core/SkCanvas.h"
+#include "include/core/SkPaint.h"
+#include "include/core/SkRegion.h"
+
 #include "Ciallo/DDR/GrBaseCompositor.h"
 
 CIALLO_BEGIN_NS
@@ -9,9 +13,13 @@ GrBaseCompositor::GrBaseCompositor(CompositeDevice device,
     : fWidth(width),
       fHeight(height),
       fColorFormat(colorFormat),
-      fPlatform(platform)
+      fRemovedDroppedFrames(0),
+      fPlatform(platform),
+      fPartialRecomposite(true)
 {
     fBackendInfo.fDeviceType = device;
+    /* Nothing has been composited yet, the first frame is fully damaged */
+    fDamageRegion.setRect(SkIRect::MakeWH(fWidth, fHeight));
 }
 
 GrBaseCompositor::~GrBaseCompositor() = default;
@@ -111,6 +119,26 @@ std::shared_ptr<GrBaseRenderLayer> GrBaseCompositor::newRenderLayer(int32_t widt
     return layer;
 }
 
+void GrBaseCompositor::removeRenderLayer(GrBaseRenderLayer *layer)
+{
+    std::scoped_lock<std::mutex> scopedLock(fSubmitMutex);
+    auto itr = fLayerIDMap.find(layer->zindex());
+    if (itr == fLayerIDMap.end() || fLayers[itr->second].fHandle != layer)
+    {
+        throw RuntimeException::Builder(__FUNCTION__)
+                .append("Given layer is not owned by current compositor")
+                .make<RuntimeException>();
+    }
+
+    LayerBinder& binder = fLayers[itr->second];
+    if (layer->visible() && binder.fSubmittedImage.valid())
+        damage(layerBounds(binder));
+
+    fRemovedDroppedFrames += binder.fDroppedFrames;
+    binder = LayerBinder();
+    fLayerIDMap.erase(itr);
+}
+
 void GrBaseCompositor::swapRenderLayers(int a, int b)
 {
     RUNTIME_EXCEPTION_ASSERT(fLayerIDMap.contains(a));
@@ -119,6 +147,13 @@ void GrBaseCompositor::swapRenderLayers(int a, int b)
     RenderLayerID& ra = fLayerIDMap[a];
     RenderLayerID& rb = fLayerIDMap[b];
 
+    /* Stacking order changes only where two layers overlap,
+       but it's cheap enough to damage both of them. */
+    if (fLayers[ra].fHandle->visible())
+        damage(layerBounds(fLayers[ra]));
+    if (fLayers[rb].fHandle->visible())
+        damage(layerBounds(fLayers[rb]));
+
     fLayers[ra].fHandle->setZIndex(b);
     fLayers[rb].fHandle->setZIndex(a);
 
@@ -137,79 +172,254 @@ GrBaseCompositor::RenderLayerIteator GrBaseCompositor::end()
     return fLayerIDMap.end();
 }
 
+int64_t GrBaseCompositor::droppedFrames() const
+{
+    int64_t dropped = fRemovedDroppedFrames;
+    for (const LayerBinder& binder : fLayers)
+        dropped += binder.fDroppedFrames;
+    return dropped;
+}
+
 void GrBaseCompositor::submit(GrBaseRenderLayer *who, const GrLayerResult& result, const SkIRect& clipRect)
 {
-    RUNTIME_EXCEPTION_ASSERT(fLayerIDMap.contains(who->zindex()));
+    {
+        std::scoped_lock<std::mutex> scopedLock(fSubmitMutex);
+        auto itr = fLayerIDMap.find(who->zindex());
+        RUNTIME_EXCEPTION_ASSERT(itr != fLayerIDMap.end());
+
+        LayerBinder& binder = fLayers[itr->second];
+        RUNTIME_EXCEPTION_ASSERT(binder.fHandle != nullptr);
+
+        if (binder.fPending)
+            binder.fDroppedFrames++;
+        binder.fSubmittedImage = result;
+        binder.fSubmittedClip = clipRect;
+        binder.fPending = true;
+    }
+
+    if (who->visible())
+        damage(who->matrix().mapRect(SkRect::Make(clipRect)).roundOut());
+}
+
+void GrBaseCompositor::damage(const SkIRect& rect)
+{
+    SkIRect clipped;
+    if (!clipped.intersect(rect, SkIRect::MakeWH(fWidth, fHeight)))
+        return;
 
-    RenderLayerID layerID = fLayerIDMap[who->zindex()];
-    LayerBinder& binder = fLayers[layerID];
-    RUNTIME_EXCEPTION_ASSERT(binder.fHandle != nullptr);
+    std::scoped_lock<std::mutex> scopedLock(fDamageMutex);
+    fDamageRegion.op(clipped, SkRegion::kUnion_Op);
+}
 
-    if (binder.fSubmittedImage.valid())
-        binder.fDroppedFrames++;
-    binder.fSubmittedImage = result;
-    binder.fSubmittedClip = clipRect;
+void GrBaseCompositor::setPartialRecomposite(bool enable)
+{
+    fPartialRecomposite = enable;
+}
+
+SkIRect GrBaseCompositor::layerBounds(const LayerBinder& binder) const
+{
+    return binder.fHandle->bounds();
+}
+
+GrBaseCompositor::DamageList GrBaseCompositor::collectDamage()
+{
+    std::scoped_lock<std::mutex> scopedLock(fDamageMutex);
+    if (!fPartialRecomposite)
+        fDamageRegion.setRect(SkIRect::MakeWH(fWidth, fHeight));
+
+    DamageList damage;
+    for (SkRegion::Iterator itr(fDamageRegion); !itr.done(); itr.next())
+        damage.push_back(itr.rect());
+    fDamageRegion.setEmpty();
+    return damage;
 }
 
 void GrBaseCompositor::present()
 {
     GrTargetSurface target = onTargetSurface();
+    DamageList damage = collectDamage();
+
+    if (!damage.empty())
+        onRecomposite(target, damage);
 
     for (auto& layerIDPair : fLayerIDMap)
+        fLayers[layerIDPair.second].fPending = false;
+    onPresent(damage);
+}
+
+void GrBaseCompositor::waitForPublished()
+{
+    this->onWaitForPublished();
+}
+
+void GrBaseCompositor::onWaitForPublished()
+{
+}
+
+void GrBaseCompositor::onRecomposite(GrTargetSurface& target, const DamageList& damage)
+{
+    for (const SkIRect& rect : damage)
+        recompositeRect(target, rect);
+}
+
+void GrBaseCompositor::recompositeRect(GrTargetSurface& target, const SkIRect& rect,
+                                       const SkIPoint& origin)
+{
+    VisibleLayerList visibleParts;
+    SkRegion uncovered = collectVisibleLayers(rect, visibleParts);
+
+    /* Areas under opaque layers will be overwritten, no need to clear */
+    for (SkRegion::Iterator itr(uncovered); !itr.done(); itr.next())
+    {
+        SkIRect localRect = itr.rect().makeOffset(-origin.x(), -origin.y());
+        if (target.kind() == GrTargetSurface::Kind::kSkSurface)
+            skClear(target.asSkSurface(), localRect);
+#ifdef COCOA_USE_OPENCL
+        else if (target.kind() == GrTargetSurface::Kind::kOpenClSurface)
+            clClear(target.asClSurface(), localRect);
+#endif /* COCOA_USE_OPENCL */
+    }
+
+    for (auto itr = visibleParts.rbegin(); itr != visibleParts.rend(); itr++)
+    {
+        for (SkRegion::Iterator partItr(itr->second); !partItr.done(); partItr.next())
+            compositeLayerRect(target, *itr->first, partItr.rect(), origin);
+    }
+}
+
+SkRegion GrBaseCompositor::collectVisibleLayers(const SkIRect& rect, VisibleLayerList& visibleParts)
+{
+    /* From top to bottom, each layer only shows the parts
+       which are not covered by opaque layers above it */
+    SkRegion uncovered(rect);
+    for (auto itr = fLayerIDMap.rbegin(); itr != fLayerIDMap.rend(); itr++)
     {
-        LayerBinder& binder = fLayers[layerIDPair.second];
+        LayerBinder& binder = fLayers[itr->second];
         if (binder.fHandle == nullptr)
             continue;
         if (!binder.fHandle->visible()
             || !binder.fSubmittedImage.valid())
             continue;
 
-        SkRect srcClip = SkRect::MakeLTRB(binder.fSubmittedClip.left(),
-                                          binder.fSubmittedClip.top(),
-                                          binder.fSubmittedClip.right(),
-                                          binder.fSubmittedClip.bottom());
+        SkRegion part(layerBounds(binder));
+        if (!part.op(uncovered, SkRegion::kIntersect_Op))
+            continue;
+        SkIRect cover;
+        if (layerCoverage(binder, &cover))
+            uncovered.op(cover, SkRegion::kDifference_Op);
+        visibleParts.emplace_back(&binder, std::move(part));
 
-        SkRect dstClip = SkRect::MakeLTRB(binder.fHandle->left() + srcClip.left(),
-                                          binder.fHandle->top() + srcClip.top(),
-                                          binder.fHandle->left() + srcClip.right(),
-                                          binder.fHandle->top() + srcClip.bottom());
+        if (uncovered.isEmpty())
+            break;
+    }
+    return uncovered;
+}
 
-        if (target.kind() == GrTargetSurface::Kind::kSkSurface)
-        {
-            skComposite(target.asSkSurface(),
-                        binder.fSubmittedImage.asImage(),
-                        srcClip, dstClip);
-        }
+bool GrBaseCompositor::layerCoverage(LayerBinder& binder, SkIRect *cover)
+{
+    GrBaseRenderLayer *layer = binder.fHandle;
+    if (layer->opacity() < 1.0f
+        || layer->blendMode() != SkBlendMode::kSrcOver
+        || !layer->transform().rectStaysRect())
+        return false;
+
+    bool opaque = layer->opaque();
+    if (!opaque && binder.fSubmittedImage.kind() != GrLayerResult::Kind::kOpenClImage)
+    {
+        sk_sp<SkImage> image = binder.fSubmittedImage.asImage();
+        opaque = image != nullptr && image->isOpaque();
+    }
+    if (!opaque)
+        return false;
+
+    /* Edge pixels of a scaled layer may be partially covered */
+    *cover = layer->matrix().mapRect(SkRect::MakeIWH(layer->width(), layer->height())).roundIn();
+    return true;
+}
+
+void GrBaseCompositor::compositeLayerRect(GrTargetSurface& target,
+                                          LayerBinder& binder,
+                                          const SkIRect& rect,
+                                          const SkIPoint& origin)
+{
+    SkIRect dstRect;
+    if (!dstRect.intersect(layerBounds(binder), rect))
+        return;
+
+    SkIRect clip = dstRect.makeOffset(-origin.x(), -origin.y());
+    SkMatrix matrix = binder.fHandle->matrix();
+    matrix.postTranslate(SkIntToScalar(-origin.x()), SkIntToScalar(-origin.y()));
+
+    if (target.kind() == GrTargetSurface::Kind::kSkSurface)
+    {
+        skComposite(target.asSkSurface(),
+                    binder.fSubmittedImage.asImage(),
+                    matrix, clip,
+                    binder.fHandle->fProperties);
+    }
 #ifdef COCOA_USE_OPENCL
-        else if (target.kind() == GrTargetSurface::Kind::kOpenClSurface)
-        {
-            clComposite(target.asClSurface(),
-                        binder.fSubmittedImage.asOpenCLImage(),
-                        srcClip, dstClip);
-        }
+    else if (target.kind() == GrTargetSurface::Kind::kOpenClSurface)
+    {
+        clComposite(target.asClSurface(),
+                    binder.fSubmittedImage.asOpenCLImage(),
+                    matrix, clip,
+                    binder.fHandle->fProperties);
+    }
 #endif /* COCOA_USE_OPENCL */
-        else
-        {
-            throw RuntimeException::Builder(__FUNCTION__)
-                    .append("Invalid kind of target surface")
-                    .make<RuntimeException>();
-        }
+    else
+    {
+        throw RuntimeException::Builder(__FUNCTION__)
+                .append("Invalid kind of target surface")
+                .make<RuntimeException>();
     }
-    onPresent();
 }
 
-void GrBaseCompositor::skComposite(SkSurface *target, const sk_sp<SkImage> &image,
-                                   const SkRect &srcClip, const SkRect &dstClip)
+void GrBaseCompositor::skComposite(SkSurface *target, const sk_sp<SkImage>& image,
+                                   const SkMatrix& matrix, const SkIRect& clip,
+                                   const LayerProperties& props)
 {
     SkPaint paint;
-    paint.setBlendMode(SkBlendMode::kSrcOver);
-    target->getCanvas()->drawImageRect(image, srcClip, dstClip,
-                                       &paint, SkCanvas::kStrict_SrcRectConstraint);
+    paint.setAlphaf(props.fOpacity);
+    paint.setBlendMode(props.fBlendMode);
+    /* Pixels are copied exactly if they are not resampled */
+    if (!IsIntegerTranslate(matrix))
+        paint.setFilterQuality(kLow_SkFilterQuality);
+
+    SkCanvas *canvas = target->getCanvas();
+    canvas->save();
+    canvas->clipIRect(clip);
+    canvas->concat(matrix);
+    canvas->drawImage(image, 0, 0, &paint);
+    canvas->restore();
+}
+
+bool GrBaseCompositor::IsIntegerTranslate(const SkMatrix& matrix)
+{
+    return matrix.isTranslate()
+           && SkScalarIsInt(matrix.getTranslateX())
+           && SkScalarIsInt(matrix.getTranslateY());
+}
+
+void GrBaseCompositor::skClear(SkSurface *target, const SkIRect& rect)
+{
+    SkCanvas *canvas = target->getCanvas();
+    canvas->save();
+    canvas->clipIRect(rect);
+    canvas->clear(SK_ColorTRANSPARENT);
+    canvas->restore();
 }
 
 #ifdef COCOA_USE_OPENCL
 void GrBaseCompositor::clComposite(::cl_mem target, ::cl_mem image,
-                                   const SkRect &srcClip, const SkRect &dstClip)
+                                   const SkMatrix& matrix, const SkIRect& clip,
+                                   const LayerProperties& props)
+{
+    throw RuntimeException::Builder(__FUNCTION__)
+            .append("Not implemented yet")
+            .make<RuntimeException>();
+}
+
+void GrBaseCompositor::clClear(::cl_mem target, const SkIRect& rect)
 {
     throw RuntimeException::Builder(__FUNCTION__)
             .append("Not implemented yet")
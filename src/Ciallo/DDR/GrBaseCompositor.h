@@ -12,6 +12,7 @@
 #include "include/core/SkSurface.h"
 #include "include/core/SkImage.h"
 #include "include/core/SkRect.h"
+#include "include/core/SkRegion.h"
 #include "include/gpu/GrDirectContext.h"
 
 #include "Ciallo/GrBase.h"
@@ -72,6 +73,8 @@ struct LayerBinder
     GrBaseRenderLayer *fHandle = nullptr;
     SkIRect          fSubmittedClip;
     GrLayerResult    fSubmittedImage;
+    /* Submitted but not presented yet */
+    bool             fPending = false;
     int64_t          fDroppedFrames = 0;
 };
 
@@ -80,6 +83,7 @@ class GrBaseCompositor : public std::enable_shared_from_this<GrBaseCompositor>
 public:
     using RenderLayerID = uint32_t;
     using RenderLayerIteator = std::map<int, RenderLayerID>::iterator;
+    using DamageList = std::vector<SkIRect>;
 
     virtual ~GrBaseCompositor();
 
@@ -105,6 +109,18 @@ public:
 
     void submit(GrBaseRenderLayer *who, const GrLayerResult& result, const SkIRect& clipRect);
 
+    /**
+     * @brief Marks a rectangle of the target surface as damaged.
+     *
+     * Damaged areas are accumulated until next present() and only
+     * these areas will be recomposited. Submitting, moving, showing,
+     * hiding and swapping layers damage the target automatically.
+     *
+     * @param rect: Rectangle in the coordinate of target surface,
+     *              will be clipped by the bounds of target surface.
+     */
+    void damage(const SkIRect& rect);
+
     /**
      * @brief Presents current frame.
      * 
@@ -116,9 +132,21 @@ public:
      * Note that even if the rasterizer submits textures multiple times,
      * they will not be displayed until present is called. The content of
      * the final frame is the last texture submitted.
+     * Only the damaged areas (see damage()) are recomposited, layers
+     * are composited from bottom to top in each damaged rectangle.
      */
     void present();
 
+    /**
+     * @brief Waits until all the presented frames are in the buffers
+     *        of platform.
+     *
+     * present() of an asynchronous compositor returns before the frame
+     * is published. Callers which expose or measure frames by themselves
+     * (benchmarks, replaying) should call this after present().
+     */
+    void waitForPublished();
+
     /**
      * @brief Creates a new render layer with a rasterizer.
      * @param width: Width of new layer.
@@ -135,12 +163,24 @@ public:
                                                       int32_t top,
                                                       int zindex);
 
+    /**
+     * @brief Unregisters a layer created by newRenderLayer().
+     *
+     * The area of the layer is damaged and its Z-index can be used
+     * by a new layer then. It must not race with present() or
+     * submissions of the layer, and the layer can't be updated after.
+     */
+    void removeRenderLayer(GrBaseRenderLayer *layer);
+
     /* Swaps two layers by their Z-index value */
     void swapRenderLayers(int a, int b);
 
     RenderLayerIteator begin();
     RenderLayerIteator end();
 
+    /* Number of submitted images replaced before being presented, of all layers */
+    int64_t droppedFrames() const;
+
 protected:
     GrBaseCompositor(CompositeDevice device,
                      int32_t width,
@@ -156,15 +196,82 @@ protected:
     void appendGpuExtensionsInfo(const std::string& ext);
     void appendNativeExtensionsInfo(const std::string& ext);
 
-    static void skComposite(SkSurface *target, const sk_sp<SkImage>& image,
-                            const SkRect& srcClip, const SkRect& dstClip);
+    /**
+     * If the content of target surface is not preserved between
+     * two frames (like a Vulkan swapchain), partial recomposition
+     * should be disabled and the whole frame will be damaged
+     * on each present().
+     */
+    void setPartialRecomposite(bool enable);
+
+    /**
+     * @brief Composites @a image into @a target with the opacity and
+     *        blend mode in @a props.
+     *
+     * @param matrix: Maps @a image to @a target, including the transform
+     *                and position of layer.
+     * @param clip: Only pixels inside it can be changed, in the
+     *              coordinate of @a target.
+     */
+    virtual void skComposite(SkSurface *target, const sk_sp<SkImage>& image,
+                             const SkMatrix& matrix, const SkIRect& clip,
+                             const LayerProperties& props);
+    static void skClear(SkSurface *target, const SkIRect& rect);
 #ifdef COCOA_USE_OPENCL
     virtual void clComposite(::cl_mem target, ::cl_mem image,
-                             const SkRect& srcClip, const SkRect& dstClip);
+                             const SkMatrix& matrix, const SkIRect& clip,
+                             const LayerProperties& props);
+    virtual void clClear(::cl_mem target, const SkIRect& rect);
 #endif
 
+    /* Whether the matrix only moves pixels by whole pixels */
+    static bool IsIntegerTranslate(const SkMatrix& matrix);
+
+    /**
+     * @brief Clears @a rect and composites all the visible layers
+     *        inside it from bottom to top.
+     *
+     * Layers are culled from top to bottom first, the parts hidden
+     * behind opaque layers are neither cleared nor composited.
+     *
+     * @param target: Surface to composite to.
+     * @param rect: Rectangle in the coordinate of whole frame.
+     * @param origin: Position of @a target in the whole frame, which
+     *                allows compositing into a part (tile) of the frame.
+     */
+    void recompositeRect(GrTargetSurface& target, const SkIRect& rect,
+                         const SkIPoint& origin = SkIPoint::Make(0, 0));
+
+    /* Visible parts of layers, from top to bottom */
+    using VisibleLayerList = std::vector<std::pair<LayerBinder*, SkRegion>>;
+
+    /**
+     * @brief Visibility pass of recompositeRect(), which collects the
+     *        parts of layers visible in @a rect. Parts hidden behind
+     *        opaque layers are excluded.
+     *
+     * @return The area of @a rect not covered by any opaque layer.
+     */
+    SkRegion collectVisibleLayers(const SkIRect& rect, VisibleLayerList& visible);
+
+    /**
+     * @brief Whether the layer covers everything under it, and
+     *        the covered rectangle in the frame if it does.
+     */
+    static bool layerCoverage(LayerBinder& binder, SkIRect *cover);
+
+    /**
+     * Recomposites the damaged areas, compositors may override
+     * this to composite them in parallel. By default, it calls
+     * recompositeRect() for each rectangle serially.
+     */
+    virtual void onRecomposite(GrTargetSurface& target, const DamageList& damage);
+
     virtual GrTargetSurface onTargetSurface() = 0;
-    virtual void onPresent() = 0;
+    /* @a damage is the list of recomposited rectangles, maybe empty */
+    virtual void onPresent(const DamageList& damage) = 0;
+    /* Compositors which publish frames asynchronously override it */
+    virtual void onWaitForPublished();
     virtual GrBaseRenderLayer *onCreateRenderLayer(int32_t width,
                                                    int32_t height,
                                                    int32_t left,
@@ -179,13 +286,25 @@ protected:
     static SkColorType ToSkColorType(GrColorFormat colorFormat);
 
 private:
+    SkIRect layerBounds(const LayerBinder& binder) const;
+    DamageList collectDamage();
+    void compositeLayerRect(GrTargetSurface& target, LayerBinder& binder,
+                            const SkIRect& rect, const SkIPoint& origin);
+
     int32_t                         fWidth;
     int32_t                         fHeight;
     GrColorFormat                   fColorFormat;
     CompositeBackendInfo            fBackendInfo;
     std::map<int, RenderLayerID>    fLayerIDMap;
     std::vector<LayerBinder>        fLayers;
+    /* Dropped frames of removed layers */
+    int64_t                         fRemovedDroppedFrames;
     GrBasePlatform                 *fPlatform;
+    bool                            fPartialRecomposite;
+    /* Layers may be submitted by several raster threads at the same time */
+    std::mutex                      fSubmitMutex;
+    std::mutex                      fDamageMutex;
+    SkRegion                        fDamageRegion;
 };
 
 CIALLO_END_NS
@@ -10,7 +10,11 @@ GrBasePlatform::GrBasePlatform(GrPlatformKind kind,
                                const GrPlatformOptions& opts)
     : fCompositor(nullptr),
       fKind(kind),
-      fOptions(opts)
+      fOptions(opts),
+      fLatestFrame(1),
+      fSkippedFrames(0),
+      fBackBuffer(0),
+      fFrontBuffer(2)
 {
 }
 
@@ -21,14 +25,58 @@ std::shared_ptr<GrBaseCompositor> GrBasePlatform::compositor()
     return fCompositor;
 }
 
-void GrBasePlatform::expose()
+uint8_t *GrBasePlatform::buffer(int32_t index)
 {
-    return this->onExpose();
+    RUNTIME_EXCEPTION_ASSERT(index >= 0 && index < kBufferCount);
+    return this->onBuffer(index);
 }
 
-uint8_t *GrBasePlatform::writableBuffer()
+int32_t GrBasePlatform::acquireBuffer()
 {
-    return this->onWritableBuffer();
+    return fBackBuffer;
+}
+
+void GrBasePlatform::releaseBuffer(const SkRegion& damage)
+{
+    if (damage.isEmpty())
+        return;
+
+    /* If the previous frame hasn't been displayed yet, its changes must be
+       displayed together with this frame. The consumer may take it after
+       the check, which only makes the damage larger than needed. */
+    SkRegion& frameDamage = fFrameDamage[fBackBuffer];
+    frameDamage = damage;
+    if (fLatestFrame.load(std::memory_order_acquire) & kFreshBit)
+        frameDamage.op(fUndisplayedDamage, SkRegion::kUnion_Op);
+    fUndisplayedDamage = frameDamage;
+
+    for (int32_t i = 0; i < kBufferCount; i++)
+    {
+        if (i == fBackBuffer)
+            fOutdatedRegions[i].setEmpty();
+        else
+            fOutdatedRegions[i].op(damage, SkRegion::kUnion_Op);
+    }
+
+    uint32_t previous = fLatestFrame.exchange(fBackBuffer | kFreshBit, std::memory_order_acq_rel);
+    if (previous & kFreshBit)
+        fSkippedFrames.fetch_add(1, std::memory_order_relaxed);
+    fBackBuffer = static_cast<int32_t>(previous & kIndexMask);
+}
+
+void GrBasePlatform::expose(const SkIRect& exposed)
+{
+    SkRegion damage;
+    if (fLatestFrame.load(std::memory_order_relaxed) & kFreshBit)
+    {
+        uint32_t latest = fLatestFrame.exchange(fFrontBuffer, std::memory_order_acq_rel);
+        fFrontBuffer = static_cast<int32_t>(latest & kIndexMask);
+        damage = fFrameDamage[fFrontBuffer];
+    }
+
+    if (!exposed.isEmpty())
+        damage.op(exposed, SkRegion::kUnion_Op);
+    return this->onExpose(damage);
 }
 
 CIALLO_END_NS
@@ -3,7 +3,11 @@
 
 #include <memory>
 #include <vector>
-#include <mutex>
+#include <string>
+#include <atomic>
+
+#include "include/core/SkRect.h"
+#include "include/core/SkRegion.h"
 
 #include "Core/Exception.h"
 #include "Ciallo/GrBase.h"
@@ -12,7 +16,8 @@ CIALLO_BEGIN_NS
 
 enum class GrPlatformKind
 {
-    kXcb
+    kXcb,
+    kHeadless
 };
 
 struct GrPlatformOptions
@@ -39,21 +44,126 @@ struct GrPlatformOptions
      */
      std::string opencl_platform_keyword;
      std::string opencl_device_keyword;
+
+    /**
+     * Built OpenCL programs are cached as binaries in
+     * @a opencl_binary_cache_dir, so that later launches skip the
+     * compilation. An empty directory disables the cache.
+     */
+    std::string opencl_binary_cache_dir;
+
+    /**
+     * If CPU compositor is used, following options will be used.
+     * A tiled compositor splits the frame into square tiles of
+     * @a cpu_tile_size pixels and composites them in parallel.
+     * @a cpu_composite_threads is 0 means the number of CPU cores.
+     */
+    bool cpu_tiled_composite = false;
+    int32_t cpu_tile_size = 256;
+    int32_t cpu_composite_threads = 0;
+
+    /**
+     * If @a cpu_tiled_raster is true, CPU render layers are split into
+     * tiles of @a cpu_raster_tile_size pixels, which are rasterized in
+     * parallel by @a cpu_composite_threads threads.
+     */
+    bool cpu_tiled_raster = false;
+    int32_t cpu_raster_tile_size = 256;
+
+    /**
+     * Layers are rasterized in parallel by @a raster_threads threads,
+     * 0 means the number of CPU cores and 1 means layers are rasterized
+     * one by one on the Renderer thread. Ignored by GPU compositor,
+     * whose context can't be shared by threads.
+     */
+    int32_t raster_threads = 0;
+
+    /**
+     * Pictures of paint nodes which stay unchanged for
+     * @a raster_cache_stable_frames updates are rasterized once and
+     * cached, up to @a raster_cache_budget bytes (0 disables the cache).
+     * Ignored by GPU compositor.
+     */
+    int64_t raster_cache_budget = 64 << 20;
+    int32_t raster_cache_stable_frames = 3;
+
+    /**
+     * If @a zero_copy_present is true, the CPU compositor composites
+     * into the frame buffers of platform directly, so that presenting
+     * is just a handoff of the buffer.
+     */
+    bool zero_copy_present = false;
+
+    /**
+     * XCB platform sends frames through MIT-SHM if the X server
+     * supports it. Otherwise, or @a xcb_use_shm is false, the
+     * whole frame is sent through the connection.
+     */
+    bool xcb_use_shm = true;
+
+    /**
+     * Headless platform writes exposed frames into @a headless_dump_dir
+     * if it is not empty, as PNG images or, if @a headless_dump_raw
+     * is true, as raw pixels in the color format of compositor.
+     */
+    std::string headless_dump_dir;
+    bool headless_dump_raw = false;
+
+    /**
+     * GraphicsContext captures frames into @a frame_capture_dir
+     * from the beginning if it is not empty, see FrameCapture.
+     */
+    std::string frame_capture_dir;
 };
 
+/**
+ * Platform owns kBufferCount frame buffers, which are handed off between
+ * a producer (compositor, on Renderer thread) and a consumer (expose(),
+ * on the thread of window system) without locks:
+ *
+ * - The producer always owns a buffer to write, which is obtained by
+ *   acquireBuffer() and published as the latest frame by releaseBuffer().
+ * - The consumer owns the front buffer, and expose() takes the latest
+ *   published frame as the new front buffer.
+ * - The third buffer holds the latest published frame. If the producer
+ *   publishes a new frame before the consumer takes it, it is skipped
+ *   and counted by skippedFrames().
+ *
+ * A buffer acquired by the producer holds an older frame, the areas
+ * changed since then are given by ScopedAcquireBuffer::outdated().
+ */
 class GrBasePlatform
 {
 public:
+    static constexpr int32_t kBufferCount = 3;
+
     class ScopedAcquireBuffer
     {
     public:
         explicit ScopedAcquireBuffer(GrBasePlatform *platform)
-            : fPlatform(platform) { fPlatform->acquireBuffer(); }
+            : fPlatform(platform), fIndex(platform->acquireBuffer()) {}
         ~ScopedAcquireBuffer()
-        { fPlatform->releaseBuffer(); }
+        { fPlatform->releaseBuffer(fDamage); }
+
+        inline int32_t index() const    { return fIndex; }
+        inline uint8_t *buffer()        { return fPlatform->buffer(fIndex); }
+
+        /* Areas of the buffer which are older than the latest published frame */
+        inline const SkRegion& outdated() const
+        { return fPlatform->fOutdatedRegions[fIndex]; }
+
+        /**
+         * @brief Marks an area of the frame which is different from
+         *        the latest published frame. Nothing is published
+         *        if no area is damaged.
+         */
+        inline void damage(const SkIRect& rect)
+        { fDamage.op(rect, SkRegion::kUnion_Op); }
 
     private:
         GrBasePlatform  *fPlatform;
+        int32_t          fIndex;
+        SkRegion         fDamage;
     };
 
     virtual ~GrBasePlatform() = default;
@@ -66,17 +176,33 @@ public:
     inline GrPlatformKind kind() const              { return fKind; }
     inline const GrPlatformOptions& options() const { return fOptions; }
 
-    bool tryAcquireBuffer()
-    { return fBufferMutex.try_lock(); }
+    /**
+     * @brief Gets the buffer owned by producer, which never blocks.
+     *        Only one buffer can be acquired at the same time.
+     */
+    int32_t acquireBuffer();
+
+    /* Publishes the acquired buffer as the latest frame if @a damage is not empty */
+    void releaseBuffer(const SkRegion& damage);
+
+    /* Gets the address of frame buffer by index */
+    uint8_t *buffer(int32_t index);
 
-    void acquireBuffer()
-    { fBufferMutex.lock(); }
+    /* Index of the buffer displayed by expose(), only used by consumer */
+    inline int32_t frontBuffer() const  { return fFrontBuffer; }
 
-    void releaseBuffer()
-    { fBufferMutex.unlock(); }
+    /* Number of frames published but never displayed */
+    inline uint64_t skippedFrames() const
+    { return fSkippedFrames.load(std::memory_order_relaxed); }
 
-    uint8_t *writableBuffer();
-    void expose();
+    /**
+     * @brief Takes the latest published frame and displays the areas
+     *        which are changed since last expose().
+     *
+     * @param exposed: An area of window which is exposed by the window
+     *                 system and should be redrawn, maybe empty.
+     */
+    void expose(const SkIRect& exposed = SkIRect::MakeEmpty());
 
 protected:
     GrBasePlatform(GrPlatformKind kind,
@@ -85,14 +211,31 @@ protected:
     inline GrPlatformOptions& writableOptions()  { return fOptions; }
     virtual std::shared_ptr<GrBaseCompositor> onCreateCompositor() = 0;
 
-    virtual uint8_t *onWritableBuffer() = 0;
-    virtual void onExpose() = 0;
+    virtual uint8_t *onBuffer(int32_t index) = 0;
+    virtual void onExpose(const SkRegion& damage) = 0;
 
 private:
+    static constexpr uint32_t kIndexMask = 0x3;
+    static constexpr uint32_t kFreshBit = 0x4;
+
     std::shared_ptr<GrBaseCompositor>   fCompositor;
     GrPlatformKind                      fKind;
     GrPlatformOptions                   fOptions;
-    std::mutex                          fBufferMutex;
+
+    /* Index of the latest frame, with kFreshBit if it hasn't been displayed */
+    std::atomic<uint32_t>               fLatestFrame;
+    std::atomic<uint64_t>               fSkippedFrames;
+
+    /* Producer only */
+    int32_t                             fBackBuffer;
+    SkRegion                            fOutdatedRegions[kBufferCount];
+    SkRegion                            fUndisplayedDamage;
+
+    /* Consumer only */
+    int32_t                             fFrontBuffer;
+
+    /* Changes since the previous displayed frame, handed off with the buffer */
+    SkRegion                            fFrameDamage[kBufferCount];
 };
 
 CIALLO_END_NS
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <Poco/UUID.h>
 #include <Poco/UUIDGenerator.h>
 
@@ -76,13 +78,79 @@ int GrBaseRenderLayer::depress()
 
 void GrBaseRenderLayer::setVisibility(bool visible)
 {
+    if (fProperties.fVisible == visible)
+        return;
     fProperties.fVisible = visible;
+    damageBounds();
+}
+
+void GrBaseRenderLayer::setOpaque(bool opaque)
+{
+    if (fProperties.fOpaque == opaque)
+        return;
+    fProperties.fOpaque = opaque;
+    if (fProperties.fVisible)
+        damageBounds();
+}
+
+void GrBaseRenderLayer::setOpacity(float opacity)
+{
+    opacity = std::clamp(opacity, 0.0f, 1.0f);
+    if (fProperties.fOpacity == opacity)
+        return;
+    fProperties.fOpacity = opacity;
+    if (fProperties.fVisible)
+        damageBounds();
+}
+
+void GrBaseRenderLayer::setTransform(const SkMatrix& matrix)
+{
+    RUNTIME_EXCEPTION_ASSERT(!matrix.hasPerspective());
+    if (fProperties.fTransform == matrix)
+        return;
+
+    if (fProperties.fVisible)
+        damageBounds();
+    fProperties.fTransform = matrix;
+    if (fProperties.fVisible)
+        damageBounds();
+}
+
+void GrBaseRenderLayer::setBlendMode(SkBlendMode mode)
+{
+    if (fProperties.fBlendMode == mode)
+        return;
+    fProperties.fBlendMode = mode;
+    if (fProperties.fVisible)
+        damageBounds();
+}
+
+SkMatrix GrBaseRenderLayer::matrix() const
+{
+    SkMatrix matrix(fProperties.fTransform);
+    matrix.postTranslate(SkIntToScalar(fProperties.fLeft), SkIntToScalar(fProperties.fTop));
+    return matrix;
+}
+
+SkIRect GrBaseRenderLayer::bounds() const
+{
+    if (fProperties.fTransform.isIdentity())
+        return SkIRect::MakeXYWH(left(), top(), width(), height());
+    return matrix().mapRect(SkRect::MakeIWH(width(), height())).roundOut();
 }
 
 void GrBaseRenderLayer::moveTo(int32_t left, int32_t top)
 {
+    if (fProperties.fLeft == left && fProperties.fTop == top)
+        return;
+
+    /* Both of the old and new area should be recomposited */
+    if (fProperties.fVisible)
+        damageBounds();
     fProperties.fLeft = left;
     fProperties.fTop = top;
+    if (fProperties.fVisible)
+        damageBounds();
 }
 
 void GrBaseRenderLayer::update()
@@ -95,6 +163,11 @@ void GrBaseRenderLayer::update()
                                          fDirtyBoundary.fTop,
                                          fDirtyBoundary.fRight,
                                          fDirtyBoundary.fBottom);
+    if (!clipRect.intersect(SkIRect::MakeWH(width(), height())))
+    {
+        fDirtyBoundary = DirtyBoundary();
+        return;
+    }
 
     fCompositor->submit(this, onLayerResult(), clipRect);
 
@@ -107,16 +180,69 @@ void GrBaseRenderLayer::update()
 void GrBaseRenderLayer::paint(const sk_sp<SkPicture>& picture,
                             int32_t left,
                             int32_t top,
-                            const SkPaint *paint)
+                            const SkPaint *paint,
+                            const SkIRect *clip)
 {
-    SkMatrix mat = SkMatrix::Translate(left, top);
-    getCanvas()->drawPicture(picture, &mat, paint);
-
     SkRect cullRect = picture->cullRect();
-    updateDirtyBoundary(SkIRect::MakeLTRB(left + cullRect.left(),
+    SkIRect dirtyRect = SkIRect::MakeLTRB(left + cullRect.left(),
                                           top + cullRect.top(),
                                           left + cullRect.right(),
-                                          top + cullRect.bottom()));
+                                          top + cullRect.bottom());
+    if (clip != nullptr && !dirtyRect.intersect(*clip))
+        return;
+
+    SkCanvas *canvas = getCanvas();
+    SkMatrix mat = SkMatrix::Translate(left, top);
+    if (clip != nullptr)
+    {
+        canvas->save();
+        canvas->clipIRect(*clip);
+        canvas->drawPicture(picture, &mat, paint);
+        canvas->restore();
+    }
+    else
+        canvas->drawPicture(picture, &mat, paint);
+
+    updateDirtyBoundary(dirtyRect);
+}
+
+void GrBaseRenderLayer::drawImage(const sk_sp<SkImage>& image,
+                                  int32_t left,
+                                  int32_t top,
+                                  const SkPaint *paint,
+                                  const SkIRect *clip)
+{
+    SkIRect dirtyRect = SkIRect::MakeXYWH(left, top, image->width(), image->height());
+    if (clip != nullptr && !dirtyRect.intersect(*clip))
+        return;
+
+    SkCanvas *canvas = getCanvas();
+    if (clip != nullptr)
+    {
+        canvas->save();
+        canvas->clipIRect(*clip);
+        canvas->drawImage(image, left, top, SkSamplingOptions(), paint);
+        canvas->restore();
+    }
+    else
+        canvas->drawImage(image, left, top, SkSamplingOptions(), paint);
+
+    updateDirtyBoundary(dirtyRect);
+}
+
+void GrBaseRenderLayer::clear(const SkIRect& rect)
+{
+    SkIRect clearRect = rect;
+    if (!clearRect.intersect(SkIRect::MakeWH(width(), height())))
+        return;
+
+    SkCanvas *canvas = getCanvas();
+    canvas->save();
+    canvas->clipIRect(clearRect);
+    canvas->clear(SK_ColorTRANSPARENT);
+    canvas->restore();
+
+    updateDirtyBoundary(clearRect);
 }
 
 void GrBaseRenderLayer::drawImageFile(const std::string &file,
@@ -167,6 +293,17 @@ void GrBaseRenderLayer::drawImageFile(const std::string &file,
 
 void GrBaseRenderLayer::updateDirtyBoundary(const SkIRect& rect)
 {
+    /* An empty boundary must not be joined, or it always contains (0, 0) */
+    if (fDirtyBoundary.fLeft == fDirtyBoundary.fRight
+        || fDirtyBoundary.fTop == fDirtyBoundary.fBottom)
+    {
+        fDirtyBoundary.fLeft = rect.left();
+        fDirtyBoundary.fTop = rect.top();
+        fDirtyBoundary.fRight = rect.right();
+        fDirtyBoundary.fBottom = rect.bottom();
+        return;
+    }
+
     if (fDirtyBoundary.fLeft > rect.left())
         fDirtyBoundary.fLeft = rect.left();
 
@@ -186,9 +323,16 @@ SkCanvas *GrBaseRenderLayer::getCanvas()
         fCanvas = onCreateCanvas();
 
     RUNTIME_EXCEPTION_ASSERT(fCanvas != nullptr);
+    onPrepareCanvas();
     return fCanvas;
 }
 
+void GrBaseRenderLayer::damageBounds()
+{
+    if (fCompositor != nullptr)
+        fCompositor->damage(bounds());
+}
+
 void GrBaseRenderLayer::setCompositor(const std::shared_ptr<GrBaseCompositor>& ptr)
 {
     fCompositor = ptr;
@@ -7,9 +7,12 @@
 #include <Poco/UUID.h>
 
 #include "include/core/SkPicture.h"
+#include "include/core/SkImage.h"
 #include "include/core/SkPaint.h"
 #include "include/core/SkCanvas.h"
 #include "include/core/SkRect.h"
+#include "include/core/SkMatrix.h"
+#include "include/core/SkBlendMode.h"
 
 #include "Core/Exception.h"
 #include "Ciallo/GrBase.h"
@@ -27,6 +30,11 @@ struct LayerProperties
     int32_t    fTop = 0;
     int        fZIndex;
     bool       fVisible = false;
+    bool       fOpaque = false;
+    /* Applied at composite time, the rasterized content is untouched */
+    float       fOpacity = 1.0f;
+    SkBlendMode fBlendMode = SkBlendMode::kSrcOver;
+    SkMatrix    fTransform;
     Poco::UUID fUUID;
 };
 
@@ -57,6 +65,24 @@ public:
     { return fProperties.fZIndex; }
     inline bool visible() const
     { return fProperties.fVisible; }
+    inline bool opaque() const
+    { return fProperties.fOpaque; }
+    inline float opacity() const
+    { return fProperties.fOpacity; }
+    inline SkBlendMode blendMode() const
+    { return fProperties.fBlendMode; }
+    inline const SkMatrix& transform() const
+    { return fProperties.fTransform; }
+
+    /**
+     * @brief Gets the matrix which maps the layer's content to
+     *        the frame, that is, transform() followed by a translation
+     *        to the position of layer.
+     */
+    SkMatrix matrix() const;
+
+    /* Bounds of the transformed layer in the frame */
+    SkIRect bounds() const;
 
     /**
      * @brief  Increase or decrease the Z-index value of this layer.
@@ -84,10 +110,40 @@ public:
      */
     void setVisibility(bool visible);
 
+    /**
+     * @brief Declares that every pixel of the layer is opaque.
+     *
+     * Compositor skips the layers (or parts of layers) covered by
+     * an opaque layer. Layers whose images have opaque alpha type
+     * are treated as opaque even if this is not declared.
+     * Declaring a layer with translucent pixels as opaque leads to
+     * undefined content under these pixels.
+     */
+    void setOpaque(bool opaque);
+
+    /**
+     * @brief Set the opacity, transform and blend mode of layer.
+     *
+     * They are applied by compositor when the layer is composited,
+     * so that changing them only costs a recomposition of affected
+     * areas instead of a rasterization of the layer.
+     *
+     * @param opacity: From 0 (transparent) to 1 (no change).
+     * @param matrix: Affine transform (scale, rotate, translate and so on)
+     *                in the layer's coordinate, whose origin is
+     *                the upper-left corner of layer. Perspective is
+     *                not supported.
+     * @param mode: How the layer is blended with the layers under it.
+     */
+    void setOpacity(float opacity);
+    void setTransform(const SkMatrix& matrix);
+    void setBlendMode(SkBlendMode mode);
+
     /**
      * @brief Change the position of layer, can be out of screen.
      * 
-     * It effects nothing until you call update().
+     * Both of the old and new area are damaged and the layer will be
+     * displayed at new position after next present() of compositor.
      *
      * @param px: x coordinate.
      * @param py: y coordinate.
@@ -116,11 +172,25 @@ public:
      * @param top: Offset on y coordinate.
      * @param paint: SkPaint to apply transparency, filtering and so on.
      *               Maybe nullptr.
+     * @param clip: Only the pixels inside it are touched if it is not nullptr.
+     *              Pictures recorded with a bounding box hierarchy
+     *              skip the operations out of clip.
     */
     void paint(const sk_sp<SkPicture>& picture,
                int32_t left,
                int32_t top,
-               const SkPaint *paint = nullptr);
+               const SkPaint *paint = nullptr,
+               const SkIRect *clip = nullptr);
+
+    /* Draws an image at (@a left, @a top), with the same clip as paint() */
+    void drawImage(const sk_sp<SkImage>& image,
+                   int32_t left,
+                   int32_t top,
+                   const SkPaint *paint = nullptr,
+                   const SkIRect *clip = nullptr);
+
+    /* Makes pixels inside @a rect transparent */
+    void clear(const SkIRect& rect);
 
     void drawImageFile(const std::string& file,
                        int32_t x = 0,
@@ -137,6 +207,8 @@ protected:
 
     virtual GrLayerResult onLayerResult() = 0;
     virtual SkCanvas *onCreateCanvas() = 0;
+    /* Called before each drawing on the canvas, makes the pixels writable */
+    virtual void onPrepareCanvas() {}
 
     inline SkIRect dirtyBoundary() const
     {
@@ -151,6 +223,7 @@ private:
     void setCompositor(const std::shared_ptr<GrBaseCompositor>& ptr);
     void setZIndex(int z);
     void updateDirtyBoundary(const SkIRect& rect);
+    void damageBounds();
     SkCanvas *getCanvas();
 
 private:
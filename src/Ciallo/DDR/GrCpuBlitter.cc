@@ -0,0 +1,334 @@
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CIALLO_BLITTER_X86     1
+#endif
+
+#include "Ciallo/GrBase.h"
+#include "Ciallo/DDR/GrCpuBlitter.h"
+CIALLO_BEGIN_NS
+
+namespace {
+
+/**
+ * All the implementations compute (d * (255 - sa) + 128) / 255 by
+ * ((x + (x >> 8)) >> 8), which is the exact rounding of division by 255.
+ * So that different instruction sets produce the same pixels.
+ */
+inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+inline uint32_t blend_src_over_scalar(uint32_t s, uint32_t d)
+{
+    uint32_t inv = 255 - (s >> 24);
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t c = ((s >> shift) & 0xff) + div255(((d >> shift) & 0xff) * inv);
+        result |= (c > 0xff ? 0xff : c) << shift;
+    }
+    return result;
+}
+
+/* Multiplies all the channels of a premultiplied pixel by alpha */
+inline uint32_t scale_scalar(uint32_t s, uint32_t alpha)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        result |= div255(((s >> shift) & 0xff) * alpha) << shift;
+    return result;
+}
+
+void blit_row_src_over_scalar(uint32_t *dst, const uint32_t *src, int32_t count)
+{
+    for (int32_t i = 0; i < count; i++)
+    {
+        uint32_t s = src[i];
+        uint32_t sa = s >> 24;
+        if (sa == 0xff)
+        {
+            dst[i] = s;
+            continue;
+        }
+        else if (sa == 0)
+            continue;
+
+        dst[i] = blend_src_over_scalar(s, dst[i]);
+    }
+}
+
+void blit_row_src_over_alpha_scalar(uint32_t *dst, const uint32_t *src, int32_t count, uint32_t alpha)
+{
+    for (int32_t i = 0; i < count; i++)
+    {
+        uint32_t s = scale_scalar(src[i], alpha);
+        if ((s >> 24) == 0)
+            continue;
+        dst[i] = blend_src_over_scalar(s, dst[i]);
+    }
+}
+
+#ifdef CIALLO_BLITTER_X86
+
+__attribute__((target("sse4.1")))
+inline __m128i blend_src_over_sse41(__m128i s, __m128i d)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i c128 = _mm_set1_epi16(128);
+    /* Spread alpha of each pixel to its four 16-bit channels */
+    const __m128i alphaLo = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1,
+                                          7, -1, 7, -1, 7, -1, 7, -1);
+    const __m128i alphaHi = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1,
+                                          15, -1, 15, -1, 15, -1, 15, -1);
+
+    __m128i dLo = _mm_unpacklo_epi8(d, zero);
+    __m128i dHi = _mm_unpackhi_epi8(d, zero);
+    __m128i invLo = _mm_sub_epi16(c255, _mm_shuffle_epi8(s, alphaLo));
+    __m128i invHi = _mm_sub_epi16(c255, _mm_shuffle_epi8(s, alphaHi));
+
+    dLo = _mm_add_epi16(_mm_mullo_epi16(dLo, invLo), c128);
+    dHi = _mm_add_epi16(_mm_mullo_epi16(dHi, invHi), c128);
+    dLo = _mm_srli_epi16(_mm_add_epi16(dLo, _mm_srli_epi16(dLo, 8)), 8);
+    dHi = _mm_srli_epi16(_mm_add_epi16(dHi, _mm_srli_epi16(dHi, 8)), 8);
+
+    return _mm_adds_epu8(_mm_packus_epi16(dLo, dHi), s);
+}
+
+__attribute__((target("sse4.1")))
+inline __m128i scale_sse41(__m128i s, __m128i alpha)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c128 = _mm_set1_epi16(128);
+
+    __m128i sLo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), alpha), c128);
+    __m128i sHi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), alpha), c128);
+    sLo = _mm_srli_epi16(_mm_add_epi16(sLo, _mm_srli_epi16(sLo, 8)), 8);
+    sHi = _mm_srli_epi16(_mm_add_epi16(sHi, _mm_srli_epi16(sHi, 8)), 8);
+    return _mm_packus_epi16(sLo, sHi);
+}
+
+__attribute__((target("sse4.1")))
+void blit_row_src_over_sse41(uint32_t *dst, const uint32_t *src, int32_t count)
+{
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int32_t>(0xff000000));
+
+    int32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i sa = _mm_and_si128(s, alphaMask);
+
+        /* Fully transparent pixels leave the destination unchanged */
+        if (_mm_testz_si128(s, alphaMask))
+            continue;
+        /* Fully opaque pixels replace the destination */
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, alphaMask)) == 0xffff)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), s);
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), blend_src_over_sse41(s, d));
+    }
+    blit_row_src_over_scalar(dst + i, src + i, count - i);
+}
+
+__attribute__((target("sse4.1")))
+void blit_row_src_over_alpha_sse41(uint32_t *dst, const uint32_t *src, int32_t count, uint32_t alpha)
+{
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int32_t>(0xff000000));
+    const __m128i alpha16 = _mm_set1_epi16(static_cast<int16_t>(alpha));
+
+    int32_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i s = scale_sse41(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), alpha16);
+        if (_mm_testz_si128(s, alphaMask))
+            continue;
+
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), blend_src_over_sse41(s, d));
+    }
+    blit_row_src_over_alpha_scalar(dst + i, src + i, count - i, alpha);
+}
+
+__attribute__((target("avx2")))
+inline __m256i blend_src_over_avx2(__m256i s, __m256i d)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c255 = _mm256_set1_epi16(255);
+    const __m256i c128 = _mm256_set1_epi16(128);
+    /* Unpacking and shuffling work in 128-bit lanes */
+    const __m256i alphaLo = _mm256_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1,
+                                             7, -1, 7, -1, 7, -1, 7, -1,
+                                             3, -1, 3, -1, 3, -1, 3, -1,
+                                             7, -1, 7, -1, 7, -1, 7, -1);
+    const __m256i alphaHi = _mm256_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1,
+                                             15, -1, 15, -1, 15, -1, 15, -1,
+                                             11, -1, 11, -1, 11, -1, 11, -1,
+                                             15, -1, 15, -1, 15, -1, 15, -1);
+
+    __m256i dLo = _mm256_unpacklo_epi8(d, zero);
+    __m256i dHi = _mm256_unpackhi_epi8(d, zero);
+    __m256i invLo = _mm256_sub_epi16(c255, _mm256_shuffle_epi8(s, alphaLo));
+    __m256i invHi = _mm256_sub_epi16(c255, _mm256_shuffle_epi8(s, alphaHi));
+
+    dLo = _mm256_add_epi16(_mm256_mullo_epi16(dLo, invLo), c128);
+    dHi = _mm256_add_epi16(_mm256_mullo_epi16(dHi, invHi), c128);
+    dLo = _mm256_srli_epi16(_mm256_add_epi16(dLo, _mm256_srli_epi16(dLo, 8)), 8);
+    dHi = _mm256_srli_epi16(_mm256_add_epi16(dHi, _mm256_srli_epi16(dHi, 8)), 8);
+
+    return _mm256_adds_epu8(_mm256_packus_epi16(dLo, dHi), s);
+}
+
+__attribute__((target("avx2")))
+inline __m256i scale_avx2(__m256i s, __m256i alpha)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c128 = _mm256_set1_epi16(128);
+
+    __m256i sLo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), alpha), c128);
+    __m256i sHi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), alpha), c128);
+    sLo = _mm256_srli_epi16(_mm256_add_epi16(sLo, _mm256_srli_epi16(sLo, 8)), 8);
+    sHi = _mm256_srli_epi16(_mm256_add_epi16(sHi, _mm256_srli_epi16(sHi, 8)), 8);
+    return _mm256_packus_epi16(sLo, sHi);
+}
+
+__attribute__((target("avx2")))
+void blit_row_src_over_avx2(uint32_t *dst, const uint32_t *src, int32_t count)
+{
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int32_t>(0xff000000));
+
+    int32_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i sa = _mm256_and_si256(s, alphaMask);
+
+        if (_mm256_testz_si256(s, alphaMask))
+            continue;
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, alphaMask)) == -1)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), s);
+            continue;
+        }
+
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), blend_src_over_avx2(s, d));
+    }
+
+    /* Less than 8 pixels, try 4 pixels at once */
+    if (i + 4 <= count)
+    {
+        blit_row_src_over_sse41(dst + i, src + i, 4);
+        i += 4;
+    }
+    blit_row_src_over_scalar(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void blit_row_src_over_alpha_avx2(uint32_t *dst, const uint32_t *src, int32_t count, uint32_t alpha)
+{
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int32_t>(0xff000000));
+    const __m256i alpha16 = _mm256_set1_epi16(static_cast<int16_t>(alpha));
+
+    int32_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i s = scale_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), alpha16);
+        if (_mm256_testz_si256(s, alphaMask))
+            continue;
+
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), blend_src_over_avx2(s, d));
+    }
+    blit_row_src_over_alpha_sse41(dst + i, src + i, count - i, alpha);
+}
+
+#endif /* CIALLO_BLITTER_X86 */
+
+} // namespace anonymous
+
+GrCpuBlitter::GrCpuBlitter(ISA isa)
+    : fISA(isa),
+      fSrcOverProc(blit_row_src_over_scalar),
+      fSrcOverAlphaProc(blit_row_src_over_alpha_scalar)
+{
+#ifdef CIALLO_BLITTER_X86
+    switch (isa)
+    {
+    case ISA::kScalar:
+        fSrcOverProc = blit_row_src_over_scalar;
+        fSrcOverAlphaProc = blit_row_src_over_alpha_scalar;
+        break;
+    case ISA::kSSE41:
+        fSrcOverProc = blit_row_src_over_sse41;
+        fSrcOverAlphaProc = blit_row_src_over_alpha_sse41;
+        break;
+    case ISA::kAVX2:
+        fSrcOverProc = blit_row_src_over_avx2;
+        fSrcOverAlphaProc = blit_row_src_over_alpha_avx2;
+        break;
+    }
+#else
+    fISA = ISA::kScalar;
+#endif /* CIALLO_BLITTER_X86 */
+}
+
+GrCpuBlitter::ISA GrCpuBlitter::DetectISA()
+{
+#ifdef CIALLO_BLITTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return ISA::kAVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return ISA::kSSE41;
+#endif /* CIALLO_BLITTER_X86 */
+    return ISA::kScalar;
+}
+
+const char *GrCpuBlitter::ISAName(ISA isa)
+{
+    switch (isa)
+    {
+    case ISA::kScalar:
+        return "Scalar";
+    case ISA::kSSE41:
+        return "SSE4.1";
+    case ISA::kAVX2:
+        return "AVX2";
+    }
+    return "Unknown";
+}
+
+void GrCpuBlitter::blit(Mode mode,
+                        uint8_t *dst, size_t dstRowBytes,
+                        const uint8_t *src, size_t srcRowBytes,
+                        int32_t width, int32_t height,
+                        uint8_t alpha) const
+{
+    if (width <= 0 || height <= 0 || alpha == 0)
+        return;
+
+    for (int32_t y = 0; y < height; y++)
+    {
+        auto *dstRow = reinterpret_cast<uint32_t*>(dst + y * dstRowBytes);
+        auto *srcRow = reinterpret_cast<const uint32_t*>(src + y * srcRowBytes);
+
+        /* A translucent copy of opaque pixels is still a src-over blending */
+        if (alpha != 0xff)
+            fSrcOverAlphaProc(dstRow, srcRow, width, alpha);
+        else if (mode == Mode::kSrcCopy)
+            std::memcpy(dstRow, srcRow, width * sizeof(uint32_t));
+        else
+            fSrcOverProc(dstRow, srcRow, width);
+    }
+}
+
+CIALLO_END_NS
@@ -0,0 +1,67 @@
+#ifndef COCOA_GRCPUBLITTER_H
+#define COCOA_GRCPUBLITTER_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Ciallo/GrBase.h"
+CIALLO_BEGIN_NS
+
+/**
+ * GrCpuBlitter blends premultiplied 32-bit pixels (RGBA_8888 or BGRA_8888,
+ * alpha is always the highest byte) without any scaling or filtering.
+ * It is used by GrCpuCompositor for pixel-aligned and unscaled layers,
+ * which is the most common case of composition. Other cases are still
+ * handled by Skia.
+ *
+ * Instruction set is chosen at runtime, and all the implementations
+ * generate exactly the same results.
+ */
+class GrCpuBlitter
+{
+public:
+    enum class ISA
+    {
+        kScalar,
+        kSSE41,
+        kAVX2
+    };
+
+    enum class Mode
+    {
+        /* dst = src */
+        kSrcCopy,
+        /* dst = src + dst * (1 - src.alpha) */
+        kSrcOver
+    };
+
+    using BlitRowProc = void(*)(uint32_t *dst, const uint32_t *src, int32_t count);
+    using BlitRowAlphaProc = void(*)(uint32_t *dst, const uint32_t *src, int32_t count, uint32_t alpha);
+
+    explicit GrCpuBlitter(ISA isa);
+
+    /* The best instruction set supported by current CPU */
+    static ISA DetectISA();
+    static const char *ISAName(ISA isa);
+
+    inline ISA isa() const
+    { return fISA; }
+
+    /**
+     * @param alpha: Global opacity of source pixels, which are
+     *               multiplied by alpha / 255 before blending.
+     */
+    void blit(Mode mode,
+              uint8_t *dst, size_t dstRowBytes,
+              const uint8_t *src, size_t srcRowBytes,
+              int32_t width, int32_t height,
+              uint8_t alpha = 0xff) const;
+
+private:
+    ISA                 fISA;
+    BlitRowProc         fSrcOverProc;
+    BlitRowAlphaProc    fSrcOverAlphaProc;
+};
+
+CIALLO_END_NS
+#endif //COCOA_GRCPUBLITTER_H
@@ -1,13 +1,18 @@
 #include <memory>
+#include <algorithm>
+#include <cstring>
 
 #include "include/core/SkImageInfo.h"
 #include "include/core/SkSurface.h"
+#include "include/core/SkPixmap.h"
 
 #include "Core/Exception.h"
+#include "Core/Journal.h"
 #include "Ciallo/GrBase.h"
 #include "Ciallo/DDR/GrBaseCompositor.h"
 #include "Ciallo/DDR/GrCpuCompositor.h"
 #include "Ciallo/DDR/GrCpuRenderLayer.h"
+#include "Ciallo/DDR/GrCpuBlitter.h"
 #include "Ciallo/DDR/GrBasePlatform.h"
 
 CIALLO_BEGIN_NS
@@ -23,6 +28,16 @@ std::shared_ptr<GrBaseCompositor> GrCpuCompositor::MakeDirectCpu(int32_t width,
                                                  height,
                                                  colorFormat,
                                                  platform);
+    if (platform != nullptr && platform->options().cpu_tiled_composite)
+    {
+        ret->setTiledComposite(platform->options().cpu_tile_size,
+                               platform->options().cpu_composite_threads);
+    }
+    if (platform != nullptr && platform->options().cpu_tiled_raster)
+    {
+        ret->setTiledRaster(platform->options().cpu_raster_tile_size,
+                            platform->options().cpu_composite_threads);
+    }
     ret->createSurface();
     return ret;
 }
@@ -36,13 +51,19 @@ GrCpuCompositor::GrCpuCompositor(int32_t width,
                        height,
                        colorFormat,
                        platform),
-      fBitmapSurface(nullptr)
+      fZeroCopy(false),
+      fCurrentTarget(0),
+      fBlitter(GrCpuBlitter::DetectISA()),
+      fTileSize(0),
+      fRasterTileSize(0)
 {
     setDriverSpecDeviceTypeInfo(CompositeDriverSpecDeviceType::kDirectCpu);
     setDeviceInfo(CIALLO_ROMAN_CPU_DRIVER_VERSION,
                   CIALLO_ROMAN_CPU_API_VERSION,
                   CIALLO_ROMAN_CPU_VENDOR,
                   CIALLO_ROMAN_CPU_DEVICE_NAME);
+    log_write(LOG_DEBUG) << "CPU compositor blits layers with "
+                         << GrCpuBlitter::ISAName(fBlitter.isa()) << " instructions" << log_endl;
 }
 
 GrCpuCompositor::~GrCpuCompositor()
@@ -56,29 +77,252 @@ void GrCpuCompositor::createSurface()
     SkImageInfo imageInfo = SkImageInfo::Make(size,
                                               ToSkColorType(this->colorFormat()),
                                               SkAlphaType::kPremul_SkAlphaType);
-    fBitmapSurface = SkSurface::MakeRaster(imageInfo, imageInfo.minRowBytes(), nullptr);
-    if (fBitmapSurface == nullptr)
+
+    GrBasePlatform *platform = getPlatform();
+    fZeroCopy = platform != nullptr && platform->options().zero_copy_present;
+    if (fZeroCopy)
     {
-        throw RuntimeException::Builder(__FUNCTION__)
-                .append("Failed to create SkSurface to render to")
-                .make<RuntimeException>();
+        /* Platform buffers are tightly packed */
+        for (int32_t i = 0; i < GrBasePlatform::kBufferCount; i++)
+        {
+            fTargetSurfaces.push_back(SkSurface::MakeRasterDirect(imageInfo,
+                                                                  platform->buffer(i),
+                                                                  imageInfo.minRowBytes()));
+        }
+        log_write(LOG_DEBUG) << "CPU compositor composites into platform buffers directly" << log_endl;
+    }
+    else
+    {
+        fTargetSurfaces.push_back(SkSurface::MakeRaster(imageInfo, imageInfo.minRowBytes(), nullptr));
+    }
+
+    for (const sk_sp<SkSurface>& surface : fTargetSurfaces)
+    {
+        if (surface == nullptr)
+        {
+            throw RuntimeException::Builder(__FUNCTION__)
+                    .append("Failed to create SkSurface to render to")
+                    .make<RuntimeException>();
+        }
+    }
+
+    if (fTilePool != nullptr)
+        createTileSurfaces();
+}
+
+void GrCpuCompositor::setTiledComposite(int32_t tileSize, int32_t threads)
+{
+    RUNTIME_EXCEPTION_ASSERT(fTargetSurfaces.empty());
+    RUNTIME_EXCEPTION_ASSERT(tileSize > 0);
+
+    fTileSize = tileSize;
+    fTilePool = std::make_unique<ThreadPool>("Compositor", threads);
+    log_write(LOG_DEBUG) << "CPU compositor uses " << tileSize << "x" << tileSize
+                         << " tiles and " << fTilePool->size() << " threads" << log_endl;
+}
+
+void GrCpuCompositor::setTiledRaster(int32_t tileSize, int32_t threads)
+{
+    RUNTIME_EXCEPTION_ASSERT(tileSize > 0);
+
+    fRasterTileSize = tileSize;
+    fRasterPool = std::make_shared<ThreadPool>("Raster", threads);
+    log_write(LOG_DEBUG) << "CPU render layers are rasterized in " << tileSize << "x" << tileSize
+                         << " tiles by " << fRasterPool->size() << " threads" << log_endl;
+}
+
+void GrCpuCompositor::createTileSurfaces()
+{
+    for (int32_t y = 0; y < this->height(); y += fTileSize)
+    {
+        for (int32_t x = 0; x < this->width(); x += fTileSize)
+        {
+            fTiles.push_back(SkIRect::MakeXYWH(x, y,
+                                               std::min(fTileSize, this->width() - x),
+                                               std::min(fTileSize, this->height() - y)));
+        }
+    }
+
+    /* Each tile has its own surface (and canvas) sharing pixels with
+       the target surface, as Skia canvas can't be used by multiple threads */
+    for (const sk_sp<SkSurface>& target : fTargetSurfaces)
+    {
+        SkPixmap pixmap;
+        RUNTIME_EXCEPTION_ASSERT(target->peekPixels(&pixmap));
+
+        for (const SkIRect& tile : fTiles)
+        {
+            SkImageInfo tileInfo = pixmap.info().makeWH(tile.width(), tile.height());
+            sk_sp<SkSurface> surface = SkSurface::MakeRasterDirect(tileInfo,
+                                                                   pixmap.writable_addr(tile.left(), tile.top()),
+                                                                   pixmap.rowBytes());
+            if (surface == nullptr)
+            {
+                throw RuntimeException::Builder(__FUNCTION__)
+                        .append("Failed to create SkSurface for tile")
+                        .make<RuntimeException>();
+            }
+            fTileSurfaces.push_back(std::move(surface));
+        }
+    }
+}
+
+void GrCpuCompositor::onRecomposite(GrTargetSurface& target, const DamageList& damage)
+{
+    const DamageList *recompositeDamage = &damage;
+    DamageList bufferDamage;
+    if (fZeroCopy)
+    {
+        /* The buffer still holds an older frame, so its outdated areas
+           must be recomposited too */
+        SkRegion region(fPlatformBuffer->outdated());
+        for (const SkIRect& rect : damage)
+            region.op(rect, SkRegion::kUnion_Op);
+        for (SkRegion::Iterator itr(region); !itr.done(); itr.next())
+            bufferDamage.push_back(itr.rect());
+        recompositeDamage = &bufferDamage;
+    }
+
+    if (fTilePool == nullptr)
+        GrBaseCompositor::onRecomposite(target, *recompositeDamage);
+    else
+        recompositeTiles(*recompositeDamage);
+}
+
+void GrCpuCompositor::recompositeTiles(const DamageList& damage)
+{
+    std::vector<int32_t> damagedTiles;
+    for (int32_t i = 0; i < static_cast<int32_t>(fTiles.size()); i++)
+    {
+        for (const SkIRect& rect : damage)
+        {
+            if (SkIRect::Intersects(fTiles[i], rect))
+            {
+                damagedTiles.push_back(i);
+                break;
+            }
+        }
+    }
+
+    /* Without zero-copy, tiles are copied into platform buffer as soon as
+       they're composited, while the pixels are still in cache of the worker. */
+    uint8_t *buffer = fZeroCopy ? nullptr : fPlatformBuffer->buffer();
+
+    size_t firstTile = fCurrentTarget * fTiles.size();
+    fTilePool->parallelFor(static_cast<int32_t>(damagedTiles.size()), [&](int32_t i) {
+        int32_t tileIndex = damagedTiles[i];
+        const SkIRect& tile = fTiles[tileIndex];
+        GrTargetSurface tileTarget(fTileSurfaces[firstTile + tileIndex].get());
+
+        for (const SkIRect& rect : damage)
+        {
+            SkIRect part;
+            if (!part.intersect(tile, rect))
+                continue;
+            recompositeRect(tileTarget, part, SkIPoint::Make(tile.left(), tile.top()));
+            if (buffer != nullptr)
+                copyToPlatformBuffer(buffer, part);
+        }
+    });
+}
+
+void GrCpuCompositor::copyToPlatformBuffer(uint8_t *buffer, const SkIRect& rect)
+{
+    SkPixmap pixmap;
+    fTargetSurfaces[fCurrentTarget]->peekPixels(&pixmap);
+
+    size_t bpp = pixmap.info().bytesPerPixel();
+    size_t rowBytes = this->width() * bpp;
+    for (int32_t y = rect.top(); y < rect.bottom(); y++)
+    {
+        std::memcpy(buffer + y * rowBytes + rect.left() * bpp,
+                    pixmap.addr(rect.left(), y),
+                    rect.width() * bpp);
     }
 }
 
 GrTargetSurface GrCpuCompositor::onTargetSurface()
 {
-    RUNTIME_EXCEPTION_ASSERT(fBitmapSurface != nullptr);
-    return GrTargetSurface(fBitmapSurface.get());
+    RUNTIME_EXCEPTION_ASSERT(!fTargetSurfaces.empty());
+
+    /* Producer always owns a free buffer, this never blocks */
+    fPlatformBuffer.reset();
+    fPlatformBuffer = std::make_unique<GrBasePlatform::ScopedAcquireBuffer>(getPlatform());
+    if (fZeroCopy)
+        fCurrentTarget = fPlatformBuffer->index();
+    return GrTargetSurface(fTargetSurfaces[fCurrentTarget].get());
+}
+
+void GrCpuCompositor::onPresent(const DamageList& damage)
+{
+    if (!fZeroCopy && !damage.empty())
+    {
+        /* Platform buffer holds an older frame, its outdated areas are
+           copied as well. Tiled composition has copied damaged areas. */
+        SkRegion region(fPlatformBuffer->outdated());
+        for (const SkIRect& rect : damage)
+        {
+            region.op(rect, fTilePool == nullptr ? SkRegion::kUnion_Op
+                                                 : SkRegion::kDifference_Op);
+        }
+
+        uint8_t *buffer = fPlatformBuffer->buffer();
+        for (SkRegion::Iterator itr(region); !itr.done(); itr.next())
+            copyToPlatformBuffer(buffer, itr.rect());
+    }
+
+    for (const SkIRect& rect : damage)
+        fPlatformBuffer->damage(rect);
+
+    /* Publishes the frame if anything changed */
+    fPlatformBuffer.reset();
+}
+
+void GrCpuCompositor::skComposite(SkSurface *target, const sk_sp<SkImage>& image,
+                                  const SkMatrix& matrix, const SkIRect& clip,
+                                  const LayerProperties& props)
+{
+    if (!blitComposite(target, image, matrix, clip, props))
+        GrBaseCompositor::skComposite(target, image, matrix, clip, props);
 }
 
-void GrCpuCompositor::onPresent()
+bool GrCpuCompositor::blitComposite(SkSurface *target, const sk_sp<SkImage>& image,
+                                    const SkMatrix& matrix, const SkIRect& clip,
+                                    const LayerProperties& props)
 {
-    GrBasePlatform::ScopedAcquireBuffer scopedAcquireBuffer(getPlatform());
-    SkImageInfo imageInfo = SkImageInfo::Make(SkISize::Make(this->width(), this->height()),
-                                              ToSkColorType(this->colorFormat()),
-                                              SkAlphaType::kPremul_SkAlphaType);
-    fBitmapSurface->readPixels(imageInfo, getPlatform()->writableBuffer(),
-                               imageInfo.minRowBytes(), 0, 0);
+    /* Only pixel-aligned and unscaled layers blended by src-over can be blitted directly */
+    if (!IsIntegerTranslate(matrix) || props.fBlendMode != SkBlendMode::kSrcOver)
+        return false;
+    SkIRect dstRect = clip;
+    SkIRect srcRect = dstRect.makeOffset(-SkScalarRoundToInt(matrix.getTranslateX()),
+                                         -SkScalarRoundToInt(matrix.getTranslateY()));
+
+    SkPixmap srcPixmap, dstPixmap;
+    if (!image->peekPixels(&srcPixmap) || !target->peekPixels(&dstPixmap))
+        return false;
+    if (srcPixmap.colorType() != dstPixmap.colorType()
+        || srcPixmap.info().bytesPerPixel() != sizeof(uint32_t)
+        || srcPixmap.alphaType() == SkAlphaType::kUnpremul_SkAlphaType)
+        return false;
+    if (!srcPixmap.bounds().contains(srcRect) || !dstPixmap.bounds().contains(dstRect))
+        return false;
+
+    auto alpha = static_cast<uint8_t>(SkScalarRoundToInt(props.fOpacity * 255.0f));
+    if (alpha == 0)
+        return true;
+
+    target->notifyContentWillChange(SkSurface::kRetain_ContentChangeMode);
+    GrCpuBlitter::Mode mode = (image->isOpaque() && alpha == 0xff) ? GrCpuBlitter::Mode::kSrcCopy
+                                                                   : GrCpuBlitter::Mode::kSrcOver;
+    fBlitter.blit(mode,
+                  static_cast<uint8_t*>(dstPixmap.writable_addr(dstRect.left(), dstRect.top())),
+                  dstPixmap.rowBytes(),
+                  static_cast<const uint8_t*>(srcPixmap.addr(srcRect.left(), srcRect.top())),
+                  srcPixmap.rowBytes(),
+                  srcRect.width(),
+                  srcRect.height(),
+                  alpha);
+    return true;
 }
 
 GrBaseRenderLayer *GrCpuCompositor::onCreateRenderLayer(int32_t width, int32_t height,
@@ -89,7 +333,10 @@ GrBaseRenderLayer *GrCpuCompositor::onCreateRenderLayer(int32_t width, int32_t h
     SkImageInfo imageInfo = SkImageInfo::Make(size,
                                               ToSkColorType(this->colorFormat()),
                                               SkAlphaType::kPremul_SkAlphaType);
-    return new GrCpuRenderLayer(left, top, zindex, width, height, imageInfo);
+    auto *layer = new GrCpuRenderLayer(left, top, zindex, width, height, imageInfo);
+    if (fRasterPool != nullptr)
+        layer->setTiledRaster(fRasterPool, fRasterTileSize);
+    return layer;
 }
 
 CIALLO_END_NS
@@ -2,6 +2,7 @@
 #define COCOA_GRCPUCOMPOSITOR_H
 
 #include <memory>
+#include <vector>
 
 #include "include/core/SkSurface.h"
 #include "include/core/SkCanvas.h"
@@ -9,7 +10,10 @@
 #include "include/core/SkBitmap.h"
 
 #include "Ciallo/GrBase.h"
+#include "Ciallo/ThreadPool.h"
 #include "Ciallo/DDR/GrBaseCompositor.h"
+#include "Ciallo/DDR/GrBasePlatform.h"
+#include "Ciallo/DDR/GrCpuBlitter.h"
 CIALLO_BEGIN_NS
 
 #define CIALLO_ROMAN_CPU_DRIVER_VERSION     210123
@@ -31,9 +35,33 @@ public:
                                                            GrColorFormat colorFormat,
                                                            GrBasePlatform *platform);
 
+    /**
+     * @brief Splits the frame into tiles of @a tileSize x @a tileSize
+     *        pixels, which are composited independently by a pool
+     *        of @a threads workers (0 means the number of CPU cores).
+     *
+     * Must be called before the target surface is created.
+     */
+    void setTiledComposite(int32_t tileSize, int32_t threads);
+
+    /**
+     * @brief Makes the layers created later rasterize in tiles of
+     *        @a tileSize x @a tileSize pixels on a pool of @a threads
+     *        workers (0 means the number of CPU cores).
+     */
+    void setTiledRaster(int32_t tileSize, int32_t threads);
+
 private:
+    void skComposite(SkSurface *target, const sk_sp<SkImage>& image,
+                     const SkMatrix& matrix, const SkIRect& clip,
+                     const LayerProperties& props) override;
+    bool blitComposite(SkSurface *target, const sk_sp<SkImage>& image,
+                       const SkMatrix& matrix, const SkIRect& clip,
+                       const LayerProperties& props);
+
+    void onRecomposite(GrTargetSurface& target, const DamageList& damage) override;
     GrTargetSurface onTargetSurface() override;
-    void onPresent() override;
+    void onPresent(const DamageList& damage) override;
     GrBaseRenderLayer *onCreateRenderLayer(int32_t width,
                                            int32_t height,
                                            int32_t left,
@@ -41,9 +69,32 @@ private:
                                            int zindex) override;
 
     void createSurface();
+    void createTileSurfaces();
+    void recompositeTiles(const DamageList& damage);
+    void copyToPlatformBuffer(uint8_t *buffer, const SkIRect& rect);
 
 private:
-    sk_sp<SkSurface>             fBitmapSurface;
+    /**
+     * In zero-copy mode, there is a target surface for each frame
+     * buffer of platform. Otherwise, there is only one target surface.
+     */
+    bool                            fZeroCopy;
+    std::vector<sk_sp<SkSurface>>   fTargetSurfaces;
+    int32_t                         fCurrentTarget;
+    /* Acquired from onTargetSurface() to onPresent() */
+    std::unique_ptr<GrBasePlatform::ScopedAcquireBuffer>
+                                    fPlatformBuffer;
+    GrCpuBlitter                    fBlitter;
+
+    int32_t                         fTileSize;
+    std::unique_ptr<ThreadPool>     fTilePool;
+    std::vector<SkIRect>            fTiles;
+    /* Tile i of target t is fTileSurfaces[t * fTiles.size() + i] */
+    std::vector<sk_sp<SkSurface>>   fTileSurfaces;
+
+    int32_t                         fRasterTileSize;
+    /* Shared by layers, which may live longer than compositor */
+    std::shared_ptr<ThreadPool>     fRasterPool;
 };
 
 CIALLO_END_NS
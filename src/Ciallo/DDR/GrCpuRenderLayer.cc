@@ -1,6 +1,13 @@
+#include <algorithm>
+
 #include "include/core/SkCanvas.h"
 #include "include/core/SkSurface.h"
 #include "include/core/SkImageInfo.h"
+#include "include/core/SkImage.h"
+#include "include/core/SkPixmap.h"
+#include "include/core/SkPixelRef.h"
+#include "include/core/SkPicture.h"
+#include "include/core/SkPictureRecorder.h"
 
 #include "Ciallo/GrBase.h"
 #include "Ciallo/DDR/GrCpuRenderLayer.h"
@@ -14,20 +21,113 @@ GrCpuRenderLayer::GrCpuRenderLayer(int32_t x,
                                    const SkImageInfo &imageInfo)
     : GrBaseRenderLayer(x, y, z, w, h),
       fImageInfo(imageInfo),
-      fSurface(nullptr)
+      fSurface(nullptr),
+      fTileSize(0)
+{
+}
+
+void GrCpuRenderLayer::setTiledRaster(std::shared_ptr<ThreadPool> pool, int32_t tileSize)
 {
+    RUNTIME_EXCEPTION_ASSERT(fSurface == nullptr);
+    RUNTIME_EXCEPTION_ASSERT(pool != nullptr && tileSize > 0);
+
+    fRasterPool = std::move(pool);
+    fTileSize = tileSize;
+}
+
+void GrCpuRenderLayer::createTileCanvases()
+{
+    SkPixmap pixmap;
+    RUNTIME_EXCEPTION_ASSERT(fSurface->peekPixels(&pixmap));
+
+    /**
+     * Unlike the tiles of compositor, each canvas covers the whole
+     * surface and is clipped to its tile later, so that the pixels are
+     * drawn in the same device coordinate (dithering, AA and so on
+     * depend on it) as the non-tiled mode.
+     */
+    for (int32_t y = 0; y < fImageInfo.height(); y += fTileSize)
+    {
+        for (int32_t x = 0; x < fImageInfo.width(); x += fTileSize)
+        {
+            fTiles.push_back(SkIRect::MakeXYWH(x, y,
+                                               std::min(fTileSize, fImageInfo.width() - x),
+                                               std::min(fTileSize, fImageInfo.height() - y)));
+            fTileCanvases.push_back(SkCanvas::MakeRasterDirect(pixmap.info(),
+                                                               pixmap.writable_addr(),
+                                                               pixmap.rowBytes()));
+            RUNTIME_EXCEPTION_ASSERT(fTileCanvases.back() != nullptr);
+        }
+    }
+}
+
+void GrCpuRenderLayer::rasterTiles(const SkIRect& dirty)
+{
+    sk_sp<SkPicture> picture = fRecorder.finishRecordingAsPicture();
+    /**
+     * The recording canvas is reused, the pointer held by base class keeps valid.
+     * With an R-tree, each tile only replays the operations over it.
+     */
+    fRecorder.beginRecording(SkRect::Make(fImageInfo.bounds()), &fRTreeFactory);
+    if (picture == nullptr)
+        return;
+
+    std::vector<SkIRect> clips;
+    std::vector<SkCanvas*> canvases;
+    for (size_t i = 0; i < fTiles.size(); i++)
+    {
+        SkIRect clip;
+        if (clip.intersect(fTiles[i], dirty))
+        {
+            clips.push_back(clip);
+            canvases.push_back(fTileCanvases[i].get());
+        }
+    }
+
+    fRasterPool->parallelFor(static_cast<int32_t>(clips.size()), [&](int32_t i) {
+        canvases[i]->save();
+        canvases[i]->clipIRect(clips[i]);
+        canvases[i]->drawPicture(picture);
+        canvases[i]->restore();
+    });
 }
 
 GrLayerResult GrCpuRenderLayer::onLayerResult()
 {
     RUNTIME_EXCEPTION_ASSERT(fSurface != nullptr);
-    return GrLayerResult(fSurface->makeImageSnapshot());
+
+    SkIRect dirty = dirtyBoundary();
+    if (fRasterPool != nullptr)
+        rasterTiles(dirty);
+
+    SkPixmap backPixmap;
+    SkPixmap dirtyPixmap;
+    RUNTIME_EXCEPTION_ASSERT(fSurface->peekPixels(&backPixmap));
+    if (backPixmap.extractSubset(&dirtyPixmap, dirty))
+        fFrontBitmap.writePixels(dirtyPixmap, dirty.left(), dirty.top());
+
+    /**
+     * Compositor only reads the image while presenting, which never
+     * happens together with update(), so the front bitmap can be
+     * modified in place. The image keeps a reference of the pixels
+     * in case the compositor holds it longer than this layer.
+     */
+    SkPixmap frontPixmap;
+    fFrontBitmap.peekPixels(&frontPixmap);
+    SkPixelRef *pixelRef = SkRef(fFrontBitmap.pixelRef());
+    sk_sp<SkImage> image = SkImage::MakeFromRaster(frontPixmap, [](const void *, void *ctx) {
+        static_cast<SkPixelRef*>(ctx)->unref();
+    }, pixelRef);
+    RUNTIME_EXCEPTION_ASSERT(image != nullptr);
+
+    // implicit cast (sk_sp<SkImage> => GrLayerResult)
+    return GrLayerResult(image);
 }
 
 SkCanvas *GrCpuRenderLayer::onCreateCanvas()
 {
     if (fSurface != nullptr)
-        return fSurface->getCanvas();
+        return fRasterPool != nullptr ? fRecorder.getRecordingCanvas() : fSurface->getCanvas();
     fSurface = SkSurface::MakeRaster(fImageInfo, nullptr);
     if (fSurface == nullptr)
     {
@@ -36,6 +136,20 @@ SkCanvas *GrCpuRenderLayer::onCreateCanvas()
                 .make<RuntimeException>();
     }
 
+    /* Raster surface is zero-initialized, keep the front bitmap the same */
+    if (!fFrontBitmap.tryAllocPixels(fImageInfo))
+    {
+        throw RuntimeException::Builder(__FUNCTION__)
+                .append("Failed to allocate front bitmap of layer")
+                .make<RuntimeException>();
+    }
+    fFrontBitmap.eraseColor(SK_ColorTRANSPARENT);
+
+    if (fRasterPool != nullptr)
+    {
+        createTileCanvases();
+        return fRecorder.beginRecording(SkRect::Make(fImageInfo.bounds()), &fRTreeFactory);
+    }
     return fSurface->getCanvas();
 }
 
@@ -2,16 +2,33 @@
 #define COCOA_GRCPURENDERLAYER_H
 
 #include <memory>
+#include <vector>
 
 #include "include/core/SkImageInfo.h"
 #include "include/core/SkCanvas.h"
 #include "include/core/SkSurface.h"
+#include "include/core/SkBitmap.h"
+#include "include/core/SkPictureRecorder.h"
+#include "include/core/SkBBHFactory.h"
 
 #include "Ciallo/GrBase.h"
+#include "Ciallo/ThreadPool.h"
 #include "Ciallo/DDR/GrBaseRenderLayer.h"
 #include "Ciallo/DDR/GrLayerResult.h"
 CIALLO_BEGIN_NS
 
+/**
+ * GrCpuRenderLayer draws into a back surface, and the compositor
+ * reads a front bitmap. On update(), only the dirty region is copied
+ * from back to front, and the image submitted to compositor shares
+ * pixels with the front bitmap. Making a snapshot of the surface
+ * directly is avoided as the next drawing would make Skia copy
+ * the whole layer (copy-on-write) while compositor holds the image.
+ *
+ * In tiled raster mode, drawings are recorded instead of being drawn
+ * directly. On update(), the tiles intersecting the dirty boundary
+ * replay the recording in parallel, each clipped to its own tile.
+ */
 class GrCpuRenderLayer : public GrBaseRenderLayer
 {
 public:
@@ -23,13 +40,31 @@ public:
                      const SkImageInfo& imageInfo);
     ~GrCpuRenderLayer() override = default;
 
+    /**
+     * @brief Rasterizes the layer in tiles of @a tileSize x @a tileSize
+     *        pixels on @a pool. Must be called before the first drawing.
+     */
+    void setTiledRaster(std::shared_ptr<ThreadPool> pool, int32_t tileSize);
+
 private:
     GrLayerResult onLayerResult() override;
     SkCanvas *onCreateCanvas() override;
 
+    void createTileCanvases();
+    void rasterTiles(const SkIRect& dirty);
+
 private:
     SkImageInfo                 fImageInfo;
     sk_sp<SkSurface>            fSurface;
+    SkBitmap                    fFrontBitmap;
+
+    int32_t                     fTileSize;
+    std::shared_ptr<ThreadPool> fRasterPool;
+    SkPictureRecorder           fRecorder;
+    SkRTreeFactory              fRTreeFactory;
+    std::vector<SkIRect>        fTiles;
+    std::vector<std::unique_ptr<SkCanvas>>
+                                fTileCanvases;
 };
 
 CIALLO_END_NS
@@ -111,6 +111,8 @@ GrGpuCompositor::GrGpuCompositor(bool debug,
       fVkSwapchain(VK_NULL_HANDLE),
       fDirectContext(nullptr)
 {
+    /* Swapchain images don't keep the content of previous frame */
+    setPartialRecomposite(false);
 }
 
 GrGpuCompositor::~GrGpuCompositor()
@@ -816,7 +818,7 @@ uint32_t GrGpuCompositor::ToVulkanColorFormat(GrColorFormat colorFormat)
 // Public APIs
 // -----------------------------------------------------------------------------------------
 
-void GrGpuCompositor::onPresent()
+void GrGpuCompositor::onPresent([[maybe_unused]] const DamageList& damage)
 {
     if (fCurrentBackBuffer > fImagesCount)
         return;
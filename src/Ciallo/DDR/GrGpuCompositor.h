@@ -63,7 +63,7 @@ public:
                                                   bool debugMode = false);
 
 private:
-    void onPresent() override;
+    void onPresent(const DamageList& damage) override;
     GrTargetSurface onTargetSurface() override;
     GrBaseRenderLayer *onCreateRenderLayer(int32_t width,
                                          int32_t height,
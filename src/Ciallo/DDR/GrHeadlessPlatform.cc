@@ -0,0 +1,133 @@
+#include <memory>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+#include "include/core/SkImageInfo.h"
+#include "include/core/SkPixmap.h"
+#include "include/core/SkStream.h"
+#include "include/encode/SkPngEncoder.h"
+
+#include "Core/Journal.h"
+#include "Ciallo/GrBase.h"
+#include "Ciallo/DDR/GrBaseCompositor.h"
+#include "Ciallo/DDR/GrCpuCompositor.h"
+#include "Ciallo/DDR/GrOpenCLCompositor.h"
+#include "Ciallo/DDR/GrBasePlatform.h"
+#include "Ciallo/DDR/GrHeadlessPlatform.h"
+CIALLO_BEGIN_NS
+
+GrHeadlessPlatform::GrHeadlessPlatform(int32_t width,
+                                       int32_t height,
+                                       GrColorFormat colorFormat,
+                                       const GrPlatformOptions& options)
+    : GrBasePlatform(GrPlatformKind::kHeadless, options),
+      fWidth(width),
+      fHeight(height),
+      fColorFormat(colorFormat),
+      fExposedFrames(0)
+{
+    size_t bufferSize = static_cast<size_t>(fWidth) * fHeight * sizeof(uint32_t);
+    for (int32_t i = 0; i < kBufferCount; i++)
+    {
+        fBuffers.emplace_back(new uint8_t[bufferSize]);
+        std::memset(fBuffers.back().get(), 0, bufferSize);
+    }
+}
+
+std::unique_ptr<GrBasePlatform> GrHeadlessPlatform::MakeHeadless(int32_t width,
+                                                                 int32_t height,
+                                                                 GrColorFormat colorFormat,
+                                                                 const GrPlatformOptions& options)
+{
+    if (width <= 0 || height <= 0)
+    {
+        log_write(LOG_ERROR) << "Invalid size of headless platform: "
+                             << width << "x" << height << log_endl;
+        return nullptr;
+    }
+    return std::make_unique<GrHeadlessPlatform>(width, height, colorFormat, options);
+}
+
+std::shared_ptr<GrBaseCompositor> GrHeadlessPlatform::onCreateCompositor()
+{
+    bool failAccel = false;
+    if (options().use_gpu_accel)
+    {
+        /* Vulkan compositor presents to a window surface */
+        failAccel = true;
+        log_write(LOG_WARNING) << "GPU rendering is unavailable on headless platform" << log_endl;
+    }
+    else if (options().use_opencl_accel)
+    {
+        auto ret = GrOpenCLCompositor::MakeOpenCL(fWidth,
+                                                  fHeight,
+                                                  fColorFormat,
+                                                  this,
+                                                  options().opencl_platform_keyword,
+                                                  options().opencl_device_keyword);
+        if (ret != nullptr)
+            return ret;
+        failAccel = true;
+        log_write(LOG_WARNING) << "OpenCL compositor is unavailable" << log_endl;
+    }
+
+    if (failAccel && options().use_strict_accel)
+        return nullptr;
+
+    writableOptions().use_gpu_accel = false;
+    writableOptions().use_opencl_accel = false;
+    return GrCpuCompositor::MakeDirectCpu(fWidth,
+                                          fHeight,
+                                          fColorFormat,
+                                          this);
+}
+
+uint8_t *GrHeadlessPlatform::onBuffer(int32_t index)
+{
+    return fBuffers[index].get();
+}
+
+void GrHeadlessPlatform::onExpose(const SkRegion& damage)
+{
+    if (damage.isEmpty())
+        return;
+
+    fExposedFrames++;
+    /* Front buffer is owned by us until next expose(), no lock is needed */
+    if (!options().headless_dump_dir.empty())
+        dumpFrame(fBuffers[frontBuffer()].get());
+}
+
+void GrHeadlessPlatform::dumpFrame(const uint8_t *buffer)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/frame-%06lu.%s",
+                  static_cast<unsigned long>(fExposedFrames),
+                  options().headless_dump_raw ? "raw" : "png");
+    std::string path = options().headless_dump_dir + name;
+
+    if (options().headless_dump_raw)
+    {
+        std::ofstream fs(path, std::ios::binary | std::ios::trunc);
+        if (!fs.is_open())
+        {
+            log_write(LOG_ERROR) << "Failed to open " << path << log_endl;
+            return;
+        }
+        fs.write(reinterpret_cast<const char*>(buffer),
+                 static_cast<std::streamsize>(fWidth) * fHeight * sizeof(uint32_t));
+        return;
+    }
+
+    SkColorType colorType = fColorFormat == GrColorFormat::kColor_BGRA_8888
+                            ? SkColorType::kBGRA_8888_SkColorType
+                            : SkColorType::kRGBA_8888_SkColorType;
+    SkPixmap pixmap(SkImageInfo::Make(fWidth, fHeight, colorType, SkAlphaType::kPremul_SkAlphaType),
+                    buffer, fWidth * sizeof(uint32_t));
+    SkFILEWStream stream(path.c_str());
+    if (!stream.isValid() || !SkPngEncoder::Encode(&stream, pixmap, SkPngEncoder::Options()))
+        log_write(LOG_ERROR) << "Failed to write frame into " << path << log_endl;
+}
+
+CIALLO_END_NS
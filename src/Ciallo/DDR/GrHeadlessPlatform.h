@@ -0,0 +1,60 @@
+#ifndef COCOA_GRHEADLESSPLATFORM_H
+#define COCOA_GRHEADLESSPLATFORM_H
+
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "Ciallo/GrBase.h"
+#include "Ciallo/DDR/GrBaseCompositor.h"
+#include "Ciallo/DDR/GrBasePlatform.h"
+CIALLO_BEGIN_NS
+
+/**
+ * GrHeadlessPlatform keeps frames in memory instead of displaying
+ * them, so that the rendering pipeline can run without a window
+ * system (containers, benchmarks and so on).
+ *
+ * There is no window system to call expose(), the owner should call
+ * it after a frame was presented. Exposed frames are written into
+ * GrPlatformOptions::headless_dump_dir if it is not empty.
+ * CPU and OpenCL compositors are supported.
+ */
+class GrHeadlessPlatform : public GrBasePlatform
+{
+public:
+    GrHeadlessPlatform(int32_t width,
+                       int32_t height,
+                       GrColorFormat colorFormat,
+                       const GrPlatformOptions& options);
+    ~GrHeadlessPlatform() override = default;
+
+    static std::unique_ptr<GrBasePlatform> MakeHeadless(int32_t width,
+                                                        int32_t height,
+                                                        GrColorFormat colorFormat,
+                                                        const GrPlatformOptions& options);
+
+    inline int32_t width() const   { return fWidth; }
+    inline int32_t height() const  { return fHeight; }
+
+    /* Number of exposed frames which have new content */
+    inline uint64_t exposedFrames() const  { return fExposedFrames; }
+
+private:
+    std::shared_ptr<GrBaseCompositor> onCreateCompositor() override;
+    uint8_t *onBuffer(int32_t index) override;
+    void onExpose(const SkRegion& damage) override;
+
+    void dumpFrame(const uint8_t *buffer);
+
+private:
+    int32_t                      fWidth;
+    int32_t                      fHeight;
+    GrColorFormat                fColorFormat;
+    std::vector<std::unique_ptr<uint8_t[]>>
+                                 fBuffers;
+    uint64_t                     fExposedFrames;
+};
+
+CIALLO_END_NS
+#endif //COCOA_GRHEADLESSPLATFORM_H
@@ -1,5 +1,8 @@
 #include <memory>
 #include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 #include <CL/cl.h>
 #include <CL/cl_platform.h>
@@ -11,40 +14,242 @@
 #include "Ciallo/DDR/GrOpenCLCompositor.h"
 #include "Ciallo/DDR/GrBasePlatform.h"
 #include "Ciallo/DDR/GrOpenCLRenderLayer.h"
+#include "Ciallo/DDR/GrOpenCLProgramCache.h"
 CIALLO_BEGIN_NS
 
 #define RET_CHECKED(cl_func, ...) \
     this->toRetChecked(::cl_func(__VA_ARGS__), __FUNCTION__, #cl_func)
 
-#define BLEND_SRC_OVER_KERNEL_NAME     "blend_src_over_premultiplied"
-
-static char const _clCompositeSrcOverProgram[] = "const sampler_t blend_sampler = CLK_NORMALIZED_COORDS_FALSE |\n"
-                                                 "                                CLK_ADDRESS_CLAMP_TO_EDGE   |\n"
-                                                 "                                CLK_FILTER_NEAREST;\n"
-                                                 "\n"
-                                                 "__kernel void blend_src_over_premultiplied(__read_only image2d_t src,\n"
-                                                 "                                           __read_only image2d_t dst,\n"
-                                                 "                                           __write_only image2d_t out,\n"
-                                                 "                                           int2 src_clip_pos,\n"
-                                                 "                                           int2 dst_clip_pos,\n"
-                                                 "                                           int2 clip_dim)\n"
-                                                 "{\n"
-                                                 "    int2 item_id = (int2)(get_global_id(0),\n"
-                                                 "                          get_global_id(1));\n"
-                                                 "    if (item_id.s0 >= clip_dim.s0)\n"
-                                                 "        return;\n"
-                                                 "\n"
-                                                 "    int2 src_pos = item_id + src_clip_pos;\n"
-                                                 "    int2 dst_pos = item_id + dst_clip_pos;\n"
-                                                 "\n"
-                                                 "    float4 src_pixel = read_imagef(src, blend_sampler, src_pos);\n"
-                                                 "    float4 dst_pixel = read_imagef(dst, blend_sampler, dst_pos);\n"
-                                                 "    float4 final_pixel = src_pixel + (dst_pixel * (1 - src_pixel.s3));\n"
-                                                 "    final_pixel.s3 = 1.0f;\n"
-                                                 "    write_imagef(out, dst_pos, final_pixel);\n"
-                                                 "}";
-
-constexpr size_t _clSrcOverProgramSize = sizeof(_clCompositeSrcOverProgram) - 1;
+#define COMPOSITE_LAYERS_KERNEL_NAME    "composite_layers_premultiplied"
+
+static char const _clCompositeProgram[] = "const sampler_t nearest_sampler = CLK_NORMALIZED_COORDS_FALSE |\n"
+                                          "                                 CLK_ADDRESS_CLAMP           |\n"
+                                          "                                 CLK_FILTER_NEAREST;\n"
+                                          "const sampler_t linear_sampler = CLK_NORMALIZED_COORDS_FALSE |\n"
+                                          "                                CLK_ADDRESS_CLAMP           |\n"
+                                          "                                CLK_FILTER_LINEAR;\n"
+                                          "\n"
+                                          "/* Same layout as ClLayerEntry on host.\n"
+                                          "   inverse maps the position in target to the position in layer,\n"
+                                          "   like the first two rows of SkMatrix. clip and cover are\n"
+                                          "   rectangles (left, top, right, bottom) in target, cover is\n"
+                                          "   the area covered by an opaque layer, or empty. */\n"
+                                          "typedef struct\n"
+                                          "{\n"
+                                          "    float inverse[8];\n"
+                                          "    int clip[4];\n"
+                                          "    int cover[4];\n"
+                                          "    float opacity;\n"
+                                          "    int blend_mode;\n"
+                                          "    int filter;\n"
+                                          "    int reserved;\n"
+                                          "} layer_entry;\n"
+                                          "\n"
+                                          "/* Helpers of the blend modes, same as SkRasterPipeline */\n"
+                                          "float4 hard_light(float4 s, float4 d, float sa, float da)\n"
+                                          "{\n"
+                                          "    float4 both = s * (1.0f - da) + d * (1.0f - sa);\n"
+                                          "    return both + select(sa * da - 2.0f * (da - d) * (sa - s), 2.0f * s * d,\n"
+                                          "                         islessequal(2.0f * s, (float4)(sa)));\n"
+                                          "}\n"
+                                          "\n"
+                                          "float4 color_dodge(float4 s, float4 d, float sa, float da)\n"
+                                          "{\n"
+                                          "    float4 both = s * (1.0f - da) + d * (1.0f - sa);\n"
+                                          "    float4 r = sa * fmin((float4)(da), d * sa / (sa - s)) + both;\n"
+                                          "    r = select(r, s + d * (1.0f - sa), isequal(s, (float4)(sa)));\n"
+                                          "    return select(r, s * (1.0f - da), isequal(d, (float4)(0.0f)));\n"
+                                          "}\n"
+                                          "\n"
+                                          "float4 color_burn(float4 s, float4 d, float sa, float da)\n"
+                                          "{\n"
+                                          "    float4 both = s * (1.0f - da) + d * (1.0f - sa);\n"
+                                          "    float4 r = sa * (da - fmin((float4)(da), (da - d) * sa / s)) + both;\n"
+                                          "    r = select(r, d * (1.0f - sa), isequal(s, (float4)(0.0f)));\n"
+                                          "    return select(r, d + s * (1.0f - da), isequal(d, (float4)(da)));\n"
+                                          "}\n"
+                                          "\n"
+                                          "float4 soft_light(float4 s, float4 d, float sa, float da)\n"
+                                          "{\n"
+                                          "    float4 m = da > 0.0f ? d / da : (float4)(0.0f);\n"
+                                          "    float4 s2 = 2.0f * s, m4 = 4.0f * m;\n"
+                                          "    float4 dark_src = d * (sa + (s2 - sa) * (1.0f - m));\n"
+                                          "    float4 dark_dst = (m4 * m4 + m4) * (m - 1.0f) + 7.0f * m;\n"
+                                          "    float4 lite_dst = sqrt(m) - m;\n"
+                                          "    float4 lite_src = d * sa + da * (s2 - sa) * select(lite_dst, dark_dst, islessequal(4.0f * d, (float4)(da)));\n"
+                                          "    return s * (1.0f - da) + d * (1.0f - sa) + select(lite_src, dark_src, islessequal(s2, (float4)(sa)));\n"
+                                          "}\n"
+                                          "\n"
+                                          "float lum(float3 c)\n"
+                                          "{\n"
+                                          "    return dot(c, (float3)(0.30f, 0.59f, 0.11f));\n"
+                                          "}\n"
+                                          "\n"
+                                          "float sat(float3 c)\n"
+                                          "{\n"
+                                          "    return fmax(c.x, fmax(c.y, c.z)) - fmin(c.x, fmin(c.y, c.z));\n"
+                                          "}\n"
+                                          "\n"
+                                          "float3 set_sat(float3 c, float s)\n"
+                                          "{\n"
+                                          "    float mn = fmin(c.x, fmin(c.y, c.z));\n"
+                                          "    float cs = fmax(c.x, fmax(c.y, c.z)) - mn;\n"
+                                          "    return cs == 0.0f ? (float3)(0.0f) : (c - mn) * s / cs;\n"
+                                          "}\n"
+                                          "\n"
+                                          "float3 set_lum(float3 c, float l)\n"
+                                          "{\n"
+                                          "    return c + (l - lum(c));\n"
+                                          "}\n"
+                                          "\n"
+                                          "float3 clip_color(float3 c, float a)\n"
+                                          "{\n"
+                                          "    float mn = fmin(c.x, fmin(c.y, c.z));\n"
+                                          "    float mx = fmax(c.x, fmax(c.y, c.z));\n"
+                                          "    float l = lum(c);\n"
+                                          "    if (mn < 0.0f && l - mn != 0.0f)\n"
+                                          "        c = l + (c - l) * l / (l - mn);\n"
+                                          "    if (mx > a && mx - l != 0.0f)\n"
+                                          "        c = l + (c - l) * (a - l) / (mx - l);\n"
+                                          "    return fmax(c, 0.0f);\n"
+                                          "}\n"
+                                          "\n"
+                                          "/* Hue, saturation, color and luminosity modes */\n"
+                                          "float3 non_separable(float3 s, float3 d, float sa, float da, int mode)\n"
+                                          "{\n"
+                                          "    float3 r;\n"
+                                          "    switch (mode)\n"
+                                          "    {\n"
+                                          "    case 25: r = set_lum(set_sat(s * sa, sat(d) * sa), lum(d) * sa); break;\n"
+                                          "    case 26: r = set_lum(set_sat(d * sa, sat(s) * da), lum(d) * sa); break;\n"
+                                          "    case 27: r = set_lum(s * da, lum(d) * sa); break;\n"
+                                          "    default: r = set_lum(d * sa, lum(s) * da); break;\n"
+                                          "    }\n"
+                                          "    return s * (1.0f - da) + d * (1.0f - sa) + clip_color(r, sa * da);\n"
+                                          "}\n"
+                                          "\n"
+                                          "/* Values of SkBlendMode, all the colors are premultiplied */\n"
+                                          "float4 blend(float4 s, float4 d, int mode)\n"
+                                          "{\n"
+                                          "    float sa = s.s3, da = d.s3;\n"
+                                          "    float4 r;\n"
+                                          "    switch (mode)\n"
+                                          "    {\n"
+                                          "    case 0:  return (float4)(0.0f);\n"
+                                          "    case 1:  return s;\n"
+                                          "    case 2:  return d;\n"
+                                          "    case 4:  return d + s * (1.0f - da);\n"
+                                          "    case 5:  return s * da;\n"
+                                          "    case 6:  return d * sa;\n"
+                                          "    case 7:  return s * (1.0f - da);\n"
+                                          "    case 8:  return d * (1.0f - sa);\n"
+                                          "    case 9:  return s * da + d * (1.0f - sa);\n"
+                                          "    case 10: return d * sa + s * (1.0f - da);\n"
+                                          "    case 11: return s * (1.0f - da) + d * (1.0f - sa);\n"
+                                          "    case 12: return min(s + d, (float4)(1.0f));\n"
+                                          "    case 13: return s * d;\n"
+                                          "    case 14: return s + d - s * d;\n"
+                                          "    case 24: return s * (1.0f - da) + d * (1.0f - sa) + s * d;\n"
+                                          "    /* Alpha of the following modes is src-over */\n"
+                                          "    case 15: r = hard_light(d, s, da, sa); break;\n"
+                                          "    case 16: r = s + d - fmax(s * da, d * sa); break;\n"
+                                          "    case 17: r = s + d - fmin(s * da, d * sa); break;\n"
+                                          "    case 18: r = color_dodge(s, d, sa, da); break;\n"
+                                          "    case 19: r = color_burn(s, d, sa, da); break;\n"
+                                          "    case 20: r = hard_light(s, d, sa, da); break;\n"
+                                          "    case 21: r = soft_light(s, d, sa, da); break;\n"
+                                          "    case 22: r = s + d - 2.0f * fmin(s * da, d * sa); break;\n"
+                                          "    case 23: r = s + d - 2.0f * s * d; break;\n"
+                                          "    case 25:\n"
+                                          "    case 26:\n"
+                                          "    case 27:\n"
+                                          "    case 28: r = (float4)(non_separable(s.xyz, d.xyz, sa, da, mode), 0.0f); break;\n"
+                                          "    default: return s + d * (1.0f - sa);\n"
+                                          "    }\n"
+                                          "    r.s3 = sa + da - sa * da;\n"
+                                          "    return r;\n"
+                                          "}\n"
+                                          "\n"
+                                          "bool rect_contains(__global const int *rect, int2 pos)\n"
+                                          "{\n"
+                                          "    return pos.s0 >= rect[0] && pos.s1 >= rect[1] && pos.s0 < rect[2] && pos.s1 < rect[3];\n"
+                                          "}\n"
+                                          "\n"
+                                          "float4 read_layer(__read_only image2d_t image, float2 pos, int filter)\n"
+                                          "{\n"
+                                          "    return filter ? read_imagef(image, linear_sampler, pos)\n"
+                                          "                  : read_imagef(image, nearest_sampler, pos);\n"
+                                          "}\n"
+                                          "\n"
+                                          "/* Composites up to 8 (kMaxBatchLayers) layers (from bottom to top) in a single\n"
+                                          "   pass, the result is kept in registers and written once. If accumulate is\n"
+                                          "   not zero, layers are composited onto dst (result of the previous batch),\n"
+                                          "   otherwise onto transparent pixels. Unused layer images are ignored. */\n"
+                                          "__kernel void composite_layers_premultiplied(__read_only image2d_t l0,\n"
+                                          "                                             __read_only image2d_t l1,\n"
+                                          "                                             __read_only image2d_t l2,\n"
+                                          "                                             __read_only image2d_t l3,\n"
+                                          "                                             __read_only image2d_t l4,\n"
+                                          "                                             __read_only image2d_t l5,\n"
+                                          "                                             __read_only image2d_t l6,\n"
+                                          "                                             __read_only image2d_t l7,\n"
+                                          "                                             __read_only image2d_t dst,\n"
+                                          "                                             __write_only image2d_t out,\n"
+                                          "                                             __global const layer_entry *layers,\n"
+                                          "                                             int table_offset,\n"
+                                          "                                             int layer_count,\n"
+                                          "                                             int accumulate,\n"
+                                          "                                             int2 dst_clip_pos,\n"
+                                          "                                             int2 clip_dim)\n"
+                                          "{\n"
+                                          "    int2 item_id = (int2)(get_global_id(0),\n"
+                                          "                          get_global_id(1));\n"
+                                          "    if (item_id.s0 >= clip_dim.s0 || item_id.s1 >= clip_dim.s1)\n"
+                                          "        return;\n"
+                                          "\n"
+                                          "    int2 dst_pos = item_id + dst_clip_pos;\n"
+                                          "    float2 center = convert_float2(dst_pos) + 0.5f;\n"
+                                          "    layers += table_offset;\n"
+                                          "\n"
+                                          "    /* Layers under the topmost opaque layer are invisible */\n"
+                                          "    int first = 0;\n"
+                                          "    for (int i = layer_count - 1; i >= 0; i--)\n"
+                                          "    {\n"
+                                          "        if (rect_contains(layers[i].cover, dst_pos))\n"
+                                          "        {\n"
+                                          "            first = i;\n"
+                                          "            accumulate = 0;\n"
+                                          "            break;\n"
+                                          "        }\n"
+                                          "    }\n"
+                                          "\n"
+                                          "    float4 pixel = accumulate ? read_imagef(dst, nearest_sampler, dst_pos) : (float4)(0.0f);\n"
+                                          "    for (int i = first; i < layer_count; i++)\n"
+                                          "    {\n"
+                                          "        __global const layer_entry *layer = &layers[i];\n"
+                                          "        if (!rect_contains(layer->clip, dst_pos))\n"
+                                          "            continue;\n"
+                                          "\n"
+                                          "        float2 src_pos = (float2)(layer->inverse[0] * center.s0 + layer->inverse[1] * center.s1 + layer->inverse[2],\n"
+                                          "                                  layer->inverse[3] * center.s0 + layer->inverse[4] * center.s1 + layer->inverse[5]);\n"
+                                          "        float4 src_pixel;\n"
+                                          "        switch (i)\n"
+                                          "        {\n"
+                                          "        case 0:  src_pixel = read_layer(l0, src_pos, layer->filter); break;\n"
+                                          "        case 1:  src_pixel = read_layer(l1, src_pos, layer->filter); break;\n"
+                                          "        case 2:  src_pixel = read_layer(l2, src_pos, layer->filter); break;\n"
+                                          "        case 3:  src_pixel = read_layer(l3, src_pos, layer->filter); break;\n"
+                                          "        case 4:  src_pixel = read_layer(l4, src_pos, layer->filter); break;\n"
+                                          "        case 5:  src_pixel = read_layer(l5, src_pos, layer->filter); break;\n"
+                                          "        case 6:  src_pixel = read_layer(l6, src_pos, layer->filter); break;\n"
+                                          "        default: src_pixel = read_layer(l7, src_pos, layer->filter); break;\n"
+                                          "        }\n"
+                                          "        pixel = blend(src_pixel * layer->opacity, pixel, layer->blend_mode);\n"
+                                          "    }\n"
+                                          "    write_imagef(out, dst_pos, pixel);\n"
+                                          "}";
+
+constexpr size_t _clCompositeProgramSize = sizeof(_clCompositeProgram) - 1;
 
 std::shared_ptr<GrBaseCompositor> GrOpenCLCompositor::MakeOpenCL(int32_t width,
                                                                  int32_t height,
@@ -76,27 +281,55 @@ GrOpenCLCompositor::GrOpenCLCompositor(int32_t width,
       fClDeviceId(nullptr),
       fClContext(nullptr),
       fClCommandQueue(nullptr),
+      fClReadbackQueue(nullptr),
       fClProgram(nullptr),
-      fClSrcOverKernel(nullptr),
-      fImages{nullptr, nullptr},
-      fCurrentOutputImage(0),
-      fInWaitingEvent(nullptr)
+      fClCompositeKernel(nullptr),
+      fScratchImage(nullptr),
+      fClLayerTable(nullptr),
+      fClLayerTableCapacity(0),
+      fLayerTableEvent(nullptr),
+      fPresentedFrames(0),
+      fPublishedFrame(0)
 {
 }
 
 GrOpenCLCompositor::~GrOpenCLCompositor()
 {
+    /* Callbacks of pending readbacks still use the staging buffers */
+    if (fClCommandQueue)
+        ::clFinish(fClCommandQueue);
+    if (fClReadbackQueue)
+        ::clFinish(fClReadbackQueue);
+    {
+        std::unique_lock<std::mutex> lock(fReadbackMutex);
+        for (ReadbackStaging& staging : fStagings)
+        {
+            fReadbackCondition.wait(lock, [&staging]() { return !staging.fBusy; });
+            std::free(staging.fPixels);
+        }
+    }
+
     this->Dispose();
 
-    if (fInWaitingEvent != nullptr)
-        ::clReleaseEvent(fInWaitingEvent);
-    for (auto& fImage : fImages)
-        if (fImage != nullptr)
-            ::clReleaseMemObject(fImage);
-    if (fClSrcOverKernel)
-        ::clReleaseKernel(fClSrcOverKernel);
+    if (fLayerTableEvent != nullptr)
+        ::clReleaseEvent(fLayerTableEvent);
+    for (ReadbackStaging& staging : fStagings)
+    {
+        if (staging.fReadEvent != nullptr)
+            ::clReleaseEvent(staging.fReadEvent);
+        if (staging.fImage != nullptr)
+            ::clReleaseMemObject(staging.fImage);
+    }
+    if (fClLayerTable != nullptr)
+        ::clReleaseMemObject(fClLayerTable);
+    if (fScratchImage != nullptr)
+        ::clReleaseMemObject(fScratchImage);
+    if (fClCompositeKernel)
+        ::clReleaseKernel(fClCompositeKernel);
     if (fClProgram)
         ::clReleaseProgram(fClProgram);
+    if (fClReadbackQueue)
+        ::clReleaseCommandQueue(fClReadbackQueue);
     if (fClCommandQueue)
         ::clReleaseCommandQueue(fClCommandQueue);
     if (fClContext)
@@ -201,6 +434,12 @@ void GrOpenCLCompositor::createOpenCL(const std::string &platformKeyword,
                                                            &errCode);
     this->toRetChecked(errCode, __FUNCTION__, "clCreateCommandQueueWithProperties");
 
+    fClReadbackQueue = ::clCreateCommandQueueWithProperties(fClContext,
+                                                            fClDeviceId,
+                                                            nullptr,
+                                                            &errCode);
+    this->toRetChecked(errCode, __FUNCTION__, "clCreateCommandQueueWithProperties");
+
     prepareOpenCL();
 }
 
@@ -336,14 +575,26 @@ bool GrOpenCLCompositor::isDevicePropertiesSuitable(const ClDeviceProperties &pr
     return true;
 }
 
-void GrOpenCLCompositor::prepareOpenCL()
+void GrOpenCLCompositor::buildProgram()
 {
+    std::string cacheDir;
+    if (getPlatform() != nullptr)
+        cacheDir = getPlatform()->options().opencl_binary_cache_dir;
+    GrOpenCLProgramCache programCache(cacheDir);
+    std::string cacheKey = GrOpenCLProgramCache::MakeKey(fClPlatformId, fClDeviceId,
+                                                         _clCompositeProgram,
+                                                         _clCompositeProgramSize);
+
+    fClProgram = programCache.load(fClContext, fClDeviceId, cacheKey);
+    if (fClProgram != nullptr)
+        return;
+
     ::cl_int errCode;
-    char const *sourcePtr = _clCompositeSrcOverProgram;
+    char const *sourcePtr = _clCompositeProgram;
     fClProgram = ::clCreateProgramWithSource(fClContext,
                                              1,
                                              &sourcePtr,
-                                             &_clSrcOverProgramSize,
+                                             &_clCompositeProgramSize,
                                              &errCode);
     this->toRetChecked(errCode, __FUNCTION__, "clCreateProgramWithSource");
 
@@ -381,8 +632,16 @@ void GrOpenCLCompositor::prepareOpenCL()
     }
     ::clUnloadPlatformCompiler(fClPlatformId);
 
-    fClSrcOverKernel = ::clCreateKernel(fClProgram,
-                                        BLEND_SRC_OVER_KERNEL_NAME,
+    programCache.store(fClProgram, cacheKey);
+}
+
+void GrOpenCLCompositor::prepareOpenCL()
+{
+    buildProgram();
+
+    ::cl_int errCode;
+    fClCompositeKernel = ::clCreateKernel(fClProgram,
+                                        COMPOSITE_LAYERS_KERNEL_NAME,
                                         &errCode);
     this->toRetChecked(errCode, __FUNCTION__, "clCreateKernel");
 
@@ -401,17 +660,34 @@ void GrOpenCLCompositor::prepareOpenCL()
     imageDesc.num_samples = 0;
     imageDesc.buffer = nullptr;
 
-    for (auto & image : fImages)
+    for (::cl_mem *image : { &fStagings[0].fImage, &fStagings[1].fImage, &fScratchImage })
     {
-        image = ::clCreateImage(fClContext,
-                                CL_MEM_READ_WRITE,
-                                &imageFormat,
-                                &imageDesc,
-                                nullptr,
-                                &errCode);
+        *image = ::clCreateImage(fClContext,
+                                 CL_MEM_READ_WRITE,
+                                 &imageFormat,
+                                 &imageDesc,
+                                 nullptr,
+                                 &errCode);
         this->toRetChecked(errCode, __FUNCTION__, "clCreateImage");
     }
 
+    size_t stagingSize = static_cast<size_t>(this->width()) * this->height() * sizeof(uint32_t);
+    for (ReadbackStaging& staging : fStagings)
+    {
+        staging.fCompositor = this;
+        staging.fPixels = static_cast<uint8_t*>(std::malloc(stagingSize));
+        if (staging.fPixels == nullptr)
+        {
+            throw RuntimeException::Builder(__FUNCTION__)
+                    .append("Failed to allocate readback staging buffer")
+                    .make<RuntimeException>();
+        }
+        /* Nothing has been read back yet */
+        staging.fOutdated.setRect(SkIRect::MakeWH(this->width(), this->height()));
+        /* Both frame images start transparent, so neither is outdated */
+        clClear(staging.fImage, SkIRect::MakeWH(this->width(), this->height()));
+    }
+
     computePreferredWorkSize();
 }
 
@@ -444,7 +720,7 @@ void GrOpenCLCompositor::computePreferredWorkSize()
 {
     size_t preferredWorkGroupSizeMultiple;
     RET_CHECKED(clGetKernelWorkGroupInfo,
-                fClSrcOverKernel,
+                fClCompositeKernel,
                 fClDeviceId,
                 CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
                 sizeof(size_t),
@@ -482,72 +758,438 @@ void GrOpenCLCompositor::computeWorkSize(int32_t width, int32_t height)
     }
 }
 
-void GrOpenCLCompositor::clComposite(::cl_mem target,
-                                     ::cl_mem image,
-                                     const SkRect &srcClip,
-                                     const SkRect &dstClip)
+void GrOpenCLCompositor::onRecomposite(GrTargetSurface& target, const DamageList& damage)
+{
+    ReadbackStaging& staging = nextStaging();
+    ::cl_mem frameImage = staging.fImage;
+    RUNTIME_EXCEPTION_ASSERT(target.asClSurface() == frameImage);
+
+    /* Previous layer table may still be being uploaded from fLayerTable */
+    if (fLayerTableEvent != nullptr)
+    {
+        auto start = std::chrono::steady_clock::now();
+        RET_CHECKED(clWaitForEvents, 1, &fLayerTableEvent);
+        ::clReleaseEvent(fLayerTableEvent);
+        fLayerTableEvent = nullptr;
+
+        std::scoped_lock<std::mutex> scopedLock(fReadbackMutex);
+        fReadbackStats.fUploadWaitTime += std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+
+    /* The frame image was read back two frames ago, which has usually
+       completed. It is waited on device, the Renderer thread is not
+       blocked, and the readback of previous frame is not waited at all */
+    if (staging.fReadEvent != nullptr)
+    {
+        RET_CHECKED(clEnqueueBarrierWithWaitList, fClCommandQueue, 1, &staging.fReadEvent, nullptr);
+        ::clReleaseEvent(staging.fReadEvent);
+        staging.fReadEvent = nullptr;
+    }
+
+    SkRegion damageRegion;
+    for (const SkIRect& rect : damage)
+        damageRegion.op(rect, SkRegion::kUnion_Op);
+
+    /* Areas changed by the previous frame are copied from the other image,
+       except the ones which are going to be composited anyway */
+    ReadbackStaging& previous = fStagings[fPresentedFrames % kStagingCount];
+    SkRegion copyRegion;
+    copyRegion.op(staging.fImageOutdated, damageRegion, SkRegion::kDifference_Op);
+    for (SkRegion::Iterator itr(copyRegion); !itr.done(); itr.next())
+    {
+        const SkIRect& rect = itr.rect();
+        size_t origin[3] = { static_cast<size_t>(rect.left()),
+                             static_cast<size_t>(rect.top()), 0 };
+        size_t region[3] = { static_cast<size_t>(rect.width()),
+                             static_cast<size_t>(rect.height()), 1 };
+        RET_CHECKED(clEnqueueCopyImage,
+                    fClCommandQueue,
+                    previous.fImage,
+                    frameImage,
+                    origin,
+                    origin,
+                    region,
+                    0, nullptr, nullptr);
+    }
+    staging.fImageOutdated.setEmpty();
+    previous.fImageOutdated.op(damageRegion, SkRegion::kUnion_Op);
+
+    fLayerTable.clear();
+    fDispatches.clear();
+    for (const SkIRect& rect : damage)
+    {
+        VisibleLayerList visible;
+        collectVisibleLayers(rect, visible);
+        if (visible.empty())
+            clClear(frameImage, rect);
+        else
+            appendDispatches(rect, visible, frameImage);
+    }
+
+    uploadLayerTable();
+    /* Command queue is in order, no event is needed between dispatches */
+    for (const Dispatch& dispatch : fDispatches)
+        enqueueDispatch(dispatch);
+}
+
+void GrOpenCLCompositor::appendDispatches(const SkIRect& rect, const VisibleLayerList& visible,
+                                          ::cl_mem frameImage)
+{
+    auto layerCount = static_cast<int32_t>(visible.size());
+    int32_t batchCount = (layerCount + kMaxBatchLayers - 1) / kMaxBatchLayers;
+
+    /* Visible layers are listed from top to bottom */
+    auto itr = visible.rbegin();
+    for (int32_t batch = 0; batch < batchCount; batch++)
+    {
+        Dispatch dispatch{};
+        dispatch.fRect = rect;
+        dispatch.fTableOffset = static_cast<int32_t>(fLayerTable.size());
+        dispatch.fLayerCount = std::min(kMaxBatchLayers, layerCount - batch * kMaxBatchLayers);
+        dispatch.fAccumulate = batch > 0;
+        /* The last batch always writes to the frame image */
+        bool toFrame = (batchCount - 1 - batch) % 2 == 0;
+        dispatch.fOut = toFrame ? frameImage : fScratchImage;
+        dispatch.fDst = toFrame ? fScratchImage : frameImage;
+
+        for (int32_t i = 0; i < dispatch.fLayerCount; i++, itr++)
+        {
+            LayerBinder *binder = itr->first;
+            GrBaseRenderLayer *layer = binder->fHandle;
+
+            SkMatrix inverse;
+            if (!layer->matrix().invert(&inverse))
+                inverse.setScale(0, 0);
+
+            ClLayerEntry entry{};
+            entry.fInverse[0] = inverse.getScaleX();
+            entry.fInverse[1] = inverse.getSkewX();
+            entry.fInverse[2] = inverse.getTranslateX();
+            entry.fInverse[3] = inverse.getSkewY();
+            entry.fInverse[4] = inverse.getScaleY();
+            entry.fInverse[5] = inverse.getTranslateY();
+
+            const SkIRect& clip = itr->second.getBounds();
+            entry.fClip[0] = clip.left();
+            entry.fClip[1] = clip.top();
+            entry.fClip[2] = clip.right();
+            entry.fClip[3] = clip.bottom();
+
+            SkIRect cover;
+            if (!layerCoverage(*binder, &cover))
+                cover.setEmpty();
+            entry.fCover[0] = cover.left();
+            entry.fCover[1] = cover.top();
+            entry.fCover[2] = cover.right();
+            entry.fCover[3] = cover.bottom();
+
+            entry.fOpacity = layer->opacity();
+            entry.fBlendMode = static_cast<::cl_int>(layer->blendMode());
+            /* Pixels are copied exactly if they are not resampled */
+            entry.fFilter = IsIntegerTranslate(layer->matrix()) ? 0 : 1;
+
+            fLayerTable.push_back(entry);
+            dispatch.fImages[i] = binder->fSubmittedImage.asOpenCLImage();
+        }
+
+        /* Kernel ignores the unused images, but they must be valid */
+        for (int32_t i = dispatch.fLayerCount; i < kMaxBatchLayers; i++)
+            dispatch.fImages[i] = dispatch.fImages[0];
+        fDispatches.push_back(dispatch);
+    }
+}
+
+void GrOpenCLCompositor::uploadLayerTable()
 {
-    if (fInWaitingEvent != nullptr)
+    if (fLayerTable.empty())
+        return;
+
+    size_t size = fLayerTable.size() * sizeof(ClLayerEntry);
+    if (size > fClLayerTableCapacity)
     {
-        RET_CHECKED(clWaitForEvents, 1, &fInWaitingEvent);
-        ::clReleaseEvent(fInWaitingEvent);
-        fInWaitingEvent = nullptr;
+        /* Commands which are still using the old buffer keep it alive */
+        if (fClLayerTable != nullptr)
+            ::clReleaseMemObject(fClLayerTable);
+
+        ::cl_int errCode;
+        fClLayerTableCapacity = std::max(size, fClLayerTableCapacity * 2);
+        fClLayerTable = ::clCreateBuffer(fClContext,
+                                         CL_MEM_READ_ONLY,
+                                         fClLayerTableCapacity,
+                                         nullptr,
+                                         &errCode);
+        this->toRetChecked(errCode, __FUNCTION__, "clCreateBuffer");
     }
 
-    ::cl_int2 srcClipVec, dstClipVec, clipDimVec;
-    srcClipVec.s0 = static_cast<::cl_int>(srcClip.left());
-    srcClipVec.s1 = static_cast<::cl_int>(srcClip.top());
-    dstClipVec.s0 = static_cast<::cl_int>(dstClip.left());
-    dstClipVec.s1 = static_cast<::cl_int>(dstClip.top());
-    clipDimVec.s0 = static_cast<::cl_int>(srcClip.width());
-    clipDimVec.s1 = static_cast<::cl_int>(srcClip.height());
-    computeWorkSize(srcClip.width(), srcClip.height());
-
-    RET_CHECKED(clSetKernelArg, fClSrcOverKernel, 0, sizeof(cl_mem), &image);
-    RET_CHECKED(clSetKernelArg, fClSrcOverKernel, 1, sizeof(cl_mem), &fImages[fCurrentOutputImage ^ 1]);
-    RET_CHECKED(clSetKernelArg, fClSrcOverKernel, 2, sizeof(cl_mem), &target);
-    RET_CHECKED(clSetKernelArg, fClSrcOverKernel, 3, sizeof(cl_int2), &srcClipVec);
-    RET_CHECKED(clSetKernelArg, fClSrcOverKernel, 4, sizeof(cl_int2), &dstClipVec);
-    RET_CHECKED(clSetKernelArg, fClSrcOverKernel, 5, sizeof(cl_int2), &clipDimVec);
-
-    ::clEnqueueNDRangeKernel(fClCommandQueue,
-                             fClSrcOverKernel,
-                             2,
-                             nullptr,
-                             fGlobalWorkSize,
-                             fLocalWorkSize,
-                             0,
-                             nullptr,
-                             &fInWaitingEvent);
-
-    fCurrentOutputImage ^= 1;
+    /* fLayerTable is not changed until fLayerTableEvent is completed */
+    RET_CHECKED(clEnqueueWriteBuffer,
+                fClCommandQueue,
+                fClLayerTable,
+                CL_FALSE,
+                0,
+                size,
+                fLayerTable.data(),
+                0, nullptr, &fLayerTableEvent);
+}
+
+void GrOpenCLCompositor::enqueueDispatch(const Dispatch& dispatch)
+{
+    ::cl_int layerCount = dispatch.fLayerCount;
+    ::cl_int accumulate = dispatch.fAccumulate ? 1 : 0;
+    ::cl_int tableOffset = dispatch.fTableOffset;
+    ::cl_int2 dstClipVec, clipDimVec;
+    dstClipVec.s0 = dispatch.fRect.left();
+    dstClipVec.s1 = dispatch.fRect.top();
+    clipDimVec.s0 = dispatch.fRect.width();
+    clipDimVec.s1 = dispatch.fRect.height();
+    computeWorkSize(dispatch.fRect.width(), dispatch.fRect.height());
+
+    for (::cl_uint i = 0; i < kMaxBatchLayers; i++)
+        RET_CHECKED(clSetKernelArg, fClCompositeKernel, i, sizeof(cl_mem), &dispatch.fImages[i]);
+    RET_CHECKED(clSetKernelArg, fClCompositeKernel, 8, sizeof(cl_mem), &dispatch.fDst);
+    RET_CHECKED(clSetKernelArg, fClCompositeKernel, 9, sizeof(cl_mem), &dispatch.fOut);
+    RET_CHECKED(clSetKernelArg, fClCompositeKernel, 10, sizeof(cl_mem), &fClLayerTable);
+    RET_CHECKED(clSetKernelArg, fClCompositeKernel, 11, sizeof(cl_int), &tableOffset);
+    RET_CHECKED(clSetKernelArg, fClCompositeKernel, 12, sizeof(cl_int), &layerCount);
+    RET_CHECKED(clSetKernelArg, fClCompositeKernel, 13, sizeof(cl_int), &accumulate);
+    RET_CHECKED(clSetKernelArg, fClCompositeKernel, 14, sizeof(cl_int2), &dstClipVec);
+    RET_CHECKED(clSetKernelArg, fClCompositeKernel, 15, sizeof(cl_int2), &clipDimVec);
+
+    RET_CHECKED(clEnqueueNDRangeKernel,
+                fClCommandQueue,
+                fClCompositeKernel,
+                2,
+                nullptr,
+                fGlobalWorkSize,
+                fLocalWorkSize,
+                0,
+                nullptr,
+                nullptr);
 }
 
 GrTargetSurface GrOpenCLCompositor::onTargetSurface()
 {
-    return GrTargetSurface(fImages[fCurrentOutputImage]);
+    return GrTargetSurface(nextStaging().fImage);
+}
+
+void GrOpenCLCompositor::clClear(::cl_mem target, const SkIRect& rect)
+{
+    const ::cl_float4 transparent = {{ 0.0f, 0.0f, 0.0f, 0.0f }};
+    size_t origin[3] = { static_cast<size_t>(rect.left()),
+                         static_cast<size_t>(rect.top()), 0 };
+    size_t region[3] = { static_cast<size_t>(rect.width()),
+                         static_cast<size_t>(rect.height()), 1 };
+
+    RET_CHECKED(clEnqueueFillImage,
+                fClCommandQueue,
+                target,
+                &transparent,
+                origin,
+                region,
+                0, nullptr, nullptr);
+}
+
+void GrOpenCLCompositor::onPresent(const DamageList& damage)
+{
+    if (damage.empty())
+        return;
+
+    size_t rowPitch = this->width() * sizeof(uint32_t);
+    ReadbackStaging& staging = nextStaging();
+    uint64_t frame = ++fPresentedFrames;
+
+    SkRegion damageRegion;
+    for (const SkIRect& rect : damage)
+        damageRegion.op(rect, SkRegion::kUnion_Op);
+
+    /* Staging buffer holds an older frame, its outdated areas are read as well */
+    SkRegion readRegion;
+    {
+        std::unique_lock<std::mutex> lock(fReadbackMutex);
+        waitForStaging(lock, staging);
+
+        readRegion.op(staging.fOutdated, damageRegion, SkRegion::kUnion_Op);
+        staging.fOutdated.setEmpty();
+        for (ReadbackStaging& other : fStagings)
+        {
+            if (&other != &staging)
+                other.fOutdated.op(damageRegion, SkRegion::kUnion_Op);
+        }
+
+        fUnpublishedDamage.emplace_back(frame, damageRegion);
+        staging.fFrame = frame;
+        staging.fBusy = true;
+        staging.fEnqueueTime = std::chrono::steady_clock::now();
+    }
+
+    /* Reads start after the composition of the frame */
+    ::cl_event composited = nullptr;
+    cl_int ret = ::clEnqueueMarkerWithWaitList(fClCommandQueue, 0, nullptr, &composited);
+    if (ret != CL_SUCCESS)
+    {
+        abandonReadback(staging);
+        this->toRetChecked(ret, __FUNCTION__, "clEnqueueMarkerWithWaitList");
+    }
+    ret = ::clFlush(fClCommandQueue);
+    if (ret != CL_SUCCESS)
+    {
+        ::clReleaseEvent(composited);
+        abandonReadback(staging);
+        this->toRetChecked(ret, __FUNCTION__, "clFlush");
+    }
+
+    ::cl_event readEvent = nullptr;
+    for (SkRegion::Iterator itr(readRegion); !itr.done(); itr.next())
+    {
+        const SkIRect& rect = itr.rect();
+        size_t origin[3] = { static_cast<size_t>(rect.left()),
+                             static_cast<size_t>(rect.top()), 0 };
+        size_t region[3] = { static_cast<size_t>(rect.width()),
+                             static_cast<size_t>(rect.height()), 1 };
+        uint8_t *dst = staging.fPixels
+                       + rect.top() * rowPitch
+                       + rect.left() * sizeof(uint32_t);
+
+        /* Queue is in order, the event of the last read covers all of them */
+        if (readEvent != nullptr)
+            ::clReleaseEvent(readEvent);
+        readEvent = nullptr;
+        ret = ::clEnqueueReadImage(fClReadbackQueue,
+                                   staging.fImage,
+                                   CL_FALSE,
+                                   origin,
+                                   region,
+                                   rowPitch, 0,
+                                   dst,
+                                   1,
+                                   &composited,
+                                   &readEvent);
+        if (ret != CL_SUCCESS)
+        {
+            ::clReleaseEvent(composited);
+            abandonReadback(staging);
+            this->toRetChecked(ret, __FUNCTION__, "clEnqueueReadImage");
+        }
+    }
+    ::clReleaseEvent(composited);
+
+    /* Callback releases the event, so it is retained for the next
+       composition into the same frame image */
+    ::clRetainEvent(readEvent);
+    if (staging.fReadEvent != nullptr)
+        ::clReleaseEvent(staging.fReadEvent);
+    staging.fReadEvent = readEvent;
+
+    ret = ::clSetEventCallback(readEvent, CL_COMPLETE, ReadbackCompleteCallback, &staging);
+    if (ret != CL_SUCCESS)
+    {
+        ::clReleaseEvent(readEvent);
+        abandonReadback(staging);
+        this->toRetChecked(ret, __FUNCTION__, "clSetEventCallback");
+    }
+    RET_CHECKED(clFlush, fClReadbackQueue);
+}
+
+void GrOpenCLCompositor::onWaitForPublished()
+{
+    std::unique_lock<std::mutex> lock(fReadbackMutex);
+    for (ReadbackStaging& staging : fStagings)
+        waitForStaging(lock, staging);
+}
+
+void GrOpenCLCompositor::addMapWaitTime(double milliseconds)
+{
+    std::scoped_lock<std::mutex> scopedLock(fReadbackMutex);
+    fReadbackStats.fMapWaitTime += milliseconds;
+}
+
+void GrOpenCLCompositor::abandonReadback(ReadbackStaging& staging)
+{
+    /* Commands already enqueued may still write the staging buffer */
+    ::clFinish(fClReadbackQueue);
+
+    std::scoped_lock<std::mutex> scopedLock(fReadbackMutex);
+    staging.fOutdated.setRect(SkIRect::MakeWH(this->width(), this->height()));
+    staging.fBusy = false;
+    fReadbackCondition.notify_all();
+}
+
+ClReadbackStats GrOpenCLCompositor::readbackStats()
+{
+    std::scoped_lock<std::mutex> scopedLock(fReadbackMutex);
+    return fReadbackStats;
+}
+
+void GrOpenCLCompositor::waitForStaging(std::unique_lock<std::mutex>& lock, ReadbackStaging& staging)
+{
+    if (!staging.fBusy)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    fReadbackCondition.wait(lock, [&staging]() { return !staging.fBusy; });
+    fReadbackStats.fWaitTime += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+void CL_CALLBACK GrOpenCLCompositor::ReadbackCompleteCallback(::cl_event event,
+                                                              ::cl_int status,
+                                                              void *userData)
+{
+    auto *staging = reinterpret_cast<ReadbackStaging*>(userData);
+    staging->fCompositor->completeReadback(*staging, status);
+    ::clReleaseEvent(event);
 }
 
-void GrOpenCLCompositor::onPresent()
+void GrOpenCLCompositor::completeReadback(ReadbackStaging& staging, ::cl_int status)
 {
-    size_t origin[3] = { 0, 0, 0 };
-    size_t region[3];
-    region[0] = this->width();
-    region[1] = this->height();
-    region[2] = 1;
-
-    GrBasePlatform::ScopedAcquireBuffer scopedAcquireBuffer(getPlatform());
-    cl_int ret = ::clEnqueueReadImage(fClCommandQueue,
-                                      fImages[fCurrentOutputImage],
-                                      CL_TRUE,
-                                      origin,
-                                      region,
-                                      0, 0,
-                                      getPlatform()->writableBuffer(),
-                                      0,
-                                      nullptr,
-                                      nullptr);
-    this->toRetChecked(ret, __FUNCTION__, "clEnqueueReadImage");
+    /* Callbacks may be called on any thread, the mutex makes
+       them the only producer of platform buffers in turn */
+    std::scoped_lock<std::mutex> scopedLock(fReadbackMutex);
+
+    fReadbackStats.fFrames++;
+    fReadbackStats.fReadbackTime += std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - staging.fEnqueueTime).count();
+
+    if (status != CL_COMPLETE)
+    {
+        log_write(LOG_ERROR) << "Failed to read back frame " << staging.fFrame
+                             << " from OpenCL device: " << status << log_endl;
+        /* Damage is kept and published with the next frame */
+        staging.fOutdated.setRect(SkIRect::MakeWH(this->width(), this->height()));
+    }
+    else if (staging.fFrame > fPublishedFrame)
+    {
+        /* Frames completed out of order have been covered by later frames */
+        SkRegion damage;
+        while (!fUnpublishedDamage.empty() && fUnpublishedDamage.front().first <= staging.fFrame)
+        {
+            damage.op(fUnpublishedDamage.front().second, SkRegion::kUnion_Op);
+            fUnpublishedDamage.pop_front();
+        }
+
+        size_t rowPitch = this->width() * sizeof(uint32_t);
+        GrBasePlatform::ScopedAcquireBuffer scopedAcquireBuffer(getPlatform());
+        SkRegion copyRegion(scopedAcquireBuffer.outdated());
+        copyRegion.op(damage, SkRegion::kUnion_Op);
+        for (SkRegion::Iterator itr(copyRegion); !itr.done(); itr.next())
+        {
+            const SkIRect& rect = itr.rect();
+            size_t offset = rect.top() * rowPitch + rect.left() * sizeof(uint32_t);
+            for (int32_t y = 0; y < rect.height(); y++)
+            {
+                std::memcpy(scopedAcquireBuffer.buffer() + offset + y * rowPitch,
+                            staging.fPixels + offset + y * rowPitch,
+                            rect.width() * sizeof(uint32_t));
+            }
+        }
+        for (SkRegion::Iterator itr(damage); !itr.done(); itr.next())
+            scopedAcquireBuffer.damage(itr.rect());
+        fPublishedFrame = staging.fFrame;
+    }
+
+    staging.fBusy = false;
+    fReadbackCondition.notify_all();
 }
 
 GrBaseRenderLayer * GrOpenCLCompositor::onCreateRenderLayer(int32_t width,
@@ -561,23 +1203,41 @@ GrBaseRenderLayer * GrOpenCLCompositor::onCreateRenderLayer(int32_t width,
     imageFormat.image_channel_data_type = CL_UNORM_INT8;
     imageFormat.image_channel_order = ToOpenCLChannelOrder(colorFormat());
 
+    /* Layer draws into the memory which backs the image directly. Page-aligned
+       memory and cache-line aligned rows let drivers use it without copying. */
+    constexpr size_t kRowAlignment = 64;
+    constexpr size_t kPageSize = 4096;
+    size_t rowBytes = (width * sizeof(uint32_t) + kRowAlignment - 1) & ~(kRowAlignment - 1);
+    size_t allocSize = (rowBytes * height + kPageSize - 1) & ~(kPageSize - 1);
+    auto *hostPtr = static_cast<uint8_t*>(std::aligned_alloc(kPageSize, allocSize));
+    if (hostPtr == nullptr)
+    {
+        throw RuntimeException::Builder(__FUNCTION__)
+                .append("Failed to allocate memory for layer")
+                .make<RuntimeException>();
+    }
+    std::memset(hostPtr, 0, allocSize);
+
     imageDesc.image_type = CL_MEM_OBJECT_IMAGE2D;
     imageDesc.image_width = width;
     imageDesc.image_height = height;
     imageDesc.image_array_size = 0;
-    imageDesc.image_row_pitch = 0;
+    imageDesc.image_row_pitch = rowBytes;
     imageDesc.image_slice_pitch = 0;
     imageDesc.num_mip_levels = 0;
     imageDesc.num_samples = 0;
     imageDesc.buffer = nullptr;
 
+    /* Layers are only read by composition kernel */
     ::cl_int errCode;
     ::cl_mem image = ::clCreateImage(fClContext,
-                                     CL_MEM_READ_WRITE,
+                                     CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
                                      &imageFormat,
                                      &imageDesc,
-                                     nullptr,
+                                     hostPtr,
                                      &errCode);
+    if (errCode != CL_SUCCESS)
+        std::free(hostPtr);
     this->toRetChecked(errCode, __FUNCTION__, "clCreateImage");
 
     SkImageInfo imageInfo = SkImageInfo::Make(width, height,
@@ -588,7 +1248,10 @@ GrBaseRenderLayer * GrOpenCLCompositor::onCreateRenderLayer(int32_t width,
                                    width, height,
                                    imageInfo,
                                    image,
-                                   fClCommandQueue);
+                                   hostPtr,
+                                   rowBytes,
+                                   fClCommandQueue,
+                                   this);
 }
 
 cl_channel_order GrOpenCLCompositor::ToOpenCLChannelOrder(GrColorFormat colorFormat)
@@ -3,6 +3,12 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
 
 #include <CL/cl.h>
 
@@ -31,9 +37,60 @@ struct ClDeviceProperties
     ::size_t                fPreferredWorkGroupSizeMultiple;
 };
 
+/* Parameters of a layer read by the composition kernel, same layout as layer_entry */
+struct ClLayerEntry
+{
+    ::cl_float              fInverse[8];
+    ::cl_int                fClip[4];
+    ::cl_int                fCover[4];
+    ::cl_float              fOpacity;
+    ::cl_int                fBlendMode;
+    ::cl_int                fFilter;
+    ::cl_int                fReserved;
+};
+static_assert(sizeof(ClLayerEntry) == 80, "ClLayerEntry must match layer_entry of OpenCL kernel");
+
+/* Timing of asynchronous readbacks, in milliseconds */
+struct ClReadbackStats
+{
+    uint64_t                fFrames = 0;
+    /* From enqueuing readback to its completion */
+    double                  fReadbackTime = 0;
+    /* Renderer thread was blocked by readbacks, in present() or waitForPublished() */
+    double                  fWaitTime = 0;
+    /* Composition was blocked by the upload of previous layer table */
+    double                  fUploadWaitTime = 0;
+    /* Layers waited for composition to map their images for drawing */
+    double                  fMapWaitTime = 0;
+
+    /* Fraction of readback time overlapped with other work of Renderer thread */
+    inline double overlap() const
+    { return fReadbackTime > 0 ? 1.0 - std::min(fWaitTime / fReadbackTime, 1.0) : 0; }
+};
+
+/**
+ * GrOpenCLCompositor composites each damaged rectangle in a single
+ * NDRange, where every work-item walks through the layers and blends
+ * them in registers. If more than kMaxBatchLayers layers are visible
+ * in a rectangle, they are split into batches which ping-pong between
+ * the frame image and a scratch image, ending on the frame image.
+ *
+ * Frames are composited into one of two frame images in turn, and read
+ * back asynchronously into the staging buffer paired with the image,
+ * by a separate command queue which only waits for the composition of
+ * the frame. When the readback completes, an event callback copies the
+ * frame into the platform buffer and publishes it. Frame N+1 is
+ * composited into the other image, which is first brought up to date by
+ * copying the areas damaged by frame N, so that the readback of frame N
+ * overlaps the drawing, uploads and composition of frame N+1. Only the
+ * readback of frame N-1 must have completed before that.
+ */
 class GrOpenCLCompositor : public GrBaseCompositor
 {
 public:
+    /* Number of layer images accepted by the composition kernel */
+    static constexpr int32_t kMaxBatchLayers = 8;
+
     GrOpenCLCompositor(int32_t width,
                        int32_t height,
                        GrColorFormat colorFormat,
@@ -47,19 +104,25 @@ public:
                                                         const std::string& platformKeyword,
                                                         const std::string& deviceKeyword);
 
+    ClReadbackStats readbackStats();
+
 private:
+    friend class GrOpenCLRenderLayer;
+
     void createOpenCL(const std::string& platformKeyword,
                       const std::string& deviceKeyword);
     bool isPlatformSuitable(::cl_platform_id platformId, const std::string& keyword);
     bool isDeviceSuitable(::cl_device_id deviceId, const std::string& keyword);
     bool isDevicePropertiesSuitable(const ClDeviceProperties& props, const std::string& keyword);
+    void buildProgram();
     void prepareOpenCL();
     static void printProgramBuildLog(const std::string& log);
 
-    void clComposite(::cl_mem target, ::cl_mem image,
-                     const SkRect& srcClip, const SkRect& dstClip) override;
+    void clClear(::cl_mem target, const SkIRect& rect) override;
+    void onRecomposite(GrTargetSurface& target, const DamageList& damage) override;
     GrTargetSurface onTargetSurface() override;
-    void onPresent() override;
+    void onPresent(const DamageList& damage) override;
+    void onWaitForPublished() override;
     GrBaseRenderLayer *onCreateRenderLayer(int32_t width,
                                            int32_t height,
                                            int32_t left,
@@ -68,6 +131,54 @@ private:
 
     void toRetChecked(::cl_int ret, const char *func, const char *cl_func);
 
+    struct Dispatch
+    {
+        SkIRect             fRect;
+        int32_t             fTableOffset;
+        int32_t             fLayerCount;
+        bool                fAccumulate;
+        ::cl_mem            fImages[kMaxBatchLayers];
+        ::cl_mem            fDst;
+        ::cl_mem            fOut;
+    };
+
+    void appendDispatches(const SkIRect& rect, const VisibleLayerList& visible,
+                          ::cl_mem frameImage);
+    void uploadLayerTable();
+    void enqueueDispatch(const Dispatch& dispatch);
+
+    static constexpr int32_t kStagingCount = 2;
+
+    struct ReadbackStaging
+    {
+        GrOpenCLCompositor     *fCompositor = nullptr;
+        /* Frame image which is composited and read back into this staging */
+        ::cl_mem                fImage = nullptr;
+        /* Areas damaged by the other image since this image was composited,
+           only used by the Renderer thread */
+        SkRegion                fImageOutdated;
+        /* Last readback from fImage, composition into it waits for that */
+        ::cl_event              fReadEvent = nullptr;
+        uint8_t                *fPixels = nullptr;
+        /* Areas older than the frame image, guarded by fReadbackMutex */
+        SkRegion                fOutdated;
+        uint64_t                fFrame = 0;
+        bool                    fBusy = false;
+        std::chrono::steady_clock::time_point
+                                fEnqueueTime;
+    };
+
+    /* Staging of the frame which is going to be composited */
+    inline ReadbackStaging& nextStaging()
+    { return fStagings[(fPresentedFrames + 1) % kStagingCount]; }
+
+    static void CL_CALLBACK ReadbackCompleteCallback(::cl_event event, ::cl_int status, void *userData);
+    void waitForStaging(std::unique_lock<std::mutex>& lock, ReadbackStaging& staging);
+    void completeReadback(ReadbackStaging& staging, ::cl_int status);
+    void abandonReadback(ReadbackStaging& staging);
+    /* Called by layers on raster threads */
+    void addMapWaitTime(double milliseconds);
+
     void computePreferredWorkSize();
     void computeWorkSize(int32_t width, int32_t height);
 
@@ -78,12 +189,30 @@ private:
     ::cl_device_id              fClDeviceId;
     ::cl_context                fClContext;
     ::cl_command_queue          fClCommandQueue;
+    /* Readbacks of frames, out of order with the composition of next frame */
+    ::cl_command_queue          fClReadbackQueue;
     ::cl_program                fClProgram;
-    ::cl_kernel                 fClSrcOverKernel;
-    ::cl_mem                    fImages[2];
-    int8_t                      fCurrentOutputImage;
+    ::cl_kernel                 fClCompositeKernel;
+    /* Output of odd batches when a rectangle needs several of them */
+    ::cl_mem                    fScratchImage;
     ClDeviceProperties          fClDeviceProperties;
-    ::cl_event                  fInWaitingEvent;
+
+    /* Layer table of current frame, shared by all the dispatches */
+    std::vector<ClLayerEntry>   fLayerTable;
+    std::vector<Dispatch>       fDispatches;
+    ::cl_mem                    fClLayerTable;
+    size_t                      fClLayerTableCapacity;
+    ::cl_event                  fLayerTableEvent;
+
+    ReadbackStaging             fStagings[kStagingCount];
+    std::mutex                  fReadbackMutex;
+    std::condition_variable     fReadbackCondition;
+    /* Damage of the frames which have not been published yet */
+    std::deque<std::pair<uint64_t, SkRegion>>
+                                fUnpublishedDamage;
+    uint64_t                    fPresentedFrames;
+    uint64_t                    fPublishedFrame;
+    ClReadbackStats             fReadbackStats;
 
     size_t                      fGlobalWorkSize[2]{};
     size_t                      fLocalWorkSize[2]{};
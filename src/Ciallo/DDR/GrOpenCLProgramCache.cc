@@ -0,0 +1,192 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <vector>
+
+#include <unistd.h>
+
+#include <CL/cl.h>
+
+#include "Core/Journal.h"
+#include "Ciallo/GrBase.h"
+#include "Ciallo/DDR/GrOpenCLProgramCache.h"
+CIALLO_BEGIN_NS
+
+namespace {
+
+constexpr char kCacheMagic[8] = { 'C', 'L', 'P', 'R', 'O', 'G', '0', '1' };
+
+/* FNV-1a, only used to name the cache files */
+uint64_t hash_string(const char *str, size_t size, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= static_cast<uint8_t>(str[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+std::string platform_info(::cl_platform_id platform, ::cl_platform_info param)
+{
+    size_t size = 0;
+    if (::clGetPlatformInfo(platform, param, 0, nullptr, &size) != CL_SUCCESS || size == 0)
+        return "";
+    std::string str(size, '\0');
+    ::clGetPlatformInfo(platform, param, size, str.data(), nullptr);
+    str.pop_back();
+    return str;
+}
+
+std::string device_info(::cl_device_id device, ::cl_device_info param)
+{
+    size_t size = 0;
+    if (::clGetDeviceInfo(device, param, 0, nullptr, &size) != CL_SUCCESS || size == 0)
+        return "";
+    std::string str(size, '\0');
+    ::clGetDeviceInfo(device, param, size, str.data(), nullptr);
+    str.pop_back();
+    return str;
+}
+
+} // namespace anonymous
+
+GrOpenCLProgramCache::GrOpenCLProgramCache(const std::string& directory)
+    : fDirectory(directory)
+{
+}
+
+std::string GrOpenCLProgramCache::MakeKey(::cl_platform_id platform, ::cl_device_id device,
+                                          const char *source, size_t sourceSize)
+{
+    char sourceHash[17];
+    std::snprintf(sourceHash, sizeof(sourceHash), "%016llx",
+                  static_cast<unsigned long long>(hash_string(source, sourceSize)));
+
+    return platform_info(platform, CL_PLATFORM_NAME) + "\n"
+           + platform_info(platform, CL_PLATFORM_VERSION) + "\n"
+           + device_info(device, CL_DEVICE_NAME) + "\n"
+           + device_info(device, CL_DEVICE_VENDOR) + "\n"
+           + device_info(device, CL_DEVICE_VERSION) + "\n"
+           + device_info(device, CL_DRIVER_VERSION) + "\n"
+           + sourceHash;
+}
+
+std::string GrOpenCLProgramCache::pathOf(const std::string& key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin",
+                  static_cast<unsigned long long>(hash_string(key.data(), key.size())));
+    return fDirectory + "/" + name;
+}
+
+::cl_program GrOpenCLProgramCache::load(::cl_context context, ::cl_device_id device, const std::string& key)
+{
+    if (!enabled())
+        return nullptr;
+
+    std::ifstream fs(pathOf(key), std::ios::binary);
+    if (!fs.is_open())
+        return nullptr;
+
+    /* Layout: magic, key size (uint32), key, binary size (uint64), binary */
+    char magic[sizeof(kCacheMagic)];
+    uint32_t keySize = 0;
+    uint64_t binarySize = 0;
+    fs.read(magic, sizeof(magic));
+    fs.read(reinterpret_cast<char*>(&keySize), sizeof(keySize));
+    if (!fs || std::memcmp(magic, kCacheMagic, sizeof(kCacheMagic)) != 0 || keySize != key.size())
+        return nullptr;
+
+    std::string storedKey(keySize, '\0');
+    fs.read(storedKey.data(), keySize);
+    fs.read(reinterpret_cast<char*>(&binarySize), sizeof(binarySize));
+    if (!fs || storedKey != key || binarySize == 0)
+    {
+        log_write(LOG_DEBUG) << "OpenCL program cache mismatched, rebuilding from source" << log_endl;
+        return nullptr;
+    }
+
+    std::vector<unsigned char> binary(binarySize);
+    fs.read(reinterpret_cast<char*>(binary.data()), static_cast<std::streamsize>(binarySize));
+    if (!fs)
+        return nullptr;
+
+    const unsigned char *binaryPtr = binary.data();
+    size_t size = binary.size();
+    ::cl_int binaryStatus, errCode;
+    ::cl_program program = ::clCreateProgramWithBinary(context, 1, &device, &size, &binaryPtr,
+                                                       &binaryStatus, &errCode);
+    if (errCode != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+    {
+        if (program != nullptr)
+            ::clReleaseProgram(program);
+        log_write(LOG_DEBUG) << "OpenCL program cache was rejected by driver, rebuilding from source" << log_endl;
+        return nullptr;
+    }
+
+    /* Binaries still need to be built, which is much cheaper than compiling */
+    if (::clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr) != CL_SUCCESS)
+    {
+        ::clReleaseProgram(program);
+        return nullptr;
+    }
+    log_write(LOG_DEBUG) << "Loaded OpenCL program from cache " << pathOf(key) << log_endl;
+    return program;
+}
+
+void GrOpenCLProgramCache::store(::cl_program program, const std::string& key)
+{
+    if (!enabled())
+        return;
+
+    size_t binarySize = 0;
+    if (::clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binarySize, nullptr) != CL_SUCCESS
+        || binarySize == 0)
+        return;
+
+    std::vector<unsigned char> binary(binarySize);
+    unsigned char *binaryPtr = binary.data();
+    if (::clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binaryPtr), &binaryPtr, nullptr) != CL_SUCCESS)
+        return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(fDirectory, ec);
+    if (ec)
+    {
+        log_write(LOG_WARNING) << "Failed to create OpenCL program cache directory "
+                               << fDirectory << ": " << ec.message() << log_endl;
+        return;
+    }
+
+    /* Written into a temporary file first, so other processes never see a partial file */
+    std::string path = pathOf(key);
+    std::string tmpPath = path + ".tmp." + std::to_string(::getpid());
+    {
+        std::ofstream fs(tmpPath, std::ios::binary | std::ios::trunc);
+        auto keySize = static_cast<uint32_t>(key.size());
+        auto size = static_cast<uint64_t>(binarySize);
+        fs.write(kCacheMagic, sizeof(kCacheMagic));
+        fs.write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+        fs.write(key.data(), keySize);
+        fs.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        fs.write(reinterpret_cast<const char*>(binary.data()), static_cast<std::streamsize>(binarySize));
+        if (!fs)
+        {
+            log_write(LOG_WARNING) << "Failed to write OpenCL program cache " << tmpPath << log_endl;
+            fs.close();
+            std::filesystem::remove(tmpPath, ec);
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        log_write(LOG_WARNING) << "Failed to write OpenCL program cache " << path << log_endl;
+        std::filesystem::remove(tmpPath, ec);
+    }
+}
+
+CIALLO_END_NS
@@ -0,0 +1,51 @@
+#ifndef COCOA_GROPENCLPROGRAMCACHE_H
+#define COCOA_GROPENCLPROGRAMCACHE_H
+
+#include <string>
+
+#include <CL/cl.h>
+
+#include "Ciallo/GrBase.h"
+CIALLO_BEGIN_NS
+
+/**
+ * GrOpenCLProgramCache keeps binaries of built OpenCL programs on disk,
+ * so that they are not compiled from source on every launch.
+ *
+ * A binary is identified by a key, which should contain everything the
+ * binary depends on (platform, device, driver version, source and so on).
+ * Cache files are named after the hash of key, and the whole key is
+ * stored in the file and compared when loading, so a binary built by
+ * another driver or from another source is never used.
+ */
+class GrOpenCLProgramCache
+{
+public:
+    /* An empty @a directory disables the cache */
+    explicit GrOpenCLProgramCache(const std::string& directory);
+    ~GrOpenCLProgramCache() = default;
+
+    inline bool enabled() const
+    { return !fDirectory.empty(); }
+
+    /**
+     * @brief Creates and builds a program from the cached binary.
+     * @return nullptr if there is no valid binary for @a key,
+     *         then the program should be built from source.
+     */
+    ::cl_program load(::cl_context context, ::cl_device_id device, const std::string& key);
+
+    /* Writes binary of a built program, failures are only logged */
+    void store(::cl_program program, const std::string& key);
+
+    static std::string MakeKey(::cl_platform_id platform, ::cl_device_id device,
+                               const char *source, size_t sourceSize);
+
+private:
+    std::string pathOf(const std::string& key) const;
+
+    std::string     fDirectory;
+};
+
+CIALLO_END_NS
+#endif //COCOA_GROPENCLPROGRAMCACHE_H
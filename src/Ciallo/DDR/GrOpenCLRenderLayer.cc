@@ -1,3 +1,6 @@
+#include <cstdlib>
+#include <chrono>
+
 #include <CL/cl.h>
 #include "include/core/SkImageInfo.h"
 #include "include/core/SkSurface.h"
@@ -5,29 +8,40 @@
 
 #include "Ciallo/GrBase.h"
 #include "Ciallo/DDR/GrOpenCLRenderLayer.h"
+#include "Ciallo/DDR/GrOpenCLCompositor.h"
 CIALLO_BEGIN_NS
 
 GrOpenCLRenderLayer::GrOpenCLRenderLayer(int32_t x, int32_t y, int32_t z,
                                          int32_t width, int32_t height,
                                          const SkImageInfo& imageInfo,
-                                         cl_mem image, cl_command_queue commandQueue)
+                                         cl_mem image, uint8_t *hostPtr, size_t rowBytes,
+                                         cl_command_queue commandQueue,
+                                         GrOpenCLCompositor *compositor)
     : GrBaseRenderLayer(x, y, z, width, height),
       fCommandQueue(commandQueue),
+      fClCompositor(compositor),
       fDeviceImage(image),
-      fBitmapAddr(nullptr),
-      fBitmapSize(0),
+      fBitmapAddr(hostPtr),
+      fRowBytes(rowBytes),
+      fMapped(false),
+      fUnmapEvent(nullptr),
       fSurface(nullptr),
       fImageInfo(imageInfo)
 {
-    fBitmapSize = width * height * imageInfo.bytesPerPixel();
 }
 
 GrOpenCLRenderLayer::~GrOpenCLRenderLayer()
 {
-    /* "if" is unnecessary, deleting a null-pointer has no effect */
-    delete[] fBitmapAddr;
+    if (fMapped)
+        ::clEnqueueUnmapMemObject(fCommandQueue, fDeviceImage, fBitmapAddr, 0, nullptr, nullptr);
+    if (fUnmapEvent)
+        ::clReleaseEvent(fUnmapEvent);
     if (fDeviceImage)
         ::clReleaseMemObject(fDeviceImage);
+
+    /* Host memory must outlive all the commands using the image */
+    ::clFinish(fCommandQueue);
+    std::free(fBitmapAddr);
 }
 
 SkCanvas *GrOpenCLRenderLayer::onCreateCanvas()
@@ -35,9 +49,7 @@ SkCanvas *GrOpenCLRenderLayer::onCreateCanvas()
     if (fSurface != nullptr)
         return fSurface->getCanvas();
 
-    fBitmapAddr = new uint8_t[fBitmapSize];
-    fSurface = SkSurface::MakeRasterDirect(fImageInfo, fBitmapAddr,
-                                           this->width() * fImageInfo.bytesPerPixel());
+    fSurface = SkSurface::MakeRasterDirect(fImageInfo, fBitmapAddr, fRowBytes);
     if (fSurface == nullptr)
     {
         throw RuntimeException::Builder(__FUNCTION__)
@@ -47,42 +59,75 @@ SkCanvas *GrOpenCLRenderLayer::onCreateCanvas()
     return fSurface->getCanvas();
 }
 
-GrLayerResult GrOpenCLRenderLayer::onLayerResult()
+void GrOpenCLRenderLayer::onPrepareCanvas()
 {
-    if (fBitmapAddr == nullptr)
+    if (fMapped)
+        return;
+
+    size_t origin[3] = { 0, 0, 0 };
+    size_t region[3] = { static_cast<size_t>(this->width()),
+                         static_cast<size_t>(this->height()), 1 };
+    size_t rowPitch;
+    ::cl_int ret;
+
+    /* Compositor may still be reading the image, mapping waits for it */
+    auto start = std::chrono::steady_clock::now();
+    void *mapped = ::clEnqueueMapImage(fCommandQueue,
+                                       fDeviceImage,
+                                       CL_TRUE,
+                                       CL_MAP_READ | CL_MAP_WRITE,
+                                       origin,
+                                       region,
+                                       &rowPitch,
+                                       nullptr,
+                                       fUnmapEvent ? 1 : 0,
+                                       fUnmapEvent ? &fUnmapEvent : nullptr,
+                                       nullptr,
+                                       &ret);
+    fClCompositor->addMapWaitTime(std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count());
+    if (ret != CL_SUCCESS)
     {
         throw RuntimeException::Builder(__FUNCTION__)
-                .append("Nothing was rendered on this layer")
+                .append("Failed to map OpenCL image of layer")
                 .make<RuntimeException>();
     }
 
-    SkIRect boundary = dirtyBoundary();
-    size_t origin[3];
-    size_t region[3];
-    origin[0] = boundary.left();
-    origin[1] = boundary.top();
-    origin[2] = 0;
-    region[0] = boundary.width();
-    region[1] = boundary.height();
-    region[2] = 1;
+    /* Images created with CL_MEM_USE_HOST_PTR are mapped to their host memory */
+    RUNTIME_EXCEPTION_ASSERT(mapped == fBitmapAddr && rowPitch == fRowBytes);
+    if (fUnmapEvent)
+    {
+        ::clReleaseEvent(fUnmapEvent);
+        fUnmapEvent = nullptr;
+    }
+    fMapped = true;
+}
 
-    ::cl_int ret = ::clEnqueueWriteImage(fCommandQueue,
-                                         fDeviceImage,
-                                         CL_TRUE,
-                                         origin,
-                                         region,
-                                         this->width() * fImageInfo.bytesPerPixel(),
-                                         0,
-                                         fBitmapAddr,
-                                         0,
-                                         nullptr,
-                                         nullptr);
-    if (ret != CL_SUCCESS)
+GrLayerResult GrOpenCLRenderLayer::onLayerResult()
+{
+    if (fSurface == nullptr)
     {
         throw RuntimeException::Builder(__FUNCTION__)
-                .append("Failed to copy buffer from OpenCL device to host device")
+                .append("Nothing was rendered on this layer")
                 .make<RuntimeException>();
     }
+
+    if (fMapped)
+    {
+        ::cl_int ret = ::clEnqueueUnmapMemObject(fCommandQueue,
+                                                 fDeviceImage,
+                                                 fBitmapAddr,
+                                                 0,
+                                                 nullptr,
+                                                 &fUnmapEvent);
+        if (ret != CL_SUCCESS)
+        {
+            throw RuntimeException::Builder(__FUNCTION__)
+                    .append("Failed to unmap OpenCL image of layer")
+                    .make<RuntimeException>();
+        }
+        fMapped = false;
+    }
     return GrLayerResult(fDeviceImage);
 }
 
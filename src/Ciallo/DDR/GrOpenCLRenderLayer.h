@@ -10,25 +10,53 @@
 #include "Ciallo/DDR/GrBaseRenderLayer.h"
 CIALLO_BEGIN_NS
 
+class GrOpenCLCompositor;
+
+/**
+ * GrOpenCLRenderLayer draws into the host memory which backs the
+ * OpenCL image (CL_MEM_USE_HOST_PTR), so there is no copy between
+ * Skia and OpenCL. The image is mapped while drawing and unmapped
+ * when it is submitted to compositor. Unmapping is asynchronous,
+ * and on CPU devices it costs nothing.
+ * As a mapped image can't be read by kernels, drawing on the layer
+ * after update() waits until composition has finished reading it
+ * (but not the readback of the frame, which uses another queue).
+ */
 class GrOpenCLRenderLayer : public GrBaseRenderLayer
 {
 public:
+    /**
+     * @param image: Image created with CL_MEM_USE_HOST_PTR and @a hostPtr.
+     * @param hostPtr: Backing store of @a image allocated by std::aligned_alloc(),
+     *                 the layer takes the ownership.
+     * @param rowBytes: Row pitch of @a image.
+     * @param compositor: Compositor of the layer, which collects the time
+     *                    of waiting for mapping.
+     */
     GrOpenCLRenderLayer(int32_t x, int32_t y, int32_t z,
                         int32_t width, int32_t height,
                         const SkImageInfo& imageInfo,
                         cl_mem image,
-                        cl_command_queue commandQueue);
+                        uint8_t *hostPtr,
+                        size_t rowBytes,
+                        cl_command_queue commandQueue,
+                        GrOpenCLCompositor *compositor);
     ~GrOpenCLRenderLayer() override;
 
 private:
     GrLayerResult onLayerResult() override;
     SkCanvas *onCreateCanvas() override;
+    void onPrepareCanvas() override;
 
 private:
     ::cl_command_queue      fCommandQueue;
+    GrOpenCLCompositor     *fClCompositor;
     ::cl_mem                fDeviceImage;
     uint8_t                *fBitmapAddr;
-    size_t                  fBitmapSize;
+    size_t                  fRowBytes;
+    bool                    fMapped;
+    /* Signaled when the pixels have been handed to device */
+    ::cl_event              fUnmapEvent;
     sk_sp<SkSurface>        fSurface;
     SkImageInfo             fImageInfo;
 };
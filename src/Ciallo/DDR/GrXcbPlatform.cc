@@ -4,8 +4,12 @@
 #include <string>
 #include <memory>
 
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
 #include <xcb/xcb.h>
 #include <xcb/xcb_renderutil.h>
+#include <xcb/shm.h>
 #include <vulkan/vulkan.h>
 
 #include "Core/Journal.h"
@@ -34,10 +38,8 @@ GrXcbPlatform::GrXcbPlatform(::xcb_connection_t *connection,
       fWindowAttributes(attrs),
       fScreen(screen),
 
-      fXcbImage(nullptr),
       fXcbPixmap(0),
       fXcbGContext(0),
-      fBufferAddr(nullptr),
       fBufferSize(0)
 {
 }
@@ -47,8 +49,12 @@ GrXcbPlatform::~GrXcbPlatform()
     if (fWindowAttributes)
         std::free(fWindowAttributes);
 
-    if (fXcbImage)
-        ::xcb_image_destroy(fXcbImage);
+    for (::xcb_image_t *image : fXcbImages)
+        ::xcb_image_destroy(image);
+    if (!fShmSegments.empty())
+        destroyShmBuffers();
+    for (uint8_t *buffer : fBuffers)
+        delete[] buffer;
     if (fXcbPixmap)
         ::xcb_free_pixmap(fConnection, fXcbPixmap);
     if (fXcbGContext)
@@ -270,7 +276,34 @@ std::shared_ptr<GrBaseCompositor> GrXcbPlatform::createOpenCLCompositor()
 void GrXcbPlatform::createXcbResources()
 {
     fBufferSize = fWidth * fHeight * sizeof(uint32_t);
-    fBufferAddr = new uint8_t[fBufferSize];
+
+    fXcbGContext = ::xcb_generate_id(fConnection);
+    ::xcb_create_gc(fConnection,
+                    fXcbGContext,
+                    fWindow,
+                    0, nullptr);
+
+    if (options().xcb_use_shm && queryShmExtension())
+    {
+        for (int32_t i = 0; i < kBufferCount; i++)
+        {
+            uint8_t *buffer = createShmBuffer();
+            if (buffer == nullptr)
+            {
+                log_write(LOG_WARNING) << "Failed to attach MIT-SHM segment, "
+                                       << "sending frames through XCB connection" << log_endl;
+                destroyShmBuffers();
+                break;
+            }
+            fBuffers.push_back(buffer);
+        }
+    }
+
+    if (!fShmSegments.empty())
+    {
+        log_write(LOG_DEBUG) << "XCB platform sends frames through MIT-SHM" << log_endl;
+        return;
+    }
 
     fXcbPixmap = ::xcb_generate_id(fConnection);
     ::xcb_create_pixmap(fConnection,
@@ -280,49 +313,146 @@ void GrXcbPlatform::createXcbResources()
                         fWidth,
                         fHeight);
 
-    fXcbImage = ::xcb_image_create_native(fConnection,
-                                          fWidth,
-                                          fHeight,
-                                          XCB_IMAGE_FORMAT_Z_PIXMAP,
-                                          fScreen->root_depth,
-                                          fBufferAddr,
-                                          fBufferSize,
-                                          fBufferAddr);
-    RUNTIME_EXCEPTION_ASSERT(fXcbImage != nullptr);
+    /* Images don't own the buffers (base is nullptr), we free them ourselves */
+    for (int32_t i = 0; i < kBufferCount; i++)
+    {
+        auto *buffer = new uint8_t[fBufferSize];
+        fBuffers.push_back(buffer);
+
+        ::xcb_image_t *image = ::xcb_image_create_native(fConnection,
+                                                         fWidth,
+                                                         fHeight,
+                                                         XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                                         fScreen->root_depth,
+                                                         nullptr,
+                                                         fBufferSize,
+                                                         buffer);
+        RUNTIME_EXCEPTION_ASSERT(image != nullptr);
+        fXcbImages.push_back(image);
+    }
+}
 
-    fXcbGContext = ::xcb_generate_id(fConnection);
-    ::xcb_create_gc(fConnection,
-                    fXcbGContext,
-                    fWindow,
-                    0, nullptr);
+bool GrXcbPlatform::queryShmExtension()
+{
+    const ::xcb_query_extension_reply_t *extension = ::xcb_get_extension_data(fConnection, &xcb_shm_id);
+    if (extension == nullptr || !extension->present)
+    {
+        log_write(LOG_DEBUG) << "MIT-SHM extension is not supported by X server" << log_endl;
+        return false;
+    }
+
+    ::xcb_shm_query_version_reply_t *version =
+            ::xcb_shm_query_version_reply(fConnection, ::xcb_shm_query_version(fConnection), nullptr);
+    if (version == nullptr)
+        return false;
+    std::free(version);
+    return true;
 }
 
-uint8_t *GrXcbPlatform::onWritableBuffer()
+uint8_t *GrXcbPlatform::createShmBuffer()
 {
-    return fBufferAddr;
+    int shmid = ::shmget(IPC_PRIVATE, fBufferSize, IPC_CREAT | 0600);
+    if (shmid < 0)
+        return nullptr;
+
+    void *addr = ::shmat(shmid, nullptr, 0);
+    if (addr == reinterpret_cast<void*>(-1))
+    {
+        ::shmctl(shmid, IPC_RMID, nullptr);
+        return nullptr;
+    }
+
+    /* Attaching fails if X server is on another machine */
+    ::xcb_shm_seg_t segment = ::xcb_generate_id(fConnection);
+    ::xcb_generic_error_t *error = ::xcb_request_check(fConnection,
+            ::xcb_shm_attach_checked(fConnection, segment, shmid, 0));
+
+    /* Segment will be destroyed after both of us and X server detached it */
+    ::shmctl(shmid, IPC_RMID, nullptr);
+    if (error != nullptr)
+    {
+        std::free(error);
+        ::shmdt(addr);
+        return nullptr;
+    }
+
+    fShmSegments.push_back(segment);
+    return static_cast<uint8_t*>(addr);
+}
+
+void GrXcbPlatform::destroyShmBuffers()
+{
+    for (::xcb_shm_seg_t segment : fShmSegments)
+        ::xcb_shm_detach(fConnection, segment);
+    ::xcb_flush(fConnection);
+
+    for (uint8_t *buffer : fBuffers)
+        ::shmdt(buffer);
+    fShmSegments.clear();
+    fBuffers.clear();
 }
 
-void GrXcbPlatform::onExpose()
+uint8_t *GrXcbPlatform::onBuffer(int32_t index)
 {
-    if (this->compositor()->getDeviceType() != CompositeDevice::kGpuVulkan)
+    return fBuffers[index];
+}
+
+void GrXcbPlatform::onExpose(const SkRegion& damage)
+{
+    if (this->compositor()->getDeviceType() == CompositeDevice::kGpuVulkan || damage.isEmpty())
+        return;
+
+    /* Front buffer is owned by us until next expose(), no lock is needed */
+    if (!fShmSegments.empty())
     {
-        acquireBuffer();
-        ::xcb_image_put(fConnection,
-                        fXcbPixmap,
-                        fXcbGContext,
-                        fXcbImage,
-                        0, 0, 0);
-        ::xcb_copy_area(fConnection,
-                        fXcbPixmap,
-                        fWindow,
-                        fXcbGContext,
-                        0, 0,
-                        0, 0,
-                        fWidth,
-                        fHeight);
-        ::xcb_flush(fConnection);
-        releaseBuffer();
+        exposeShm(damage);
+        return;
     }
+
+    ::xcb_image_put(fConnection,
+                    fXcbPixmap,
+                    fXcbGContext,
+                    fXcbImages[frontBuffer()],
+                    0, 0, 0);
+    ::xcb_copy_area(fConnection,
+                    fXcbPixmap,
+                    fWindow,
+                    fXcbGContext,
+                    0, 0,
+                    0, 0,
+                    fWidth,
+                    fHeight);
+    ::xcb_flush(fConnection);
+}
+
+void GrXcbPlatform::exposeShm(const SkRegion& damage)
+{
+    SkIRect bounds = SkIRect::MakeWH(fWidth, fHeight);
+    for (SkRegion::Iterator itr(damage); !itr.done(); itr.next())
+    {
+        SkIRect rect;
+        if (!rect.intersect(itr.rect(), bounds))
+            continue;
+
+        /* X server reads pixels from the shared memory directly */
+        ::xcb_shm_put_image(fConnection,
+                            fWindow,
+                            fXcbGContext,
+                            fWidth, fHeight,
+                            rect.x(), rect.y(),
+                            rect.width(), rect.height(),
+                            rect.x(), rect.y(),
+                            fScreen->root_depth,
+                            XCB_IMAGE_FORMAT_Z_PIXMAP,
+                            0,
+                            fShmSegments[frontBuffer()],
+                            0);
+    }
+
+    /* ShmPutImage is asynchronous, the buffer can't be handed off to the
+       compositor until X server has read it. A round trip guarantees that
+       all the requests above have been processed. */
+    std::free(::xcb_get_input_focus_reply(fConnection, ::xcb_get_input_focus(fConnection), nullptr));
 }
 
 CIALLO_END_NS
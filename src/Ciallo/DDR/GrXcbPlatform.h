@@ -3,10 +3,12 @@
 
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include <xcb/xcb.h>
 #include <xcb/xcb_renderutil.h>
 #include <xcb/xcb_image.h>
+#include <xcb/shm.h>
 
 #include "Ciallo/GrBase.h"
 #include "Ciallo/DDR/GrBaseCompositor.h"
@@ -38,13 +40,17 @@ private:
     void setPictureFormatInfo();
 
     std::shared_ptr<GrBaseCompositor> onCreateCompositor() override;
-    uint8_t *onWritableBuffer() override;
-    void onExpose() override;
+    uint8_t *onBuffer(int32_t index) override;
+    void onExpose(const SkRegion& damage) override;
 
     std::shared_ptr<GrBaseCompositor> createGpuCompositor();
     std::shared_ptr<GrBaseCompositor> createCpuCompositor();
     std::shared_ptr<GrBaseCompositor> createOpenCLCompositor();
     void createXcbResources();
+    bool queryShmExtension();
+    uint8_t *createShmBuffer();
+    void destroyShmBuffers();
+    void exposeShm(const SkRegion& damage);
 
 private:
     ::xcb_connection_t          *fConnection;
@@ -55,11 +61,13 @@ private:
                                 *fWindowAttributes;
     ::xcb_screen_t              *fScreen;
 
-    ::xcb_image_t               *fXcbImage;
+    std::vector<::xcb_image_t*>  fXcbImages;
     ::xcb_pixmap_t               fXcbPixmap;
     ::xcb_gcontext_t             fXcbGContext;
-    uint8_t                     *fBufferAddr;
+    std::vector<uint8_t*>        fBuffers;
     size_t                       fBufferSize;
+    /* Not empty if frame buffers are MIT-SHM segments */
+    std::vector<::xcb_shm_seg_t> fShmSegments;
 
     GrColorFormat                fColorFormat;
 };
@@ -0,0 +1,108 @@
+/**
+ * Measures per-layer composition cost (ns/pixel) of GrCpuBlitter
+ * against the SkCanvas::drawImageRect path used by GrBaseCompositor.
+ *
+ * Usage: blit_bench [layer width] [layer height] [iterations]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <functional>
+
+#include "include/core/SkSurface.h"
+#include "include/core/SkCanvas.h"
+#include "include/core/SkImage.h"
+#include "include/core/SkPaint.h"
+#include "include/core/SkPixmap.h"
+
+#include "Ciallo/DDR/GrCpuBlitter.h"
+
+using namespace cocoa::ciallo;
+
+sk_sp<SkImage> make_layer_image(int32_t width, int32_t height, bool opaque)
+{
+    SkImageInfo info = SkImageInfo::MakeN32Premul(width, height);
+    sk_sp<SkSurface> surface = SkSurface::MakeRaster(info);
+
+    SkPixmap pixmap;
+    surface->peekPixels(&pixmap);
+    std::mt19937 rng(20210213);
+    for (int32_t y = 0; y < height; y++)
+    {
+        auto *row = pixmap.writable_addr32(0, y);
+        for (int32_t x = 0; x < width; x++)
+        {
+            uint32_t a = opaque ? 0xff : rng() & 0xff;
+            uint32_t r = rng() % (a + 1), g = rng() % (a + 1), b = rng() % (a + 1);
+            row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+    return surface->makeImageSnapshot();
+}
+
+double measure(int32_t iterations, const std::function<void()>& func)
+{
+    func();
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < iterations; i++)
+        func();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+int main(int argc, char const **argv)
+{
+    int32_t width = argc > 1 ? std::atoi(argv[1]) : 800;
+    int32_t height = argc > 2 ? std::atoi(argv[2]) : 600;
+    int32_t iterations = argc > 3 ? std::atoi(argv[3]) : 200;
+    double pixels = static_cast<double>(width) * height;
+
+    SkImageInfo info = SkImageInfo::MakeN32Premul(width, height);
+    sk_sp<SkSurface> target = SkSurface::MakeRaster(info);
+    target->getCanvas()->clear(0xff336699);
+    SkPixmap dst;
+    target->peekPixels(&dst);
+
+    std::cout << "Layer " << width << "x" << height << ", "
+              << iterations << " iterations, best ISA: "
+              << GrCpuBlitter::ISAName(GrCpuBlitter::DetectISA()) << std::endl;
+
+    for (bool opaque : { false, true })
+    {
+        sk_sp<SkImage> image = make_layer_image(width, height, opaque);
+        SkPixmap src;
+        image->peekPixels(&src);
+        SkRect rect = SkRect::MakeWH(width, height);
+
+        double skia = measure(iterations, [&]() {
+            SkPaint paint;
+            paint.setBlendMode(SkBlendMode::kSrcOver);
+            target->getCanvas()->drawImageRect(image, rect, rect, &paint,
+                                               SkCanvas::kStrict_SrcRectConstraint);
+        });
+        std::cout << (opaque ? "[opaque]      " : "[translucent] ")
+                  << std::setw(8) << "Skia" << ": "
+                  << std::fixed << std::setprecision(3) << skia / pixels << " ns/pixel" << std::endl;
+
+        for (auto isa : { GrCpuBlitter::ISA::kScalar, GrCpuBlitter::ISA::kSSE41, GrCpuBlitter::ISA::kAVX2 })
+        {
+            if (isa > GrCpuBlitter::DetectISA())
+                continue;
+            GrCpuBlitter blitter(isa);
+            auto mode = opaque ? GrCpuBlitter::Mode::kSrcCopy : GrCpuBlitter::Mode::kSrcOver;
+            double ns = measure(iterations, [&]() {
+                blitter.blit(mode,
+                             static_cast<uint8_t*>(dst.writable_addr()), dst.rowBytes(),
+                             static_cast<const uint8_t*>(src.addr()), src.rowBytes(),
+                             width, height);
+            });
+            std::cout << (opaque ? "[opaque]      " : "[translucent] ")
+                      << std::setw(8) << GrCpuBlitter::ISAName(isa) << ": "
+                      << std::fixed << std::setprecision(3) << ns / pixels << " ns/pixel ("
+                      << std::setprecision(2) << skia / ns << "x)" << std::endl;
+        }
+    }
+    return 0;
+}
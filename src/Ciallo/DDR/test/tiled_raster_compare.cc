@@ -0,0 +1,155 @@
+/**
+ * Checks that tiled raster mode of GrCpuRenderLayer produces exactly
+ * the same pixels as the non-tiled mode. The same drawings are made on
+ * two headless platforms and the exposed frames are compared byte by byte.
+ *   $ ./tiled_raster_compare
+ */
+#include <unistd.h>
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "include/core/SkCanvas.h"
+#include "include/core/SkPaint.h"
+#include "include/core/SkPath.h"
+#include "include/core/SkPicture.h"
+#include "include/core/SkPictureRecorder.h"
+#include "include/effects/SkGradientShader.h"
+
+#include "Core/Journal.h"
+#include "Ciallo/DDR/GrBasePlatform.h"
+#include "Ciallo/DDR/GrBaseCompositor.h"
+#include "Ciallo/DDR/GrBaseRenderLayer.h"
+#include "Ciallo/DDR/GrHeadlessPlatform.h"
+
+using namespace cocoa;
+using namespace cocoa::ciallo;
+
+namespace {
+
+constexpr int32_t kWidth = 800;
+constexpr int32_t kHeight = 600;
+/* Not a divisor of layer size, so that there are partial tiles */
+constexpr int32_t kTileSize = 96;
+constexpr int32_t kFrames = 16;
+
+sk_sp<SkPicture> make_picture(int32_t w, int32_t h, int32_t seed)
+{
+    SkPictureRecorder recorder;
+    SkCanvas *canvas = recorder.beginRecording(SkRect::MakeWH(w, h));
+
+    /* Dithered gradient depends on device coordinate */
+    SkPoint points[2] = { SkPoint::Make(0, 0), SkPoint::Make(w, h) };
+    SkColor colors[2] = { SkColorSetARGB(0xc0, seed * 40 & 0xff, 0x30, 0x80), SK_ColorTRANSPARENT };
+    SkPaint gradient;
+    gradient.setShader(SkGradientShader::MakeLinear(points, colors, nullptr, 2, SkTileMode::kClamp));
+    gradient.setDither(true);
+    canvas->drawRect(SkRect::MakeWH(w, h), gradient);
+
+    SkPaint paint;
+    paint.setAntiAlias(true);
+    paint.setColor(SkColorSetARGB(0x80, 0xff, seed * 25 & 0xff, 0x20));
+    canvas->drawCircle(w / 2.0f + seed, h / 2.0f, std::min(w, h) / 3.0f, paint);
+
+    SkPath path;
+    path.moveTo(3.3f, 5.7f);
+    path.cubicTo(w * 0.7f, 0, w * 0.2f, h * 1.1f, w - 2.5f, h - 4.1f);
+    paint.setStyle(SkPaint::kStroke_Style);
+    paint.setStrokeWidth(7.5f);
+    paint.setColor(SkColorSetARGB(0xe0, 0x20, 0xc0, seed * 60 & 0xff));
+    canvas->drawPath(path, paint);
+
+    return recorder.finishRecordingAsPicture();
+}
+
+struct Scene
+{
+    std::unique_ptr<GrBasePlatform>         platform;
+    std::shared_ptr<GrBaseCompositor>       compositor;
+    std::shared_ptr<GrBaseRenderLayer>      layer;
+};
+
+Scene make_scene(bool tiled)
+{
+    GrPlatformOptions options;
+    options.use_gpu_accel = false;
+    options.use_opencl_accel = false;
+    options.cpu_tiled_raster = tiled;
+    options.cpu_raster_tile_size = kTileSize;
+
+    Scene scene;
+    scene.platform = GrHeadlessPlatform::MakeHeadless(kWidth, kHeight,
+                                                      GrColorFormat::kColor_BGRA_8888,
+                                                      options);
+    scene.compositor = scene.platform->compositor();
+    scene.layer = scene.compositor->newRenderLayer(kWidth - 30, kHeight - 50, 10, 20, 0);
+    scene.layer->setVisibility(true);
+    return scene;
+}
+
+void draw_frame(Scene& scene, int32_t frame, const std::vector<sk_sp<SkPicture>>& pictures)
+{
+    GrBaseRenderLayer *layer = scene.layer.get();
+    if (frame == 0)
+        layer->paint(pictures[0], 0, 0);
+
+    int32_t x = (frame * 53) % (kWidth - 200);
+    int32_t y = (frame * 37) % (kHeight - 200);
+    layer->paint(pictures[frame % pictures.size()], x, y);
+
+    /* Partial repaint as RenderNode does */
+    SkIRect clip = SkIRect::MakeXYWH(y, x / 2, 150, 90);
+    layer->clear(clip);
+    layer->paint(pictures[(frame + 1) % pictures.size()], x / 2, y / 3, nullptr, &clip);
+
+    layer->update();
+    scene.compositor->present();
+    scene.platform->expose();
+}
+
+bool compare(Scene& a, Scene& b, int32_t frame)
+{
+    const uint8_t *pa = a.platform->buffer(a.platform->frontBuffer());
+    const uint8_t *pb = b.platform->buffer(b.platform->frontBuffer());
+    for (int32_t y = 0; y < kHeight; y++)
+    {
+        size_t offset = static_cast<size_t>(y) * kWidth * 4;
+        if (std::memcmp(pa + offset, pb + offset, kWidth * 4) != 0)
+        {
+            std::cerr << "Frame " << frame << ": mismatched pixels at row " << y << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace anonymous
+
+int main(int argc, char const *argv[])
+{
+    Journal::New(STDOUT_FILENO, LOG_LEVEL_DEBUG, true);
+
+    std::vector<sk_sp<SkPicture>> pictures;
+    pictures.push_back(make_picture(kWidth - 30, kHeight - 50, 0));
+    for (int32_t i = 1; i < 5; i++)
+        pictures.push_back(make_picture(120 + i * 41, 90 + i * 29, i));
+
+    bool ok = true;
+    {
+        Scene plain = make_scene(false);
+        Scene tiled = make_scene(true);
+        for (int32_t frame = 0; frame < kFrames && ok; frame++)
+        {
+            draw_frame(plain, frame, pictures);
+            draw_frame(tiled, frame, pictures);
+            ok = compare(plain, tiled, frame);
+        }
+    }
+
+    std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+    Journal::Delete();
+    return ok ? 0 : 1;
+}
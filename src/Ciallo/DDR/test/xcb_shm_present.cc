@@ -0,0 +1,145 @@
+/**
+ * Checks the pixels presented by GrXcbPlatform. It needs an X server,
+ * run it under Xvfb in headless environments:
+ *   $ xvfb-run -s "-screen 0 1920x1080x24" ./xcb_shm_present [--no-shm]
+ */
+#include <unistd.h>
+
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+#include <xcb/xcb.h>
+
+#include "Core/Journal.h"
+#include "Ciallo/DDR/GrBasePlatform.h"
+#include "Ciallo/DDR/GrXcbPlatform.h"
+
+using namespace cocoa;
+using namespace cocoa::ciallo;
+
+namespace {
+
+constexpr int32_t kWidth = 1920;
+constexpr int32_t kHeight = 1080;
+constexpr int32_t kFrames = 100;
+
+uint32_t pattern(int32_t x, int32_t y, int32_t frame)
+{
+    return 0xff000000 | ((x + frame) & 0xff) << 16 | ((y + frame) & 0xff) << 8 | (frame & 0xff);
+}
+
+void draw(GrBasePlatform *platform, const SkIRect& rect, int32_t frame)
+{
+    GrBasePlatform::ScopedAcquireBuffer scopedAcquireBuffer(platform);
+    auto *pixels = reinterpret_cast<uint32_t*>(scopedAcquireBuffer.buffer());
+
+    /* The buffer may hold an older frame, which has nothing of the first frame */
+    SkRegion region(rect);
+    if (frame > 0)
+        region.op(scopedAcquireBuffer.outdated(), SkRegion::kUnion_Op);
+    for (SkRegion::Iterator itr(region); !itr.done(); itr.next())
+    {
+        for (int32_t y = itr.rect().top(); y < itr.rect().bottom(); y++)
+        {
+            for (int32_t x = itr.rect().left(); x < itr.rect().right(); x++)
+            {
+                bool damaged = rect.contains(x, y);
+                pixels[y * kWidth + x] = pattern(x, y, damaged ? frame : 0);
+            }
+        }
+    }
+    scopedAcquireBuffer.damage(rect);
+}
+
+bool verify(xcb_connection_t *connection, xcb_window_t window,
+            const SkIRect& rect, int32_t frame)
+{
+    xcb_get_image_reply_t *reply = xcb_get_image_reply(connection,
+            xcb_get_image(connection, XCB_IMAGE_FORMAT_Z_PIXMAP, window,
+                          rect.x(), rect.y(), rect.width(), rect.height(), ~0u),
+            nullptr);
+    if (reply == nullptr)
+        return false;
+
+    auto *pixels = reinterpret_cast<const uint32_t*>(xcb_get_image_data(reply));
+    bool ok = true;
+    for (int32_t y = 0; y < rect.height() && ok; y++)
+    {
+        for (int32_t x = 0; x < rect.width(); x++)
+        {
+            /* Depth 24 visuals don't keep alpha */
+            uint32_t expected = pattern(rect.x() + x, rect.y() + y, frame) & 0xffffff;
+            if ((pixels[y * rect.width() + x] & 0xffffff) != expected)
+            {
+                std::cerr << "Mismatched pixel at (" << rect.x() + x << ", "
+                          << rect.y() + y << ")" << std::endl;
+                ok = false;
+                break;
+            }
+        }
+    }
+    std::free(reply);
+    return ok;
+}
+
+} // namespace anonymous
+
+int main(int argc, char const *argv[])
+{
+    Journal::New(STDOUT_FILENO, LOG_LEVEL_DEBUG, true);
+
+    int screenp;
+    xcb_connection_t *connection = xcb_connect(nullptr, &screenp);
+    if (xcb_connection_has_error(connection))
+    {
+        std::cerr << "Failed to connect to X server" << std::endl;
+        return 1;
+    }
+
+    xcb_screen_iterator_t itr = xcb_setup_roots_iterator(xcb_get_setup(connection));
+    for (int i = screenp; i > 0; i--)
+        xcb_screen_next(&itr);
+    xcb_screen_t *screen = itr.data;
+
+    xcb_window_t window = xcb_generate_id(connection);
+    xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, screen->root,
+                      0, 0, kWidth, kHeight, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                      0, nullptr);
+    xcb_map_window(connection, window);
+    xcb_flush(connection);
+
+    GrPlatformOptions options;
+    options.use_gpu_accel = false;
+    options.xcb_use_shm = !(argc > 1 && !std::strcmp(argv[1], "--no-shm"));
+    auto platform = GrXcbPlatform::MakeFromXcbWindow(connection, window, screenp, options);
+
+    SkIRect frameRect = SkIRect::MakeWH(kWidth, kHeight);
+    SkIRect damageRect = SkIRect::MakeXYWH(kWidth / 4, kHeight / 4, kWidth / 8, kHeight / 8);
+    draw(platform.get(), frameRect, 0);
+    platform->expose();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t frame = 1; frame <= kFrames; frame++)
+    {
+        draw(platform.get(), damageRect, frame);
+        platform->expose();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double us = std::chrono::duration<double, std::micro>(end - start).count() / kFrames;
+    std::cout << "Presented " << damageRect.width() << "x" << damageRect.height()
+              << " damage in " << us << " us per frame, "
+              << platform->skippedFrames() << " frames skipped" << std::endl;
+
+    /* Full frame has been sent once, so the area out of damage keeps frame 0 */
+    bool ok = verify(connection, window, damageRect, kFrames)
+              && verify(connection, window, SkIRect::MakeXYWH(0, 0, 64, 64), 0);
+    std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+
+    platform.reset();
+    xcb_destroy_window(connection, window);
+    xcb_disconnect(connection);
+    return ok ? 0 : 1;
+}
@@ -1,11 +1,13 @@
-#include <list>
+#include <vector>
+#include <algorithm>
 
 #include "Core/Exception.h"
 #include "Ciallo/GrBase.h"
 #include "Ciallo/DIR/BaseNode.h"
+#include "Ciallo/DIR/NodeArena.h"
 CIALLO_BEGIN_NS
 
-BaseNode::ChildrenIterable::ChildrenIterable(std::list<BaseNode *>& node)
+BaseNode::ChildrenIterable::ChildrenIterable(std::vector<BaseNode *>& node)
     : fBegin(node.begin()),
       fEnd(node.end())
 {
@@ -17,12 +19,12 @@ BaseNode::ChildrenIterable::ChildrenIterable(const ChildrenIterable& that)
 {
 }
 
-std::list<BaseNode *>::iterator BaseNode::ChildrenIterable::begin()
+std::vector<BaseNode *>::iterator BaseNode::ChildrenIterable::begin()
 {
     return fBegin;
 }
 
-std::list<BaseNode *>::iterator BaseNode::ChildrenIterable::end()
+std::vector<BaseNode *>::iterator BaseNode::ChildrenIterable::end()
 {
     return fEnd;
 }
@@ -32,7 +34,9 @@ std::list<BaseNode *>::iterator BaseNode::ChildrenIterable::end()
 BaseNode::BaseNode(NodeKind kind, BaseNode *parent)
     : fKind(kind),
       fBackendKind(NodeBackendKind::kUndefined),
-      fParent(parent)
+      fParent(parent),
+      fArena(nullptr),
+      fArenaIndex(0)
 {
     if (parent != nullptr)
         parent->appendChild(this);
@@ -42,16 +46,47 @@ BaseNode::~BaseNode()
 {
     if (fParent)
     {
-        fParent = nullptr;
         fParent->removeChild(this);
+        fParent = nullptr;
     }
     for (BaseNode *pChild : fChildrenList)
     {
         pChild->parentDispose();
-        delete pChild;
+        Delete(pChild);
     }
 }
 
+void BaseNode::Delete(BaseNode *node)
+{
+    if (node == nullptr)
+        return;
+    if (node->fArena != nullptr)
+        node->fArena->destroy(node);
+    else
+        delete node;
+}
+
+NodeArena *BaseNode::childrenArena()
+{
+    return fArena;
+}
+
+void BaseNode::arenaUnlink()
+{
+    /* A parent out of the arena keeps living, it must forget this node */
+    if (fParent != nullptr && fParent->fArena != fArena)
+        fParent->removeChild(this);
+    fParent = nullptr;
+
+    /* Children in the same arena are destructed by the arena itself */
+    std::erase_if(fChildrenList, [this](BaseNode *child) {
+        if (child->fArena != fArena)
+            return false;
+        child->fParent = nullptr;
+        return true;
+    });
+}
+
 void BaseNode::appendChild(const BaseNode *child)
 {
     fChildrenList.push_back(const_cast<BaseNode*>(child));
@@ -59,7 +94,12 @@ void BaseNode::appendChild(const BaseNode *child)
 
 void BaseNode::removeChild(const BaseNode *child)
 {
-    fChildrenList.remove(const_cast<BaseNode*>(child));
+    if (std::erase(fChildrenList, const_cast<BaseNode*>(child)) > 0)
+        onChildRemoved(const_cast<BaseNode*>(child));
+}
+
+void BaseNode::onChildRemoved(BaseNode *child)
+{
 }
 
 void BaseNode::parentDispose()
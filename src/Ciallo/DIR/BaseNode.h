@@ -1,19 +1,22 @@
 #ifndef COCOA_BASENODE_H
 #define COCOA_BASENODE_H
 
-#include <list>
+#include <vector>
 
 #include "Core/Exception.h"
 #include "Ciallo/GrBase.h"
 CIALLO_BEGIN_NS
 
 class BaseNode;
+class NodeArena;
 template<typename T>
 concept InheritGrBaseNode = std::is_base_of<BaseNode, T>::value;
 
 #define CIALLO_STATIC_NODE_KIND(kind)   const static NodeKind NODE_KIND = kind;
 class BaseNode
 {
+    friend class NodeArena;
+
 public:
     enum class NodeKind
     {
@@ -33,14 +36,14 @@ public:
     class ChildrenIterable
     {
     public:
-        explicit ChildrenIterable(std::list<BaseNode*>& node);
+        explicit ChildrenIterable(std::vector<BaseNode*>& node);
         ChildrenIterable(const ChildrenIterable& that);
-        std::list<BaseNode*>::iterator begin();
-        std::list<BaseNode*>::iterator end();
+        std::vector<BaseNode*>::iterator begin();
+        std::vector<BaseNode*>::iterator end();
 
     private:
-        std::list<BaseNode*>::iterator    fBegin;
-        std::list<BaseNode*>::iterator    fEnd;
+        std::vector<BaseNode*>::iterator    fBegin;
+        std::vector<BaseNode*>::iterator    fEnd;
     };
 
     virtual ~BaseNode();
@@ -72,18 +75,38 @@ public:
 
     virtual NodeBackendKind backendKind() const;
 
+    /* Arena which this node is allocated from, nullptr if it is in heap */
+    inline NodeArena *arena() const
+    { return fArena; }
+
+    /* Arena to allocate children from, nullptr means heap */
+    virtual NodeArena *childrenArena();
+
+    /* Destroys a node allocated from heap or arena, with its children */
+    static void Delete(BaseNode *node);
+
 protected:
     explicit BaseNode(NodeKind kind, BaseNode *parent = nullptr);
     void parentDispose();
 
+    /**
+     * Called by removeChild(). @a child may be under destruction, then
+     * only its BaseNode part is valid, so nodes which should be seen by
+     * their parent detach themselves in their own destructor.
+     */
+    virtual void onChildRemoved(BaseNode *child);
+
 private:
     void badNodeCast();
+    void arenaUnlink();
 
 private:
     NodeKind                 fKind;
     NodeBackendKind          fBackendKind;
     BaseNode              *fParent;
-    std::list<BaseNode*>   fChildrenList;
+    std::vector<BaseNode*> fChildrenList;
+    NodeArena             *fArena;
+    size_t                 fArenaIndex;
 };
 
 CIALLO_END_NS
@@ -1,4 +1,5 @@
 #include <memory>
+#include <utility>
 
 #include "Ciallo/GrBase.h"
 #include "Ciallo/DIR/CompositeNode.h"
@@ -6,7 +7,8 @@ CIALLO_BEGIN_NS
 
 CompositeNode::CompositeNode(std::shared_ptr<GrBaseCompositor>&& compositor)
     : BaseNode(NodeKind::kCompositeNode, nullptr),
-      fCompositor(compositor)
+      fCompositor(compositor),
+      fNodeArena(nullptr)
 {
 }
 
@@ -15,6 +17,16 @@ std::shared_ptr<GrBaseCompositor> CompositeNode::asCompositor()
     return fCompositor;
 }
 
+void CompositeNode::setRasterCache(std::unique_ptr<RasterCache> cache)
+{
+    fRasterCache = std::move(cache);
+}
+
+NodeArena *CompositeNode::childrenArena()
+{
+    return fNodeArena;
+}
+
 CompositeNode::NodeBackendKind CompositeNode::backendKind() const
 {
     switch (fCompositor->getDeviceType())
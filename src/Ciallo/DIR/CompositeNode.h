@@ -6,6 +6,7 @@
 #include "Ciallo/GrBase.h"
 #include "Ciallo/DDR/GrBaseCompositor.h"
 #include "Ciallo/DIR/BaseNode.h"
+#include "Ciallo/DIR/RasterCache.h"
 CIALLO_BEGIN_NS
 
 class CompositeNode : public BaseNode
@@ -18,10 +19,22 @@ public:
 
     std::shared_ptr<GrBaseCompositor> asCompositor();
 
+    /* Shared by all the render nodes, nullptr if it is disabled */
+    inline RasterCache *rasterCache()
+    { return fRasterCache.get(); }
+    void setRasterCache(std::unique_ptr<RasterCache> cache);
+
+    /* Render nodes (and their descendants) are allocated from @a arena */
+    inline void setNodeArena(NodeArena *arena)
+    { fNodeArena = arena; }
+    NodeArena *childrenArena() override;
+
     NodeBackendKind backendKind() const override;
 
 private:
     std::shared_ptr<GrBaseCompositor>       fCompositor;
+    std::unique_ptr<RasterCache>            fRasterCache;
+    NodeArena                              *fNodeArena;
 };
 
 CIALLO_END_NS
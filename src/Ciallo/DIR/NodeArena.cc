@@ -0,0 +1,135 @@
+#include <algorithm>
+
+#include "Core/Exception.h"
+#include "Ciallo/GrBase.h"
+#include "Ciallo/DIR/BaseNode.h"
+#include "Ciallo/DIR/NodeArena.h"
+CIALLO_BEGIN_NS
+
+NodeArena::NodeArena(size_t blockSize)
+    : fBlockSize(blockSize),
+      fOffset(0)
+{
+    RUNTIME_EXCEPTION_ASSERT(blockSize > 0);
+}
+
+NodeArena::~NodeArena()
+{
+    reset();
+}
+
+void *NodeArena::allocate(size_t size, size_t align)
+{
+    std::scoped_lock<std::mutex> scopedLock(fMutex);
+    for (FreeList& freeList : fFreeLists)
+    {
+        if (freeList.fSize != size || freeList.fAlign != align || freeList.fMemory.empty())
+            continue;
+        void *memory = freeList.fMemory.back();
+        freeList.fMemory.pop_back();
+        return memory;
+    }
+
+    if (!fBlocks.empty())
+    {
+        Block& block = fBlocks.back();
+        auto base = reinterpret_cast<uintptr_t>(block.fMemory.get());
+        size_t offset = ((base + fOffset + align - 1) & ~(align - 1)) - base;
+        if (offset + size <= block.fSize)
+        {
+            fOffset = offset + size;
+            return block.fMemory.get() + offset;
+        }
+    }
+
+    /* Memory from operator new[] is aligned for any fundamental type */
+    RUNTIME_EXCEPTION_ASSERT(align <= alignof(std::max_align_t));
+    size_t blockSize = std::max(size, fBlockSize);
+    fBlocks.push_back(Block{ std::make_unique<uint8_t[]>(blockSize), blockSize });
+    fOffset = size;
+    return fBlocks.back().fMemory.get();
+}
+
+void NodeArena::adoptNode(BaseNode *node, void *memory, size_t size, size_t align)
+{
+    std::scoped_lock<std::mutex> scopedLock(fMutex);
+    node->fArena = this;
+    if (fFreeEntries.empty())
+    {
+        node->fArenaIndex = fNodes.size();
+        fNodes.push_back(NodeEntry{ node, memory, size, align });
+    }
+    else
+    {
+        node->fArenaIndex = fFreeEntries.back();
+        fFreeEntries.pop_back();
+        fNodes[node->fArenaIndex] = NodeEntry{ node, memory, size, align };
+    }
+}
+
+void NodeArena::destroy(BaseNode *node)
+{
+    NodeEntry entry;
+    {
+        std::scoped_lock<std::mutex> scopedLock(fMutex);
+        RUNTIME_EXCEPTION_ASSERT(node->fArena == this && fNodes[node->fArenaIndex].fNode == node);
+        entry = fNodes[node->fArenaIndex];
+        fNodes[node->fArenaIndex].fNode = nullptr;
+        fFreeEntries.push_back(node->fArenaIndex);
+    }
+
+    /* Destructor destroys the children, so the lock is not held */
+    node->~BaseNode();
+
+    std::scoped_lock<std::mutex> scopedLock(fMutex);
+    auto itr = std::find_if(fFreeLists.begin(), fFreeLists.end(), [&entry](const FreeList& list) {
+        return list.fSize == entry.fSize && list.fAlign == entry.fAlign;
+    });
+    if (itr == fFreeLists.end())
+        itr = fFreeLists.insert(itr, FreeList{ entry.fSize, entry.fAlign, {} });
+    itr->fMemory.push_back(entry.fMemory);
+}
+
+void NodeArena::reset()
+{
+    /* Destructors run without the lock, the memory is released after them */
+    std::vector<NodeEntry> nodes;
+    std::vector<Block> blocks;
+    {
+        std::scoped_lock<std::mutex> scopedLock(fMutex);
+        nodes.swap(fNodes);
+        blocks.swap(fBlocks);
+        fFreeEntries.clear();
+        fFreeLists.clear();
+        fOffset = 0;
+    }
+
+    /* Unlinks the nodes first, so destructors don't touch each other */
+    for (const NodeEntry& entry : nodes)
+    {
+        if (entry.fNode != nullptr)
+            entry.fNode->arenaUnlink();
+    }
+    for (auto itr = nodes.rbegin(); itr != nodes.rend(); itr++)
+    {
+        if (itr->fNode != nullptr)
+            itr->fNode->~BaseNode();
+    }
+}
+
+size_t NodeArena::nodes()
+{
+    std::scoped_lock<std::mutex> scopedLock(fMutex);
+    return fNodes.size() - fFreeEntries.size();
+}
+
+size_t NodeArena::bytes()
+{
+    std::scoped_lock<std::mutex> scopedLock(fMutex);
+    size_t total = 0;
+    for (const Block& block : fBlocks)
+        total += block.fSize;
+    return total;
+}
+
+CIALLO_END_NS
@@ -0,0 +1,93 @@
+#ifndef COCOA_NODEARENA_H
+#define COCOA_NODEARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Ciallo/GrBase.h"
+CIALLO_BEGIN_NS
+
+class BaseNode;
+
+/**
+ * NodeArena allocates nodes of a rendering tree from large blocks,
+ * so that nodes of a scene lie close to each other in memory.
+ * A node of type T is constructed in the memory from
+ * allocate(sizeof(T), alignof(T)) and registered by adopt().
+ * destroy() destructs a node and keeps its memory in a free list of
+ * the same size and alignment, which is reused by the next allocate(),
+ * so a scene which keeps creating and destroying nodes does not grow.
+ * reset() destructs all the nodes in a flat loop (without the recursive
+ * deletion of children) and releases the blocks at once.
+ *
+ * Nodes may be created and destroyed on different threads.
+ */
+class NodeArena
+{
+public:
+    static constexpr size_t kDefaultBlockSize = 64 * 1024;
+
+    explicit NodeArena(size_t blockSize = kDefaultBlockSize);
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+    ~NodeArena();
+
+    void *allocate(size_t size, size_t align);
+
+    template<typename T>
+    inline T *adopt(T *node)
+    {
+        adoptNode(node, node, sizeof(T), alignof(T));
+        return node;
+    }
+
+    void destroy(BaseNode *node);
+    void reset();
+
+    /* Number of living nodes and bytes of allocated blocks */
+    size_t nodes();
+    size_t bytes();
+
+private:
+    void adoptNode(BaseNode *node, void *memory, size_t size, size_t align);
+
+    struct Block
+    {
+        std::unique_ptr<uint8_t[]>  fMemory;
+        size_t                      fSize;
+    };
+
+    struct NodeEntry
+    {
+        /* nullptr if the node has been destroyed */
+        BaseNode   *fNode;
+        /* Where the most derived object is constructed */
+        void       *fMemory;
+        size_t      fSize;
+        size_t      fAlign;
+    };
+
+    /* Memory of destroyed nodes which have the same size and alignment */
+    struct FreeList
+    {
+        size_t              fSize;
+        size_t              fAlign;
+        std::vector<void*>  fMemory;
+    };
+
+    std::mutex              fMutex;
+    size_t                  fBlockSize;
+    std::vector<Block>      fBlocks;
+    /* Offset of free space in the last block */
+    size_t                  fOffset;
+    std::vector<NodeEntry>  fNodes;
+    /* Indices of fNodes whose node has been destroyed */
+    std::vector<size_t>     fFreeEntries;
+    std::vector<FreeList>   fFreeLists;
+};
+
+CIALLO_END_NS
+#endif //COCOA_NODEARENA_H
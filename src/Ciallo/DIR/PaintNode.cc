@@ -1,3 +1,6 @@
+#include <new>
+#include <utility>
+
 #include "include/core/SkPictureRecorder.h"
 #include "include/core/SkPicture.h"
 #include "include/core/SkCanvas.h"
@@ -5,6 +8,8 @@
 #include "Core/Journal.h"
 #include "Ciallo/GrBase.h"
 #include "Ciallo/DIR/PaintNode.h"
+#include "Ciallo/DIR/NodeArena.h"
+#include "Ciallo/DIR/RasterCache.h"
 CIALLO_BEGIN_NS
 
 PaintNode::ScopedPaint::ScopedPaint(PaintNode *paintNode)
@@ -31,7 +36,12 @@ PaintNode::ScopedPaint::~ScopedPaint()
 PaintNode *PaintNode::MakeFromParent(BaseNode *parent, int32_t width, int32_t height,
                                      int32_t x, int32_t y)
 {
-    return new PaintNode(parent, width, height, x, y);
+    NodeArena *arena = parent != nullptr ? parent->childrenArena() : nullptr;
+    if (arena == nullptr)
+        return new PaintNode(parent, width, height, x, y);
+
+    void *memory = arena->allocate(sizeof(PaintNode), alignof(PaintNode));
+    return arena->adopt(new (memory) PaintNode(parent, width, height, x, y));
 }
 
 PaintNode::PaintNode(BaseNode *parent, int32_t width, int32_t height,
@@ -41,8 +51,22 @@ PaintNode::PaintNode(BaseNode *parent, int32_t width, int32_t height,
       fHeight(height),
       fLeft(x),
       fTop(y),
-      fPicture(nullptr)
+      fUseBBH(true),
+      fPicture(nullptr),
+      fGeneration(0),
+      fDrawnGeneration(0),
+      fLastDrawnRect(SkIRect::MakeEmpty()),
+      fStableUpdates(0),
+      fCheckedGeneration(0),
+      fRasterCacheable(false)
+{
+}
+
+PaintNode::~PaintNode()
 {
+    /* Detaches before the PaintNode part is destructed */
+    if (this->parent() != nullptr)
+        this->setParent(nullptr);
 }
 
 void PaintNode::resize(int32_t width, int32_t height)
@@ -55,7 +79,15 @@ void PaintNode::begin()
 {
     if (fPictureRecorder.getRecordingCanvas() != nullptr)
         return;
-    fPictureRecorder.beginRecording(fWidth, fHeight);
+
+    bool tiny = fPicture != nullptr && fPicture->approximateOpCount() < kMinOpsForBBH;
+    fPictureRecorder.beginRecording(SkRect::MakeIWH(fWidth, fHeight),
+                                    fUseBBH && !tiny ? &fRTreeFactory : nullptr);
+}
+
+void PaintNode::setUseBBH(bool enable)
+{
+    fUseBBH = enable;
 }
 
 SkCanvas *PaintNode::asCanvas()
@@ -66,7 +98,10 @@ SkCanvas *PaintNode::asCanvas()
 void PaintNode::finish()
 {
     if (fPictureRecorder.getRecordingCanvas())
+    {
         fPicture = fPictureRecorder.finishRecordingAsPicture();
+        fGeneration++;
+    }
 }
 
 sk_sp<SkPicture> PaintNode::asPicture()
@@ -74,6 +109,47 @@ sk_sp<SkPicture> PaintNode::asPicture()
     return fPicture;
 }
 
+void PaintNode::setPicture(sk_sp<SkPicture> picture)
+{
+    fPicture = std::move(picture);
+    fGeneration++;
+}
+
+SkIRect PaintNode::bounds() const
+{
+    if (fPicture == nullptr)
+        return SkIRect::MakeEmpty();
+    return fPicture->cullRect().roundOut().makeOffset(fLeft, fTop);
+}
+
+bool PaintNode::changedSinceDrawn() const
+{
+    return fGeneration != fDrawnGeneration || bounds() != fLastDrawnRect;
+}
+
+void PaintNode::markDrawn()
+{
+    /* RasterCache keys images by position, so a moved node is not stable */
+    if (!changedSinceDrawn())
+        fStableUpdates++;
+    else
+        fStableUpdates = 0;
+    fDrawnGeneration = fGeneration;
+    fLastDrawnRect = bounds();
+}
+
+bool PaintNode::rasterCacheable()
+{
+    if (fPicture == nullptr)
+        return false;
+    if (fCheckedGeneration != fGeneration)
+    {
+        fRasterCacheable = RasterCache::IsCacheable(fPicture);
+        fCheckedGeneration = fGeneration;
+    }
+    return fRasterCacheable;
+}
+
 void PaintNode::moveTo(int32_t x, int32_t y)
 {
     fLeft = x;
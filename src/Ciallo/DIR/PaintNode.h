@@ -6,6 +6,7 @@
 #include "include/core/SkCanvas.h"
 #include "include/core/SkPicture.h"
 #include "include/core/SkPictureRecorder.h"
+#include "include/core/SkBBHFactory.h"
 #include "include/core/SkVertices.h"
 #include "include/core/SkShader.h"
 #include "include/effects/SkRuntimeEffect.h"
@@ -59,12 +60,54 @@ public:
     void resize(int32_t width, int32_t height);
     void moveTo(int32_t x, int32_t y);
 
+    /**
+     * Pictures are recorded with an R-tree, so that a clipped playback
+     * skips the drawing operations out of clip. Building the R-tree costs
+     * more than walking a tiny picture, so it is skipped automatically if
+     * the last picture had less than kMinOpsForBBH operations, or always
+     * if @a enable is false. Takes effect on the next begin().
+     */
+    static constexpr int kMinOpsForBBH = 16;
+    void setUseBBH(bool enable);
+
     void begin();
     void finish();
 
     SkCanvas *asCanvas();
     sk_sp<SkPicture> asPicture();
 
+    /* Replaces the picture as if it was recorded by begin() and finish() */
+    void setPicture(sk_sp<SkPicture> picture);
+
+    /* Increased by every finish(), so a changed picture can be detected */
+    inline uint64_t generation() const
+    { return fGeneration; }
+
+    /* Bounds of current picture in the parent's coordinate */
+    SkIRect bounds() const;
+
+    /**
+     * RenderNode remembers where and which generation of the picture
+     * was drawn by markDrawn(), then only the changed nodes are drawn again.
+     */
+    inline const SkIRect& lastDrawnRect() const
+    { return fLastDrawnRect; }
+    bool changedSinceDrawn() const;
+    void markDrawn();
+
+    /* Number of RenderNode updates since the picture was changed or moved */
+    inline int32_t stableUpdates() const
+    { return fStableUpdates; }
+
+    /**
+     * Whether current picture can be blitted from the RasterCache.
+     * Checked by RasterCache::IsCacheable() once per generation.
+     */
+    bool rasterCacheable();
+
+    /* Tells the parent RenderNode to repaint the area drawn by this node */
+    ~PaintNode() override;
+
 protected:
     PaintNode(BaseNode *parent, int32_t width, int32_t height,
               int32_t x, int32_t y);
@@ -75,7 +118,15 @@ private:
     int32_t                 fLeft;
     int32_t                 fTop;
     SkPictureRecorder       fPictureRecorder;
+    SkRTreeFactory          fRTreeFactory;
+    bool                    fUseBBH;
     sk_sp<SkPicture>        fPicture;
+    uint64_t                fGeneration;
+    uint64_t                fDrawnGeneration;
+    SkIRect                 fLastDrawnRect;
+    int32_t                 fStableUpdates;
+    uint64_t                fCheckedGeneration;
+    bool                    fRasterCacheable;
 };
 
 CIALLO_END_NS
@@ -0,0 +1,174 @@
+#include <functional>
+#include <mutex>
+#include <optional>
+
+#include "include/core/SkSurface.h"
+#include "include/core/SkCanvas.h"
+#include "include/core/SkImageInfo.h"
+#include "include/utils/SkNoDrawCanvas.h"
+#include "include/utils/SkPaintFilterCanvas.h"
+
+#include "Core/Exception.h"
+#include "Ciallo/GrBase.h"
+#include "Ciallo/DIR/RasterCache.h"
+CIALLO_BEGIN_NS
+
+size_t RasterCache::KeyHash::operator()(const Key& key) const
+{
+    size_t hash = std::hash<uint32_t>()(key.fPictureID);
+    hash = hash * 31 + std::hash<int32_t>()(key.fX);
+    hash = hash * 31 + std::hash<int32_t>()(key.fY);
+    hash = hash * 31 + std::hash<SkScalar>()(key.fScale);
+    return hash;
+}
+
+namespace {
+
+/* Sees every paint of a picture without drawing anything */
+class SrcOverCheckCanvas : public SkPaintFilterCanvas
+{
+public:
+    explicit SrcOverCheckCanvas(SkCanvas *canvas)
+        : SkPaintFilterCanvas(canvas), fSrcOver(true) {}
+    ~SrcOverCheckCanvas() override = default;
+
+    inline bool srcOver() const
+    { return fSrcOver; }
+
+protected:
+    bool onFilter(SkPaint& paint) const override
+    {
+        check(paint);
+        return false;
+    }
+
+    /* Nested pictures and drawables are played back into this canvas
+       instead of being forwarded to the wrapped canvas */
+    void onDrawPicture(const SkPicture *picture, const SkMatrix *matrix,
+                       const SkPaint *paint) override
+    {
+        if (paint != nullptr)
+            check(*paint);
+        SkCanvas::onDrawPicture(picture, matrix, paint);
+    }
+
+    void onDrawDrawable(SkDrawable *drawable, const SkMatrix *matrix) override
+    {
+        SkCanvas::onDrawDrawable(drawable, matrix);
+    }
+
+    SaveLayerStrategy getSaveLayerStrategy(const SaveLayerRec& rec) override
+    {
+        if (rec.fBackdrop != nullptr)
+            fSrcOver = false;
+        if (rec.fPaint != nullptr)
+            check(*rec.fPaint);
+        return SkPaintFilterCanvas::getSaveLayerStrategy(rec);
+    }
+
+private:
+    void check(const SkPaint& paint) const
+    {
+        std::optional<SkBlendMode> mode = paint.asBlendMode();
+        if (!mode || *mode != SkBlendMode::kSrcOver || paint.isDither())
+            fSrcOver = false;
+    }
+
+    mutable bool    fSrcOver;
+};
+
+} // namespace anonymous
+
+bool RasterCache::IsCacheable(const sk_sp<SkPicture>& picture)
+{
+    SkIRect bounds = picture->cullRect().roundOut();
+    SkNoDrawCanvas noDrawCanvas(bounds.right(), bounds.bottom());
+    SrcOverCheckCanvas canvas(&noDrawCanvas);
+    picture->playback(&canvas);
+    return canvas.srcOver();
+}
+
+RasterCache::RasterCache(int64_t budget, int32_t stableFrames)
+    : fBudget(budget),
+      fStableFrames(stableFrames)
+{
+    RUNTIME_EXCEPTION_ASSERT(budget > 0 && stableFrames >= 0);
+}
+
+sk_sp<SkImage> RasterCache::get(const sk_sp<SkPicture>& picture,
+                                int32_t x, int32_t y, SkScalar scale,
+                                SkIPoint *origin)
+{
+    Key key{ picture->uniqueID(), x, y, scale };
+    {
+        std::scoped_lock<std::mutex> scopedLock(fMutex);
+        auto itr = fEntries.find(key);
+        if (itr != fEntries.end())
+        {
+            fStats.fHits++;
+            fLru.splice(fLru.begin(), fLru, itr->second.fLruItr);
+            *origin = itr->second.fOrigin;
+            return itr->second.fImage;
+        }
+        fStats.fMisses++;
+    }
+
+    SkMatrix matrix = SkMatrix::Translate(x, y);
+    matrix.preScale(scale, scale);
+    SkIRect bounds = matrix.mapRect(picture->cullRect()).roundOut();
+    int64_t bytes = static_cast<int64_t>(bounds.width()) * bounds.height() * 4;
+    if (bounds.isEmpty() || bytes > fBudget)
+        return nullptr;
+
+    /* Rasterized without the lock, so other threads are not blocked */
+    sk_sp<SkSurface> surface = SkSurface::MakeRaster(SkImageInfo::MakeN32Premul(bounds.width(),
+                                                                                bounds.height()));
+    if (surface == nullptr)
+        return nullptr;
+    SkCanvas *canvas = surface->getCanvas();
+    canvas->translate(-bounds.left(), -bounds.top());
+    canvas->drawPicture(picture, &matrix, nullptr);
+    sk_sp<SkImage> image = surface->makeImageSnapshot();
+
+    std::scoped_lock<std::mutex> scopedLock(fMutex);
+    /* Another thread may have rasterized the same picture */
+    if (!fEntries.contains(key))
+    {
+        evictUntil(fBudget - bytes);
+        fLru.push_front(key);
+        fEntries[key] = Entry{ image, bounds.topLeft(), bytes, fLru.begin() };
+        fStats.fBytes += bytes;
+    }
+    *origin = bounds.topLeft();
+    return image;
+}
+
+void RasterCache::evictUntil(int64_t bytes)
+{
+    while (fStats.fBytes > bytes && !fLru.empty())
+    {
+        auto itr = fEntries.find(fLru.back());
+        fStats.fBytes -= itr->second.fBytes;
+        fEntries.erase(itr);
+        fLru.pop_back();
+        fStats.fEvictions++;
+    }
+}
+
+void RasterCache::purge()
+{
+    std::scoped_lock<std::mutex> scopedLock(fMutex);
+    fEntries.clear();
+    fLru.clear();
+    fStats.fBytes = 0;
+}
+
+RasterCache::Stats RasterCache::stats()
+{
+    std::scoped_lock<std::mutex> scopedLock(fMutex);
+    Stats stats = fStats;
+    stats.fEntries = static_cast<int32_t>(fEntries.size());
+    return stats;
+}
+
+CIALLO_END_NS
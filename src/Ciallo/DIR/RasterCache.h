@@ -0,0 +1,117 @@
+#ifndef COCOA_RASTERCACHE_H
+#define COCOA_RASTERCACHE_H
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "include/core/SkImage.h"
+#include "include/core/SkPicture.h"
+
+#include "Ciallo/GrBase.h"
+CIALLO_BEGIN_NS
+
+/**
+ * RasterCache keeps pre-rendered images of pictures, so that a picture
+ * which does not change can be blitted instead of replayed. Images are
+ * keyed by SkPicture::uniqueID() plus the integer translation and scale
+ * they are drawn with, and are evicted in LRU order once the total size
+ * exceeds the budget.
+ *
+ * A cached image is blended with kSrcOver, which is only equal to
+ * replaying the picture if the picture itself draws with kSrcOver,
+ * so callers should check IsCacheable() before get().
+ * It can be used by multiple threads.
+ */
+class RasterCache
+{
+public:
+    struct Stats
+    {
+        int64_t     fHits = 0;
+        int64_t     fMisses = 0;
+        int64_t     fEvictions = 0;
+        int64_t     fBytes = 0;
+        int32_t     fEntries = 0;
+    };
+
+    /**
+     * @param budget: Maximum bytes of all cached images.
+     * @param stableFrames: Pictures should be cached after they stayed
+     *                      unchanged for this number of updates.
+     */
+    RasterCache(int64_t budget, int32_t stableFrames);
+    RasterCache(const RasterCache&) = delete;
+    RasterCache& operator=(const RasterCache&) = delete;
+    ~RasterCache() = default;
+
+    inline int32_t stableFrames() const
+    { return fStableFrames; }
+
+    /**
+     * @brief Whether blitting the image of @a picture with kSrcOver
+     *        looks the same as replaying it. That is false if any paint
+     *        of the picture (nested pictures and layers included) uses
+     *        another blend mode, a custom blender or dithering, or a
+     *        layer has a backdrop filter.
+     *
+     * The picture is walked without drawing, so the result should be
+     * kept by callers as long as the picture does not change.
+     */
+    static bool IsCacheable(const sk_sp<SkPicture>& picture);
+
+    /**
+     * @brief Gets the image of @a picture translated by (@a x, @a y)
+     *        and scaled by @a scale, rasterizes it on a miss.
+     *
+     * @param origin: Where the upper-left corner of image should be drawn.
+     * @return nullptr if the image can't fit in the budget.
+     */
+    sk_sp<SkImage> get(const sk_sp<SkPicture>& picture,
+                       int32_t x, int32_t y, SkScalar scale,
+                       SkIPoint *origin);
+
+    void purge();
+    Stats stats();
+
+private:
+    struct Key
+    {
+        uint32_t    fPictureID;
+        int32_t     fX;
+        int32_t     fY;
+        SkScalar    fScale;
+
+        bool operator==(const Key& that) const
+        {
+            return fPictureID == that.fPictureID && fX == that.fX
+                   && fY == that.fY && fScale == that.fScale;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry
+    {
+        sk_sp<SkImage>              fImage;
+        SkIPoint                    fOrigin;
+        int64_t                     fBytes;
+        std::list<Key>::iterator    fLruItr;
+    };
+
+    void evictUntil(int64_t bytes);
+
+    int64_t                                 fBudget;
+    int32_t                                 fStableFrames;
+    std::mutex                              fMutex;
+    /* Most recently used key is at front */
+    std::list<Key>                          fLru;
+    std::unordered_map<Key, Entry, KeyHash> fEntries;
+    Stats                                   fStats;
+};
+
+CIALLO_END_NS
+#endif //COCOA_RASTERCACHE_H
@@ -1,11 +1,15 @@
 #include <memory>
 #include <utility>
 
+#include "include/core/SkRegion.h"
+
+#include "Core/Journal.h"
 #include "Ciallo/GrBase.h"
 #include "Ciallo/DDR/GrBaseRenderLayer.h"
 #include "Ciallo/DIR/RenderNode.h"
 #include "Ciallo/DIR/CompositeNode.h"
 #include "Ciallo/DIR/PaintNode.h"
+#include "Ciallo/DIR/NodeArena.h"
 CIALLO_BEGIN_NS
 
 RenderNode *RenderNode::MakeFromParent(BaseNode *parent,
@@ -25,7 +29,12 @@ RenderNode *RenderNode::MakeFromParent(BaseNode *parent,
     if (renderLayer == nullptr)
         return nullptr;
 
-    return new RenderNode(parent, id, std::move(renderLayer));
+    NodeArena *arena = parent->childrenArena();
+    if (arena == nullptr)
+        return new RenderNode(parent, id, std::move(renderLayer));
+
+    void *memory = arena->allocate(sizeof(RenderNode), alignof(RenderNode));
+    return arena->adopt(new (memory) RenderNode(parent, id, std::move(renderLayer)));
 }
 
 RenderNode::RenderNode(BaseNode *parent,
@@ -33,8 +42,39 @@ RenderNode::RenderNode(BaseNode *parent,
                            std::shared_ptr<GrBaseRenderLayer>&& layer)
     : BaseNode(NodeKind::kRenderNode, parent),
       fNodeId(std::move(id)),
-      fRenderLayer(layer)
+      fRenderLayer(layer),
+      fLayerAttached(true)
+{
+}
+
+RenderNode::~RenderNode()
+{
+    try
+    {
+        detachLayer();
+    }
+    catch (const RuntimeException& e)
+    {
+        log_write(LOG_ERROR) << "<RenderNode> Failed to detach layer of " << fNodeId
+                             << ": " << e.what() << log_endl;
+    }
+}
+
+void RenderNode::detachLayer()
 {
+    if (!fLayerAttached)
+        return;
+    fLayerAttached = false;
+    fRenderLayer->asCompositor()->removeRenderLayer(fRenderLayer.get());
+}
+
+void RenderNode::onChildRemoved(BaseNode *child)
+{
+    if (child->kind() != NodeKind::kPaintNode)
+        return;
+    /* Not a PaintNode anymore if it is being destructed */
+    if (auto *paintNode = dynamic_cast<PaintNode*>(child))
+        fRemovedDamage.op(paintNode->lastDrawnRect(), SkRegion::kUnion_Op);
 }
 
 std::string RenderNode::nodeID() const
@@ -49,18 +89,56 @@ std::shared_ptr<GrBaseRenderLayer> RenderNode::asRenderLayer()
 
 void RenderNode::update()
 {
+    if (!fLayerAttached)
+        return;
+
+    /* Both of the old and new area of a changed node must be drawn again */
+    SkRegion damage;
+    damage.swap(fRemovedDamage);
     for (auto *child : this->children())
     {
         auto *paintNode = child->cast<PaintNode>();
-        sk_sp<SkPicture> picture = paintNode->asPicture();
-        if (picture == nullptr)
-            continue;
+        if (paintNode->changedSinceDrawn())
+        {
+            damage.op(paintNode->lastDrawnRect(), SkRegion::kUnion_Op);
+            damage.op(paintNode->bounds(), SkRegion::kUnion_Op);
+        }
+        paintNode->markDrawn();
+    }
+    if (!damage.op(SkIRect::MakeWH(fRenderLayer->width(), fRenderLayer->height()),
+                   SkRegion::kIntersect_Op))
+        return;
 
-        if (paintNode->left() >= fRenderLayer->width() ||
-            paintNode->top() >= fRenderLayer->height())
-            continue;
+    /* Damaged area is cleared, then every node over it (changed or not)
+       is replayed in order, clipped to the area. Pictures which have been
+       stable for a while, and only draw with kSrcOver, are blitted from
+       the raster cache instead. */
+    RasterCache *rasterCache = this->parent()->cast<CompositeNode>()->rasterCache();
+    for (SkRegion::Iterator itr(damage); !itr.done(); itr.next())
+    {
+        const SkIRect& rect = itr.rect();
+        fRenderLayer->clear(rect);
+        for (auto *child : this->children())
+        {
+            auto *paintNode = child->cast<PaintNode>();
+            sk_sp<SkPicture> picture = paintNode->asPicture();
+            if (picture == nullptr || !SkIRect::Intersects(paintNode->bounds(), rect))
+                continue;
 
-        fRenderLayer->paint(picture, paintNode->left(), paintNode->top(), nullptr);
+            if (rasterCache && paintNode->stableUpdates() >= rasterCache->stableFrames()
+                && paintNode->rasterCacheable())
+            {
+                SkIPoint origin;
+                sk_sp<SkImage> image = rasterCache->get(picture, paintNode->left(),
+                                                        paintNode->top(), 1, &origin);
+                if (image != nullptr)
+                {
+                    fRenderLayer->drawImage(image, origin.x(), origin.y(), nullptr, &rect);
+                    continue;
+                }
+            }
+            fRenderLayer->paint(picture, paintNode->left(), paintNode->top(), nullptr, &rect);
+        }
     }
     fRenderLayer->update();
 }
@@ -3,6 +3,8 @@
 
 #include <memory>
 
+#include "include/core/SkRegion.h"
+
 #include "Ciallo/GrBase.h"
 #include "Ciallo/GrDefinitions.h"
 #include "Ciallo/DIR/BaseNode.h"
@@ -20,12 +22,31 @@ public:
                                       int32_t x, int32_t y,
                                       int zindex);
 
-    ~RenderNode() override = default;
+    /* Removes the layer from compositor if it hasn't been detached */
+    ~RenderNode() override;
 
     std::string nodeID() const;
     std::shared_ptr<GrBaseRenderLayer> asRenderLayer();
+
+    /**
+     * Removes the layer from compositor, so that it is not composited
+     * anymore and its Z-index is released. The node can't be updated
+     * after. Must be called on the thread which presents the frames.
+     */
+    void detachLayer();
+
+    /**
+     * Draws the child PaintNodes whose picture or position has changed
+     * since the last update() and submits the layer. Only the old and
+     * new area of these nodes, and the area of removed nodes, are
+     * drawn again.
+     */
     void update();
 
+protected:
+    /* Area drawn by a removed PaintNode is repainted by the next update() */
+    void onChildRemoved(BaseNode *child) override;
+
 private:
     RenderNode(BaseNode *parent, std::string id,
                std::shared_ptr<GrBaseRenderLayer>&& layer);
@@ -33,6 +54,9 @@ private:
 private:
     std::string                         fNodeId;
     std::shared_ptr<GrBaseRenderLayer>  fRenderLayer;
+    bool                                fLayerAttached;
+    /* Area of removed children which hasn't been repainted */
+    SkRegion                            fRemovedDamage;
 };
 
 CIALLO_END_NS
@@ -0,0 +1,129 @@
+/**
+ * Checks that a render node destroyed by destroyRenderNode() or
+ * resetScene() disappears from the next frame: the area it covered
+ * is repainted, and its Z-index can be used by a new render node.
+ *   $ ./destroy_render_node
+ */
+#include <unistd.h>
+
+#include <iostream>
+#include <cstring>
+#include <memory>
+
+#include "include/core/SkCanvas.h"
+#include "include/core/SkPicture.h"
+#include "include/core/SkPictureRecorder.h"
+
+#include "Core/Journal.h"
+#include "Ciallo/GraphicsContext.h"
+#include "Ciallo/DDR/GrHeadlessPlatform.h"
+#include "Ciallo/DIR/PaintNode.h"
+
+using namespace cocoa;
+using namespace cocoa::ciallo;
+
+namespace {
+
+constexpr int32_t kWidth = 320;
+constexpr int32_t kHeight = 240;
+constexpr int32_t kLayerSize = 100;
+constexpr int32_t kLayerX = 40;
+constexpr int32_t kLayerY = 30;
+constexpr int kZIndex = 3;
+
+RenderNodeHandle make_layer(GraphicsContext& context)
+{
+    RenderNodeHandle handle = context.createRenderNode("Layer", kLayerSize, kLayerSize,
+                                                       kLayerX, kLayerY, kZIndex);
+    RenderNode *renderNode = context.getRenderNode(handle);
+    renderNode->asRenderLayer()->setVisibility(true);
+
+    SkPictureRecorder recorder;
+    SkCanvas *canvas = recorder.beginRecording(SkRect::MakeWH(kLayerSize, kLayerSize));
+    canvas->clear(SK_ColorRED);
+    PaintNode::MakeFromParent(renderNode, kLayerSize, kLayerSize, 0, 0)
+            ->setPicture(recorder.finishRecordingAsPicture());
+
+    context.emitCmdRenderNodeUpdate(handle)->wait();
+    return handle;
+}
+
+uint32_t present_and_read(GraphicsContext& context)
+{
+    context.emitCmdPresent()->wait();
+    GrBasePlatform *platform = context.asPlatform();
+    platform->expose();
+
+    const uint8_t *buffer = platform->buffer(platform->frontBuffer());
+    size_t offset = (static_cast<size_t>(kLayerY + kLayerSize / 2) * kWidth + kLayerX + kLayerSize / 2) * 4;
+    uint32_t pixel;
+    std::memcpy(&pixel, buffer + offset, sizeof(pixel));
+    return pixel;
+}
+
+bool check(bool condition, const char *what)
+{
+    if (!condition)
+        std::cerr << "Failed: " << what << std::endl;
+    return condition;
+}
+
+} // namespace anonymous
+
+int main(int argc, char const *argv[])
+{
+    Journal::New(STDOUT_FILENO, LOG_LEVEL_DEBUG, true);
+
+    GrPlatformOptions options;
+    options.use_gpu_accel = false;
+    options.use_opencl_accel = false;
+
+    bool ok = true;
+    {
+        GraphicsContext context(GrHeadlessPlatform::MakeHeadless(kWidth, kHeight,
+                                                                 GrColorFormat::kColor_BGRA_8888,
+                                                                 options));
+        uint32_t background = present_and_read(context);
+
+        RenderNodeHandle handle = make_layer(context);
+        ok &= check(present_and_read(context) != background, "layer is composited");
+
+        context.destroyRenderNode(handle);
+        ok &= check(present_and_read(context) == background, "destroyed layer is repainted");
+        ok &= check(!context.ownsRenderNode(handle), "handle of destroyed node is stale");
+
+        /* The Z-index of destroyed node is released */
+        try
+        {
+            RenderNodeHandle newHandle = make_layer(context);
+            /* The new node reuses the registry slot with a new generation */
+            ok &= check(newHandle.fIndex == handle.fIndex && newHandle != handle, "slot is reused");
+            ok &= check(context.getRenderNode(handle) == nullptr, "stale handle is rejected");
+            ok &= check(present_and_read(context) != background, "new layer is composited");
+            context.destroyRenderNode(newHandle);
+            ok &= check(present_and_read(context) == background, "new layer is repainted");
+        }
+        catch (const RuntimeException& e)
+        {
+            ok = check(false, e.what());
+        }
+
+        /* Same for the nodes destroyed by resetScene() */
+        try
+        {
+            make_layer(context);
+            context.resetScene();
+            ok &= check(present_and_read(context) == background, "reset layer is repainted");
+            make_layer(context);
+            ok &= check(present_and_read(context) != background, "layer after reset is composited");
+        }
+        catch (const RuntimeException& e)
+        {
+            ok = check(false, e.what());
+        }
+    }
+
+    std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+    Journal::Delete();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+/**
+ * Checks that NodeArena reuses the memory of destroyed nodes, so a
+ * scene which keeps creating and destroying nodes does not grow.
+ *   $ ./node_arena
+ */
+#include <iostream>
+
+#include "Ciallo/DIR/NodeArena.h"
+#include "Ciallo/DIR/CompositeNode.h"
+#include "Ciallo/DIR/PaintNode.h"
+
+using namespace cocoa::ciallo;
+
+namespace {
+
+bool check(bool condition, const char *what)
+{
+    if (!condition)
+        std::cerr << "Failed: " << what << std::endl;
+    return condition;
+}
+
+} // namespace anonymous
+
+int main(int argc, char const *argv[])
+{
+    NodeArena arena;
+    CompositeNode root(nullptr);
+    root.setNodeArena(&arena);
+
+    bool ok = true;
+    for (int32_t i = 0; i < 64; i++)
+        PaintNode::MakeFromParent(&root, 16, 16, 0, 0);
+    size_t bytes = arena.bytes();
+
+    for (int32_t round = 0; round < 100000; round++)
+    {
+        PaintNode *node = PaintNode::MakeFromParent(&root, 16, 16, 0, 0);
+        BaseNode::Delete(node);
+    }
+    ok &= check(arena.nodes() == 64, "destroyed nodes are not counted");
+    ok &= check(arena.bytes() == bytes, "memory of destroyed nodes is reused");
+
+    arena.reset();
+    ok &= check(arena.nodes() == 0 && arena.bytes() == 0, "reset releases everything");
+
+    std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+/**
+ * Checks that RasterCache::IsCacheable() only accepts pictures which
+ * look the same when blitted with kSrcOver as when replayed.
+ *   $ ./raster_cache
+ */
+#include <iostream>
+#include <functional>
+
+#include "include/core/SkCanvas.h"
+#include "include/core/SkPaint.h"
+#include "include/core/SkPicture.h"
+#include "include/core/SkPictureRecorder.h"
+
+#include "Ciallo/DIR/RasterCache.h"
+
+using namespace cocoa::ciallo;
+
+namespace {
+
+sk_sp<SkPicture> record(const std::function<void(SkCanvas*)>& draw)
+{
+    SkPictureRecorder recorder;
+    draw(recorder.beginRecording(SkRect::MakeWH(100, 100)));
+    return recorder.finishRecordingAsPicture();
+}
+
+bool check(bool condition, const char *what)
+{
+    if (!condition)
+        std::cerr << "Failed: " << what << std::endl;
+    return condition;
+}
+
+} // namespace anonymous
+
+int main(int argc, char const *argv[])
+{
+    SkPaint srcOver;
+    srcOver.setColor(SK_ColorRED);
+
+    SkPaint multiply(srcOver);
+    multiply.setBlendMode(SkBlendMode::kMultiply);
+
+    SkPaint dither(srcOver);
+    dither.setDither(true);
+
+    bool ok = true;
+    ok &= check(RasterCache::IsCacheable(record([&](SkCanvas *canvas) {
+        canvas->drawRect(SkRect::MakeWH(50, 50), srcOver);
+        canvas->saveLayer(nullptr, nullptr);
+        canvas->drawCircle(50, 50, 20, srcOver);
+        canvas->restore();
+    })), "kSrcOver picture is cacheable");
+
+    ok &= check(!RasterCache::IsCacheable(record([](SkCanvas *canvas) {
+        canvas->clear(SK_ColorRED);
+    })), "cleared picture is not cacheable");
+
+    ok &= check(!RasterCache::IsCacheable(record([&](SkCanvas *canvas) {
+        canvas->drawRect(SkRect::MakeWH(50, 50), multiply);
+    })), "kMultiply picture is not cacheable");
+
+    ok &= check(!RasterCache::IsCacheable(record([&](SkCanvas *canvas) {
+        canvas->drawRect(SkRect::MakeWH(50, 50), dither);
+    })), "dithered picture is not cacheable");
+
+    ok &= check(!RasterCache::IsCacheable(record([&](SkCanvas *canvas) {
+        canvas->saveLayer(nullptr, &multiply);
+        canvas->drawRect(SkRect::MakeWH(50, 50), srcOver);
+        canvas->restore();
+    })), "kMultiply layer is not cacheable");
+
+    sk_sp<SkPicture> nested = record([&](SkCanvas *canvas) {
+        canvas->drawRect(SkRect::MakeWH(50, 50), multiply);
+    });
+    ok &= check(!RasterCache::IsCacheable(record([&](SkCanvas *canvas) {
+        canvas->drawPicture(nested);
+    })), "picture with nested kMultiply picture is not cacheable");
+
+    std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,210 @@
+#include <string>
+#include <filesystem>
+#include <unordered_set>
+
+#include <Poco/JSON/Object.h>
+
+#include "Core/Journal.h"
+#include "Core/Exception.h"
+#include "Ciallo/GrBase.h"
+#include "Ciallo/ThreadPool.h"
+#include "Ciallo/SkpSnapshot.h"
+#include "Ciallo/FrameCapture.h"
+#include "Ciallo/DIR/PaintNode.h"
+CIALLO_BEGIN_NS
+
+FrameCapture::FrameCapture(const std::string& directory, int32_t frameWidth, int32_t frameHeight)
+    : fDirectory(directory),
+      fStartTime(std::chrono::steady_clock::now()),
+      fFrames(0),
+      fNextLayer(0),
+      fEvents(new Poco::JSON::Array())
+{
+    std::error_code ec;
+    std::filesystem::create_directories(fDirectory + "/pictures", ec);
+    if (!ec)
+        fStream.open(fDirectory + "/capture.jsonl", std::ios::out | std::ios::trunc);
+    if (ec || !fStream.is_open())
+    {
+        throw RuntimeException::Builder(__FUNCTION__)
+                .append("Failed to create capture in ")
+                .append(fDirectory)
+                .make<RuntimeException>();
+    }
+
+    Poco::JSON::Object header;
+    header.set("version", kVersion);
+    header.set("frame_width", frameWidth);
+    header.set("frame_height", frameHeight);
+    header.stringify(fStream);
+    fStream << '\n';
+
+    /* Pictures are serialized and compressed out of the Renderer thread */
+    fWriterPool = std::make_unique<ThreadPool>("CaptureWriter", 1);
+    log_write(LOG_INFO) << "<FrameCapture> Capturing frames into " << fDirectory << log_endl;
+}
+
+FrameCapture::~FrameCapture()
+{
+    finish();
+}
+
+void FrameCapture::finish()
+{
+    for (auto& fence : fPendingWrites)
+        fence->wait();
+    fPendingWrites.clear();
+    fStream.flush();
+}
+
+int32_t FrameCapture::pictureIndexOf(const sk_sp<SkPicture>& picture, const std::string& layerName)
+{
+    if (picture == nullptr)
+        return -1;
+
+    auto itr = fPictures.find(picture->uniqueID());
+    if (itr != fPictures.end())
+        return itr->second;
+
+    auto index = static_cast<int32_t>(fPictures.size());
+    fPictures[picture->uniqueID()] = index;
+
+    std::string path = fDirectory + "/pictures/" + std::to_string(index) + ".cskp";
+    fPendingWrites.push_back(fWriterPool->enqueue([picture, path, layerName]() {
+        SkpSnapshotMetadata metadata;
+        metadata.pictureName = layerName;
+        metadata.packagerName = "FrameCapture";
+        if (!SkpSnapshotWriteToFile(picture, path, SkpSnapshotCompress::kZlib, metadata))
+            log_write(LOG_WARNING) << "<FrameCapture> Failed to write picture " << path << log_endl;
+    }));
+    return index;
+}
+
+FrameCapture::LayerRecord& FrameCapture::layerRecordOf(RenderNode *renderNode)
+{
+    std::shared_ptr<GrBaseRenderLayer> layer = renderNode->asRenderLayer();
+    auto itr = fLayers.find(renderNode);
+    if (itr != fLayers.end())
+    {
+        if (itr->second.fLayer.lock() == layer)
+            return itr->second;
+
+        /* The node was destroyed and a new one is at the same address */
+        Poco::JSON::Object::Ptr event = new Poco::JSON::Object();
+        event->set("type", "destroy");
+        event->set("layer", itr->second.fIndex);
+        fEvents->add(event);
+        fLayers.erase(itr);
+    }
+
+    LayerRecord& record = fLayers[renderNode];
+    record.fIndex = fNextLayer++;
+    record.fLayer = layer;
+    record.fLeft = layer->left();
+    record.fTop = layer->top();
+    record.fVisible = layer->visible();
+
+    Poco::JSON::Object::Ptr event = new Poco::JSON::Object();
+    event->set("type", "create");
+    event->set("layer", record.fIndex);
+    event->set("name", renderNode->nodeID());
+    event->set("width", layer->width());
+    event->set("height", layer->height());
+    event->set("x", layer->left());
+    event->set("y", layer->top());
+    event->set("zindex", layer->zindex());
+    event->set("visible", layer->visible());
+    fEvents->add(event);
+    return record;
+}
+
+void FrameCapture::recordUpdate(RenderNode *renderNode)
+{
+    LayerRecord& record = layerRecordOf(renderNode);
+
+    std::vector<PaintRecord> paints;
+    for (auto *child : renderNode->children())
+    {
+        auto *paintNode = child->cast<PaintNode>();
+        paints.push_back({ pictureIndexOf(paintNode->asPicture(), renderNode->nodeID()),
+                           paintNode->left(), paintNode->top() });
+    }
+    if (paints == record.fPaints)
+        return;
+
+    Poco::JSON::Array::Ptr nodes = new Poco::JSON::Array();
+    for (const PaintRecord& paint : paints)
+    {
+        Poco::JSON::Object::Ptr node = new Poco::JSON::Object();
+        node->set("picture", paint.fPicture);
+        node->set("x", paint.fLeft);
+        node->set("y", paint.fTop);
+        nodes->add(node);
+    }
+
+    Poco::JSON::Object::Ptr event = new Poco::JSON::Object();
+    event->set("type", "paint");
+    event->set("layer", record.fIndex);
+    event->set("nodes", nodes);
+    fEvents->add(event);
+    record.fPaints = std::move(paints);
+}
+
+void FrameCapture::sync(const std::vector<RenderNode*>& liveNodes)
+{
+    std::unordered_set<RenderNode*> live(liveNodes.begin(), liveNodes.end());
+    std::erase_if(fLayers, [this, &live](const auto& pair) {
+        if (live.contains(pair.first))
+            return false;
+        Poco::JSON::Object::Ptr event = new Poco::JSON::Object();
+        event->set("type", "destroy");
+        event->set("layer", pair.second.fIndex);
+        fEvents->add(event);
+        return true;
+    });
+
+    for (RenderNode *renderNode : liveNodes)
+    {
+        bool created = !fLayers.contains(renderNode);
+        LayerRecord& record = layerRecordOf(renderNode);
+        if (created)
+        {
+            /* Layers created before the capture never get updated again */
+            recordUpdate(renderNode);
+            continue;
+        }
+
+        std::shared_ptr<GrBaseRenderLayer> layer = renderNode->asRenderLayer();
+        if (layer->left() == record.fLeft && layer->top() == record.fTop &&
+            layer->visible() == record.fVisible)
+            continue;
+
+        record.fLeft = layer->left();
+        record.fTop = layer->top();
+        record.fVisible = layer->visible();
+
+        Poco::JSON::Object::Ptr event = new Poco::JSON::Object();
+        event->set("type", "layer");
+        event->set("layer", record.fIndex);
+        event->set("x", record.fLeft);
+        event->set("y", record.fTop);
+        event->set("visible", record.fVisible);
+        fEvents->add(event);
+    }
+}
+
+void FrameCapture::recordPresent()
+{
+    auto time = std::chrono::steady_clock::now() - fStartTime;
+
+    Poco::JSON::Object frame;
+    frame.set("frame", fFrames++);
+    frame.set("time_us", std::chrono::duration_cast<std::chrono::microseconds>(time).count());
+    frame.set("events", fEvents);
+    frame.stringify(fStream);
+    fStream << '\n';
+
+    fEvents = new Poco::JSON::Array();
+}
+
+CIALLO_END_NS
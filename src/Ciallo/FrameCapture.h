@@ -0,0 +1,109 @@
+#ifndef COCOA_FRAMECAPTURE_H
+#define COCOA_FRAMECAPTURE_H
+
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include <Poco/JSON/Array.h>
+
+#include "include/core/SkPicture.h"
+
+#include "Ciallo/GrBase.h"
+#include "Ciallo/Thread.h"
+#include "Ciallo/DIR/RenderNode.h"
+CIALLO_BEGIN_NS
+
+class ThreadPool;
+
+/**
+ * FrameCapture records what the Renderer thread does, frame by frame,
+ * so that it can be played back offline by ciallo_replay.
+ * A capture is a directory which contains:
+ *
+ * - capture.jsonl: The first line is a header object with the version
+ *   and frame size. Each of the following lines is a frame object
+ *   { "frame", "time_us", "events" }, where time_us is the time of
+ *   presenting since the capture started, and events happened before
+ *   the frame was presented are:
+ *     { "type": "create", "layer", "name", "width", "height", "x", "y", "zindex" }
+ *     { "type": "destroy", "layer" }
+ *     { "type": "layer", "layer", "x", "y", "visible" }
+ *     { "type": "paint", "layer", "nodes": [{ "picture", "x", "y" }, ...] }
+ *   A "paint" event describes all the paint nodes of the layer in order,
+ *   and "picture" is -1 for a node without picture.
+ * - pictures/<n>.cskp: Each different picture is written only once,
+ *   as a CSKP file on a background thread.
+ *
+ * All the methods must be called on the Renderer thread.
+ */
+class FrameCapture
+{
+public:
+    static constexpr int32_t kVersion = 1;
+
+    /* Throws RuntimeException if the directory can't be created */
+    FrameCapture(const std::string& directory, int32_t frameWidth, int32_t frameHeight);
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+    ~FrameCapture();
+
+    /* Records the paint nodes of @a renderNode before it is updated */
+    void recordUpdate(RenderNode *renderNode);
+
+    /**
+     * Finds out created and destroyed layers by @a liveNodes (all the
+     * render nodes of context), and records moved or hidden layers.
+     */
+    void sync(const std::vector<RenderNode*>& liveNodes);
+
+    /* Ends current frame, sync() should be called before */
+    void recordPresent();
+
+    inline uint64_t frames() const
+    { return fFrames; }
+
+    /* Waits for pending picture writes */
+    void finish();
+
+private:
+    struct PaintRecord
+    {
+        int32_t     fPicture;
+        int32_t     fLeft;
+        int32_t     fTop;
+        bool operator==(const PaintRecord&) const = default;
+    };
+
+    struct LayerRecord
+    {
+        int32_t                             fIndex;
+        /* Detects a new node which reuses the address of destroyed one */
+        std::weak_ptr<GrBaseRenderLayer>    fLayer;
+        int32_t                             fLeft;
+        int32_t                             fTop;
+        bool                                fVisible;
+        std::vector<PaintRecord>            fPaints;
+    };
+
+    LayerRecord& layerRecordOf(RenderNode *renderNode);
+    int32_t pictureIndexOf(const sk_sp<SkPicture>& picture, const std::string& layerName);
+
+private:
+    std::string                                     fDirectory;
+    std::ofstream                                   fStream;
+    std::unique_ptr<ThreadPool>                     fWriterPool;
+    std::chrono::steady_clock::time_point           fStartTime;
+    uint64_t                                        fFrames;
+    int32_t                                         fNextLayer;
+    std::unordered_map<RenderNode*, LayerRecord>    fLayers;
+    std::unordered_map<uint32_t, int32_t>           fPictures;
+    std::vector<std::shared_ptr<Thread::Fence>>     fPendingWrites;
+    Poco::JSON::Array::Ptr                          fEvents;
+};
+
+CIALLO_END_NS
+#endif //COCOA_FRAMECAPTURE_H
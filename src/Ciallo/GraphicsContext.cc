@@ -1,4 +1,13 @@
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+
 #include "Core/Journal.h"
+#include "Ciallo/ThreadPool.h"
+#include "Ciallo/FrameCapture.h"
 #include "Ciallo/GraphicsContext.h"
 CIALLO_BEGIN_NS
 
@@ -6,15 +15,68 @@ enum GCMDOpcodes
 {
     kGCMD_Composite_Present = 1,
     kGCMD_Layer_Update,
-    kGCMD_Tighten_Resources
+    kGCMD_Layers_Update,
+    kGCMD_Tighten_Resources,
+    kGCMD_Capture_Start,
+    kGCMD_Capture_Stop,
+    kGCMD_Nodes_Destroy,
+    kGCMD_Scene_Reset
+};
+
+/* Userdata of kGCMD_Layers_Update */
+struct RenderNodeHandlesBatch
+{
+    std::vector<RenderNodeHandle>   fHandles;
+};
+
+/* Userdata of kGCMD_Nodes_Destroy and kGCMD_Scene_Reset */
+struct RenderNodesBatch
+{
+    std::vector<RenderNode*>    fNodes;
+};
+
+/**
+ * Layers of a kGCMD_Layers_Update command rasterized by the raster
+ * threads. Batches are recycled by the Renderer thread after they
+ * finished, so that neither a fence nor a closure is allocated for
+ * each layer.
+ */
+struct RasterBatch
+{
+    std::vector<RenderNode*>        fNodes;
+    /* Index of the next layer to be rasterized */
+    std::atomic<size_t>             fNext{0};
+    /* Raster threads working on the batch, the last one signals the fence */
+    std::atomic<int32_t>            fWorkers{0};
+    std::shared_ptr<Thread::Fence>  fFence;
+    /* Tells a recycled batch from the one it was */
+    uint64_t                        fSerial = 0;
+
+    inline bool finished() const
+    { return fWorkers.load(std::memory_order_acquire) == 0; }
 };
 
 class RenderWorker : public Worker
 {
 public:
-    explicit RenderWorker(GraphicsContext *ctx) : fContext(ctx) {}
+    explicit RenderWorker(GraphicsContext *ctx)
+        : fContext(ctx),
+          fRasterSerial(0)
+    {
+        const GrPlatformOptions& options = ctx->asPlatform()->options();
+        bool gpu = ctx->asNode()->asCompositor()->getDeviceType() == CompositeDevice::kGpuVulkan;
+        if (!gpu && options.raster_threads != 1)
+            fRasterPool = std::make_unique<ThreadPool>("Raster", options.raster_threads);
+    }
+
     ~RenderWorker() override = default;
 
+    void final() override
+    {
+        waitRasterBarrier();
+        GCMD_Capture_Stop();
+    }
+
     Thread::CmdExecuteResult execute(const Thread::Command& cmd) override
     {
         switch (cmd.opcode())
@@ -24,12 +86,36 @@ public:
             return Thread::CmdExecuteResult::kNormal;
 
         case kGCMD_Layer_Update:
-            GCMD_Layer_Update(cmd.userdata().extract<RenderNode*>());
-            return Thread::CmdExecuteResult::kNormal;
+        {
+            const auto& handle = cmd.userdata().extract<RenderNodeHandle>();
+            return GCMD_Layers_Update(&handle, 1, cmd.fence());
+        }
+
+        case kGCMD_Layers_Update:
+        {
+            const auto& batch = cmd.userdata().extract<RenderNodeHandlesBatch>();
+            return GCMD_Layers_Update(batch.fHandles.data(), batch.fHandles.size(), cmd.fence());
+        }
 
         case kGCMD_Tighten_Resources:
             GCMD_Tighten_Resources();
             return Thread::CmdExecuteResult::kNormal;
+
+        case kGCMD_Capture_Start:
+            GCMD_Capture_Start(cmd.userdata().extract<std::shared_ptr<FrameCapture>>());
+            return Thread::CmdExecuteResult::kNormal;
+
+        case kGCMD_Capture_Stop:
+            GCMD_Capture_Stop();
+            return Thread::CmdExecuteResult::kNormal;
+
+        case kGCMD_Nodes_Destroy:
+            GCMD_Nodes_Destroy(cmd.userdata().extract<RenderNodesBatch>());
+            return Thread::CmdExecuteResult::kNormal;
+
+        case kGCMD_Scene_Reset:
+            GCMD_Scene_Reset(cmd.userdata().extract<RenderNodesBatch>());
+            return Thread::CmdExecuteResult::kNormal;
         }
 
         log_write(LOG_WARNING) << "<RenderWorker> Unknown command opcode: " << cmd.opcode() << log_endl;
@@ -39,31 +125,225 @@ public:
 private:
     void GCMD_Composite_Present()
     {
+        waitRasterBarrier();
+        if (fCapture)
+            fContext->syncCapture(fCapture.get());
         fContext->asNode()->asCompositor()->present();
+        if (fCapture)
+            fCapture->recordPresent();
+    }
+
+    Thread::CmdExecuteResult GCMD_Layers_Update(const RenderNodeHandle *handles, size_t count,
+                                                const std::shared_ptr<Thread::Fence>& cmdFence)
+    {
+        fResolvedNodes.resize(count);
+        if (fContext->resolveRenderNodes(handles, count, fResolvedNodes.data()) != count)
+        {
+            log_write(LOG_ERROR) << "<RenderWorker> Try executing GCMD_Layer_Update:" << log_endl;
+            log_write(LOG_ERROR) << "<RenderWorker>   Given layer is not owned by current GraphicsContext" << log_endl;
+        }
+
+        if (fRasterPool == nullptr)
+        {
+            for (RenderNode *renderNode : fResolvedNodes)
+            {
+                if (renderNode == nullptr)
+                    continue;
+                if (fCapture)
+                    fCapture->recordUpdate(renderNode);
+                renderNode->update();
+            }
+            return Thread::CmdExecuteResult::kNormal;
+        }
+
+        RasterBatch *batch = acquireRasterBatch();
+        for (size_t i = 0; i < count; i++)
+        {
+            RenderNode *renderNode = fResolvedNodes[i];
+            if (renderNode == nullptr || !claimSlot(handles[i].fIndex, batch))
+                continue;
+            if (fCapture)
+                fCapture->recordUpdate(renderNode);
+            batch->fNodes.push_back(renderNode);
+        }
+
+        if (batch->fNodes.empty())
+        {
+            fFreeBatches.push_back(batch);
+            return Thread::CmdExecuteResult::kNormal;
+        }
+
+        /* The command is finished by the last raster thread leaving the batch */
+        auto workers = static_cast<int32_t>(std::min<size_t>(fRasterPool->size(), batch->fNodes.size()));
+        batch->fFence = cmdFence;
+        batch->fNext.store(0, std::memory_order_relaxed);
+        batch->fWorkers.store(workers, std::memory_order_release);
+        fInFlightBatches.push_back(batch);
+        for (int32_t i = 0; i < workers; i++)
+            fRasterPool->post([batch]() { RasterizeBatch(batch); });
+        return Thread::CmdExecuteResult::kDeferredFinish;
     }
 
-    void GCMD_Layer_Update(RenderNode *renderNode)
+    /* Runs on raster threads, which take layers of the batch one by one */
+    static void RasterizeBatch(RasterBatch *batch)
     {
-        for (BaseNode *child : fContext->asNode()->children())
+        size_t count = batch->fNodes.size();
+        size_t i;
+        while ((i = batch->fNext.fetch_add(1, std::memory_order_relaxed)) < count)
         {
-            auto *renderChild = child->cast<RenderNode>();
-            if (renderChild == renderNode)
+            RenderNode *renderNode = batch->fNodes[i];
+            try
             {
-                renderChild->update();
-                return;
+                renderNode->update();
             }
+            catch (const RuntimeException& e)
+            {
+                log_write(LOG_ERROR) << "<RenderWorker> Failed to rasterize layer "
+                                     << renderNode->nodeID() << ": " << e.what() << log_endl;
+            }
+        }
+
+        /* The batch may be recycled as soon as the counter reaches zero */
+        std::shared_ptr<Thread::Fence> fence = batch->fFence;
+        if (batch->fWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            fence->signal();
+    }
+
+    RasterBatch *acquireRasterBatch()
+    {
+        std::erase_if(fInFlightBatches, [this](RasterBatch *batch) {
+            if (!batch->finished())
+                return false;
+            recycleRasterBatch(batch);
+            return true;
+        });
+
+        RasterBatch *batch;
+        if (fFreeBatches.empty())
+        {
+            fRasterBatches.push_back(std::make_unique<RasterBatch>());
+            batch = fRasterBatches.back().get();
         }
-        log_write(LOG_ERROR) << "<RenderWorker> Try executing GCMD_Layer_Update:" << log_endl;
-        log_write(LOG_ERROR) << "<RenderWorker>   Given layer is not owned by current GraphicsContext" << log_endl;
+        else
+        {
+            batch = fFreeBatches.back();
+            fFreeBatches.pop_back();
+        }
+        batch->fSerial = ++fRasterSerial;
+        batch->fNodes.clear();
+        return batch;
+    }
+
+    void recycleRasterBatch(RasterBatch *batch)
+    {
+        batch->fFence.reset();
+        fFreeBatches.push_back(batch);
+    }
+
+    /**
+     * Different layers are rasterized concurrently, but a layer can't be
+     * rasterized by two threads at the same time. Waits for the previous
+     * batch which contains the layer in registry slot @a index. Returns
+     * false if the layer is already in @a batch.
+     */
+    bool claimSlot(uint32_t index, RasterBatch *batch)
+    {
+        if (index >= fSlotBatches.size())
+            fSlotBatches.resize(index + 1);
+
+        SlotBatch& slot = fSlotBatches[index];
+        if (slot.fBatch != nullptr && slot.fBatch->fSerial == slot.fSerial)
+        {
+            if (slot.fBatch == batch)
+                return false;
+            if (!slot.fBatch->finished())
+                slot.fBatch->fFence->wait();
+        }
+        slot.fBatch = batch;
+        slot.fSerial = batch->fSerial;
+        return true;
+    }
+
+    /* Waits until all the in-flight layer rasterizations finished */
+    void waitRasterBarrier()
+    {
+        for (RasterBatch *batch : fInFlightBatches)
+        {
+            if (!batch->finished())
+                batch->fFence->wait();
+            recycleRasterBatch(batch);
+        }
+        fInFlightBatches.clear();
     }
 
     void GCMD_Tighten_Resources()
     {
-        /* TODO: Implement this */
+        waitRasterBarrier();
+        if (RasterCache *rasterCache = fContext->asNode()->rasterCache())
+        {
+            RasterCache::Stats stats = rasterCache->stats();
+            log_write(LOG_DEBUG) << "<RenderWorker> Purging raster cache: " << stats.fEntries << " entries, "
+                                 << stats.fBytes << " bytes, " << stats.fHits << " hits, "
+                                 << stats.fMisses << " misses, " << stats.fEvictions << " evictions" << log_endl;
+            rasterCache->purge();
+        }
+    }
+
+    void GCMD_Nodes_Destroy(const RenderNodesBatch& batch)
+    {
+        /* Raster threads may still be drawing into the layers. A destroyed
+           render node detaches its layer from compositor, so that the layer
+           isn't composited anymore and the area it covered is repainted */
+        waitRasterBarrier();
+        for (RenderNode *renderNode : batch.fNodes)
+            BaseNode::Delete(renderNode);
+    }
+
+    void GCMD_Scene_Reset(const RenderNodesBatch& batch)
+    {
+        GCMD_Tighten_Resources();
+        /* Layers are unregistered before the arena destructs all the nodes
+           without order, then their Z-indices can be used by a new scene */
+        for (RenderNode *renderNode : batch.fNodes)
+            renderNode->detachLayer();
+        fContext->fNodeArena.reset();
+    }
+
+    void GCMD_Capture_Start(const std::shared_ptr<FrameCapture>& capture)
+    {
+        GCMD_Capture_Stop();
+        waitRasterBarrier();
+        fCapture = capture;
+        /* Layers which exist already are recorded as created in the first frame */
+        fContext->syncCapture(fCapture.get());
+    }
+
+    void GCMD_Capture_Stop()
+    {
+        if (fCapture == nullptr)
+            return;
+        fCapture->finish();
+        log_write(LOG_INFO) << "<RenderWorker> Captured " << fCapture->frames() << " frames" << log_endl;
+        fCapture.reset();
     }
 
 private:
-    GraphicsContext     *fContext;
+    /* The last batch which contains the layer in a registry slot */
+    struct SlotBatch
+    {
+        RasterBatch    *fBatch = nullptr;
+        uint64_t        fSerial = 0;
+    };
+
+    GraphicsContext                             *fContext;
+    std::unique_ptr<ThreadPool>                  fRasterPool;
+    std::vector<std::unique_ptr<RasterBatch>>    fRasterBatches;
+    std::vector<RasterBatch*>                    fInFlightBatches;
+    std::vector<RasterBatch*>                    fFreeBatches;
+    uint64_t                                     fRasterSerial;
+    std::vector<SlotBatch>                       fSlotBatches;
+    std::vector<RenderNode*>                     fResolvedNodes;
+    std::shared_ptr<FrameCapture>                fCapture;
 };
 
 GraphicsContext::GraphicsContext(std::unique_ptr<GrBasePlatform> platform)
@@ -78,36 +358,187 @@ GraphicsContext::GraphicsContext(std::unique_ptr<GrBasePlatform> platform)
                 .make<RuntimeException>();
     }
     fRootNode = std::make_unique<CompositeNode>(fPlatform->compositor());
+    fRootNode->setNodeArena(&fNodeArena);
+
+    const GrPlatformOptions& options = fPlatform->options();
+    if (options.raster_cache_budget > 0 &&
+        fRootNode->asCompositor()->getDeviceType() != CompositeDevice::kGpuVulkan)
+    {
+        fRootNode->setRasterCache(std::make_unique<RasterCache>(options.raster_cache_budget,
+                                                                options.raster_cache_stable_frames));
+    }
 
     fRenderWorker = new RenderWorker(this);
     fRendererThread = new Thread("Renderer", fRenderWorker);
+
+    if (!options.frame_capture_dir.empty())
+    {
+        try
+        {
+            startCapture(options.frame_capture_dir);
+        }
+        catch (const RuntimeException& e)
+        {
+            log_write(LOG_ERROR) << "<GraphicsContext> " << e.what() << log_endl;
+        }
+    }
 }
 
 GraphicsContext::~GraphicsContext()
 {
     delete fRendererThread;
     delete fRenderWorker;
+    /* Render nodes detach their layers when they are destructed */
+    fNodeArena.reset();
 }
 
-RenderNode *GraphicsContext::createRenderNode(const std::string& identifier,
-                                              int32_t width, int32_t height,
-                                              int32_t x, int32_t y, int zindex)
+RenderNodeHandle GraphicsContext::createRenderNode(const std::string& identifier,
+                                                   int32_t width, int32_t height,
+                                                   int32_t x, int32_t y, int zindex)
 {
     RenderNode *renderNode = RenderNode::MakeFromParent(fRootNode.get(), identifier,
                                                         width, height, x, y, zindex);
+    if (renderNode == nullptr)
+        return RenderNodeHandle();
+
+    std::unique_lock<std::shared_mutex> scopedLock(fRenderNodesMutex);
+    uint32_t index;
+    if (fFreeRenderNodeSlots.empty())
+    {
+        index = static_cast<uint32_t>(fRenderNodeSlots.size());
+        fRenderNodeSlots.emplace_back();
+    }
+    else
+    {
+        index = fFreeRenderNodeSlots.back();
+        fFreeRenderNodeSlots.pop_back();
+    }
+    fRenderNodeSlots[index].fNode = renderNode;
+    return RenderNodeHandle{ index, fRenderNodeSlots[index].fGeneration };
+}
+
+RenderNode *GraphicsContext::releaseRenderNodeSlot(uint32_t index)
+{
+    RenderNodeSlot& slot = fRenderNodeSlots[index];
+    RenderNode *renderNode = slot.fNode;
+    slot.fNode = nullptr;
+    /* Generation 0 is reserved for invalid handles */
+    if (++slot.fGeneration == 0)
+        slot.fGeneration = 1;
+    fFreeRenderNodeSlots.push_back(index);
     return renderNode;
 }
 
+void GraphicsContext::destroyRenderNode(RenderNodeHandle handle)
+{
+    RenderNodesBatch batch;
+    {
+        std::unique_lock<std::shared_mutex> scopedLock(fRenderNodesMutex);
+        if (lookupRenderNode(handle) == nullptr)
+        {
+            throw RuntimeException::Builder(__FUNCTION__)
+                    .append("Given render node is not owned by current GraphicsContext")
+                    .make<RuntimeException>();
+        }
+        batch.fNodes.push_back(releaseRenderNodeSlot(handle.fIndex));
+    }
+
+    fRendererThread->enqueueCmd(Thread::Command(kGCMD_Nodes_Destroy,
+                                                Poco::Dynamic::Var(std::move(batch))))->wait();
+}
+
+void GraphicsContext::resetScene()
+{
+    RenderNodesBatch batch;
+    {
+        std::unique_lock<std::shared_mutex> scopedLock(fRenderNodesMutex);
+        for (uint32_t i = 0; i < fRenderNodeSlots.size(); i++)
+        {
+            if (fRenderNodeSlots[i].fNode != nullptr)
+                batch.fNodes.push_back(releaseRenderNodeSlot(i));
+        }
+    }
+    fRendererThread->enqueueCmd(Thread::Command(kGCMD_Scene_Reset,
+                                                Poco::Dynamic::Var(std::move(batch))))->wait();
+}
+
+void GraphicsContext::startCapture(const std::string& directory)
+{
+    auto compositor = fRootNode->asCompositor();
+    auto capture = std::make_shared<FrameCapture>(directory, compositor->width(), compositor->height());
+    fRendererThread->enqueueCmd(Thread::Command(kGCMD_Capture_Start,
+                                                Poco::Dynamic::Var(std::move(capture))))->wait();
+}
+
+void GraphicsContext::stopCapture()
+{
+    fRendererThread->enqueueCmd(Thread::Command(kGCMD_Capture_Stop,
+                                                Poco::Dynamic::Var()))->wait();
+}
+
+void GraphicsContext::syncCapture(FrameCapture *capture)
+{
+    /* Nodes can't be destroyed while they are being recorded */
+    std::shared_lock<std::shared_mutex> scopedLock(fRenderNodesMutex);
+    std::vector<RenderNode*> liveNodes;
+    for (const RenderNodeSlot& slot : fRenderNodeSlots)
+    {
+        if (slot.fNode != nullptr)
+            liveNodes.push_back(slot.fNode);
+    }
+    capture->sync(liveNodes);
+}
+
+RenderNode *GraphicsContext::lookupRenderNode(RenderNodeHandle handle)
+{
+    if (handle.fIndex >= fRenderNodeSlots.size())
+        return nullptr;
+    const RenderNodeSlot& slot = fRenderNodeSlots[handle.fIndex];
+    return slot.fGeneration == handle.fGeneration ? slot.fNode : nullptr;
+}
+
+size_t GraphicsContext::resolveRenderNodes(const RenderNodeHandle *handles, size_t count, RenderNode **nodes)
+{
+    std::shared_lock<std::shared_mutex> scopedLock(fRenderNodesMutex);
+    size_t resolved = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        nodes[i] = lookupRenderNode(handles[i]);
+        if (nodes[i] != nullptr)
+            resolved++;
+    }
+    return resolved;
+}
+
+bool GraphicsContext::ownsRenderNode(RenderNodeHandle handle)
+{
+    return getRenderNode(handle) != nullptr;
+}
+
+RenderNode *GraphicsContext::getRenderNode(RenderNodeHandle handle)
+{
+    std::shared_lock<std::shared_mutex> scopedLock(fRenderNodesMutex);
+    return lookupRenderNode(handle);
+}
+
 std::shared_ptr<Thread::Fence> GraphicsContext::emitCmdPresent()
 {
     return fRendererThread->enqueueCmd(Thread::Command(kGCMD_Composite_Present,
                                                        Poco::Dynamic::Var()));
 }
 
-std::shared_ptr<Thread::Fence> GraphicsContext::emitCmdRenderNodeUpdate(RenderNode *renderNode)
+std::shared_ptr<Thread::Fence> GraphicsContext::emitCmdRenderNodeUpdate(RenderNodeHandle handle)
 {
     return fRendererThread->enqueueCmd(Thread::Command(kGCMD_Layer_Update,
-                                                       Poco::Dynamic::Var(renderNode)));
+                                                       Poco::Dynamic::Var(handle)));
+}
+
+std::shared_ptr<Thread::Fence> GraphicsContext::emitCmdRenderNodesUpdate(std::span<const RenderNodeHandle> handles)
+{
+    RenderNodeHandlesBatch batch;
+    batch.fHandles.assign(handles.begin(), handles.end());
+    return fRendererThread->enqueueCmd(Thread::Command(kGCMD_Layers_Update,
+                                                       Poco::Dynamic::Var(std::move(batch))));
 }
 
 std::shared_ptr<Thread::Fence> GraphicsContext::emitCmdTightenResources()
@@ -5,6 +5,9 @@
 #include <thread>
 #include <queue>
 #include <condition_variable>
+#include <span>
+#include <vector>
+#include <shared_mutex>
 
 #include "Core/Exception.h"
 #include "Ciallo/GrBase.h"
@@ -14,13 +17,36 @@
 #include "Ciallo/DDR/GrBaseRenderLayer.h"
 #include "Ciallo/DIR/RenderNode.h"
 #include "Ciallo/DIR/CompositeNode.h"
+#include "Ciallo/DIR/NodeArena.h"
 CIALLO_BEGIN_NS
 
+class FrameCapture;
+
+/**
+ * Handle of a render node registered in GraphicsContext. The index
+ * refers to a slot of the registry, and the generation of the slot
+ * is increased when its node is destroyed, so that a stale handle
+ * never refers to a new node which reuses the slot (or the address).
+ * A default constructed handle is invalid.
+ */
+struct RenderNodeHandle
+{
+    uint32_t    fIndex = 0;
+    uint32_t    fGeneration = 0;
+
+    inline bool valid() const
+    { return fGeneration != 0; }
+
+    bool operator==(const RenderNodeHandle&) const = default;
+};
+
 /**
  * A GraphicsContext is a instance of Ciallo engine. A single
  * application can only create one GraphicsContext.
  * GraphicsContext will create a thread named Renderer to
- * rasterize and composite (or blend) layers.
+ * rasterize and composite (or blend) layers. Unless the GPU
+ * compositor is used, layers are rasterized in parallel by
+ * a pool of Raster threads, and presenting waits for all of them.
  *
  * The rendering of Ciallo engine is based on rendering tree,
  * which has following structure:
@@ -37,11 +63,12 @@ CIALLO_BEGIN_NS
  *            /                            | Paint nodes
  *       Picture#1  -----------------------+
  *
- * All of the nodes are created in heap, and will be destroyed
- * automatically. That means a node will destroy its child nodes
- * when it is destroyed. So we only need to delete "Root Node"
- * then the whole rendering tree will be destroyed. Each node
- * has its own size of canvas and the position in the father node.
+ * Render nodes and their descendants are allocated from a node
+ * arena owned by GraphicsContext (nodes created in heap can still be
+ * attached to the tree). A node destroys its child nodes when it is
+ * destroyed, and resetScene() destroys all the nodes in the arena
+ * at once. Each node has its own size of canvas and the position
+ * in the father node.
  */
 class GraphicsContext
 {
@@ -51,13 +78,58 @@ public:
 
 
     std::shared_ptr<Thread::Fence> emitCmdPresent();
-    std::shared_ptr<Thread::Fence> emitCmdRenderNodeUpdate(RenderNode *renderNode);
+    std::shared_ptr<Thread::Fence> emitCmdRenderNodeUpdate(RenderNodeHandle handle);
+
+    /**
+     * Updates several render nodes by a single command, whose fence
+     * is signaled after all of them are updated.
+     */
+    std::shared_ptr<Thread::Fence> emitCmdRenderNodesUpdate(std::span<const RenderNodeHandle> handles);
     std::shared_ptr<Thread::Fence> emitCmdTightenResources();
 
-    RenderNode *createRenderNode(const std::string& identifier,
-                                 int32_t width, int32_t height,
-                                 int32_t x, int32_t y,
-                                 int zindex);
+    /**
+     * Render nodes created by this method are registered in the context
+     * until they are destroyed by destroyRenderNode() or resetScene().
+     * Returns an invalid handle if the node can't be created.
+     */
+    RenderNodeHandle createRenderNode(const std::string& identifier,
+                                      int32_t width, int32_t height,
+                                      int32_t x, int32_t y,
+                                      int zindex);
+
+    /**
+     * Destroys the node on the Renderer thread after pending rasterizations
+     * finished, its layer is removed from compositor and the area it
+     * covered is repainted by the next presenting.
+     */
+    void destroyRenderNode(RenderNodeHandle handle);
+
+    /* Checks a render node handle in O(1), can be called by any thread */
+    bool ownsRenderNode(RenderNodeHandle handle);
+
+    /**
+     * Gets the node of @a handle to draw on it, or nullptr if the handle
+     * is stale. The pointer is valid until the node is destroyed.
+     */
+    RenderNode *getRenderNode(RenderNodeHandle handle);
+
+    /**
+     * Destroys all the render nodes after the Renderer thread finished
+     * pending commands, and removes their layers from compositor.
+     * Other threads must not use the nodes then.
+     */
+    void resetScene();
+
+    /**
+     * Records every frame into @a directory until stopCapture(), see
+     * FrameCapture for the format. A capture can be played back by
+     * the ciallo_replay tool. Throws RuntimeException if the directory
+     * can't be created.
+     */
+    void startCapture(const std::string& directory);
+
+    /* Waits until all the captured pictures are written */
+    void stopCapture();
 
     CompositeNode *asNode()
     { return fRootNode.get(); }
@@ -65,9 +137,35 @@ public:
     GrBasePlatform *asPlatform()
     { return fPlatform.get(); }
 
+private:
+    friend class RenderWorker;
+
+    /* Called by the Renderer thread to find out created and destroyed nodes */
+    void syncCapture(FrameCapture *capture);
+
+    /**
+     * Resolves @a count handles under a single lock. Nodes of stale handles
+     * are nullptr. Returns the number of resolved nodes.
+     */
+    size_t resolveRenderNodes(const RenderNodeHandle *handles, size_t count, RenderNode **nodes);
+
+    /* fRenderNodesMutex must be locked by the caller */
+    RenderNode *lookupRenderNode(RenderNodeHandle handle);
+    RenderNode *releaseRenderNodeSlot(uint32_t index);
+
+    struct RenderNodeSlot
+    {
+        RenderNode     *fNode = nullptr;
+        uint32_t        fGeneration = 1;
+    };
+
 private:
     std::unique_ptr<GrBasePlatform>     fPlatform;
+    NodeArena                           fNodeArena;
     std::unique_ptr<CompositeNode>      fRootNode;
+    std::shared_mutex                   fRenderNodesMutex;
+    std::vector<RenderNodeSlot>         fRenderNodeSlots;
+    std::vector<uint32_t>               fFreeRenderNodeSlots;
     Worker                             *fRenderWorker;
     Thread                             *fRendererThread;
 };
@@ -1,17 +1,67 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <string>
 #include <fstream>
 #include <ctime>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <vector>
+
+#include <atomic>
+#include <array>
 
 #include <zlib.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CIALLO_CRC32C_X86       1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CIALLO_CRC32C_ARM       1
+#endif
+
+#include "Core/Journal.h"
 #include "Ciallo/GrBase.h"
+#include "Ciallo/ThreadPool.h"
 #include "Ciallo/SkpSnapshot.h"
 CIALLO_BEGIN_NS
 
 namespace {
 
+/**
+ * Layout of a CSKP file, all the integers are little-endian and
+ * structures are packed:
+ *
+ * - cskp_header, followed by a locator of each section. Locators of
+ *   header are relative to the beginning of file.
+ * - Sections, each begins with the kind of section (one byte) and is
+ *   followed by the content. Locators in a section are relative to
+ *   the beginning of the section.
+ *   - Metadata: cskp_metadata_section followed by the strings it locates
+ *     (not NUL-terminated).
+ *   - Resources: cskp_resources_section followed by resourceCount
+ *     resources, each of them has `count` values of 1 << type bytes.
+ *   - SKP data: cskp_skp_data_section followed by dataSize bytes of
+ *     serialized picture, whose size is rawSize before compression.
+ *     - COMPRESS_RAW: Not compressed, dataAdler32 is the checksum.
+ *     - COMPRESS_ZLIB: A single zlib stream, dataAdler32 is the checksum
+ *       of the serialized picture. Only read for compatibility.
+ *     - COMPRESS_ZLIB_CHUNKED: cskp_chunk_index followed by the chunks.
+ *       Every kChunkSize bytes of the serialized picture are compressed
+ *       independently as a raw deflate stream (or stored as they are
+ *       if they don't shrink, then compressedSize equals rawSize), so
+ *       that chunks can be compressed, decompressed and verified in
+ *       parallel. Each chunk is checked by the CRC32C of its raw bytes,
+ *       and dataAdler32 is unused (0).
+ */
 #define CSKP_HDR_MAGIC                      "CSKP"
-#define CSKP_HDR_VERSION                    210213
+#define CSKP_HDR_VERSION                    261018
+
+#pragma pack(push, 1)
 
 struct cskp_relative_locator
 {
@@ -61,15 +111,32 @@ struct cskp_skp_data_section
     enum cskp_compress_algorithm
     {
         COMPRESS_RAW = 0,
-        COMPRESS_ZLIB
+        COMPRESS_ZLIB,
+        COMPRESS_ZLIB_CHUNKED
     };
 
     uint8_t     algorithm;
     uint64_t    dataSize;
+    uint64_t    rawSize;
     uint32_t    dataAdler32;
     uint8_t     data[0];
 };
 
+struct cskp_chunk
+{
+    uint64_t    rawOffset;      /* In the serialized picture */
+    uint64_t    offset;         /* Relative to the end of chunk index */
+    uint32_t    rawSize;
+    uint32_t    compressedSize;
+    uint32_t    rawCrc32c;
+};
+
+struct cskp_chunk_index
+{
+    uint32_t    chunkCount;
+    cskp_chunk  chunks[0];
+};
+
 struct cskp_section
 {
     enum cskp_section_kind
@@ -98,12 +165,69 @@ struct cskp_header
     cskp_relative_locator   sections[0];
 };
 
+#pragma pack(pop)
+
+constexpr uint32_t kSectionCount = 3;
+constexpr size_t kSectionKindSize = sizeof(uint8_t);
+constexpr uint32_t kChunkSize = 256 << 10;
+
+/* Readonly mapping of a whole file */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path)
+        : fAddr(nullptr), fSize(0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                fAddr = static_cast<uint8_t*>(addr);
+                fSize = st.st_size;
+                /* Chunks are read by several threads at once, so the
+                   whole file is prefetched instead of read ahead */
+                ::madvise(addr, fSize, MADV_WILLNEED);
+            }
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (fAddr != nullptr)
+            ::munmap(fAddr, fSize);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline const uint8_t *data() const  { return fAddr; }
+    inline size_t size() const          { return fSize; }
+
+    /* Checks that [offset, offset + size) is inside [0, limit) without overflow */
+    static bool InRange(uint64_t offset, uint64_t size, uint64_t limit)
+    {
+        return offset <= limit && size <= limit - offset;
+    }
+
+private:
+    uint8_t     *fAddr;
+    size_t       fSize;
+};
+
 template<typename T>
-T *cast_from_relative_locator(uint8_t *pBuffer, const cskp_relative_locator& locator)
+const T *cast_from_relative_locator(const uint8_t *pBuffer, uint64_t bufferSize,
+                                    const cskp_relative_locator& locator)
 {
-    if (locator.size != sizeof(T))
+    if (locator.size < sizeof(T) || !MappedFile::InRange(locator.offset, locator.size, bufferSize))
         return nullptr;
-    return static_cast<T*>(static_cast<void*>(pBuffer + locator.offset));
+    return reinterpret_cast<const T*>(pBuffer + locator.offset);
 }
 
 uint8_t cvt_algorithm_flag(SkpSnapshotCompress compress)
@@ -113,80 +237,493 @@ uint8_t cvt_algorithm_flag(SkpSnapshotCompress compress)
     case SkpSnapshotCompress::kRaw:
         return cskp_skp_data_section::COMPRESS_RAW;
     case SkpSnapshotCompress::kZlib:
-        return cskp_skp_data_section::COMPRESS_ZLIB;
+        return cskp_skp_data_section::COMPRESS_ZLIB_CHUNKED;
+    }
+    return cskp_skp_data_section::COMPRESS_RAW;
+}
+
+uint32_t adler32_of(const uint8_t *pData, uint64_t size)
+{
+    uLong adler = ::adler32(0L, Z_NULL, 0);
+    while (size > 0)
+    {
+        auto chunk = static_cast<uInt>(std::min<uint64_t>(size, std::numeric_limits<uInt>::max()));
+        adler = ::adler32(adler, pData, chunk);
+        pData += chunk;
+        size -= chunk;
+    }
+    return static_cast<uint32_t>(adler);
+}
+
+/* CRC32C (Castagnoli), reflected polynomial 0x82f63b78 */
+using Crc32cProc = uint32_t(*)(uint32_t crc, const uint8_t *pData, size_t size);
+
+constexpr std::array<uint32_t, 256> kCrc32cTable = []() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int32_t k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+        table[i] = crc;
+    }
+    return table;
+}();
+
+uint32_t crc32c_scalar(uint32_t crc, const uint8_t *pData, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        crc = (crc >> 8) ^ kCrc32cTable[(crc ^ pData[i]) & 0xff];
+    return crc;
+}
+
+#if defined(CIALLO_CRC32C_X86)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t *pData, size_t size)
+{
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; size >= 8; pData += 8, size -= 8)
+    {
+        uint64_t v;
+        std::memcpy(&v, pData, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = static_cast<uint32_t>(crc64);
+#endif
+    for (; size >= 4; pData += 4, size -= 4)
+    {
+        uint32_t v;
+        std::memcpy(&v, pData, sizeof(v));
+        crc = _mm_crc32_u32(crc, v);
     }
+    for (; size > 0; pData++, size--)
+        crc = _mm_crc32_u8(crc, *pData);
+    return crc;
+}
+#elif defined(CIALLO_CRC32C_ARM)
+uint32_t crc32c_arm(uint32_t crc, const uint8_t *pData, size_t size)
+{
+    for (; size >= 8; pData += 8, size -= 8)
+    {
+        uint64_t v;
+        std::memcpy(&v, pData, sizeof(v));
+        crc = __crc32cd(crc, v);
+    }
+    for (; size > 0; pData++, size--)
+        crc = __crc32cb(crc, *pData);
+    return crc;
+}
+#endif
+
+Crc32cProc select_crc32c()
+{
+#if defined(CIALLO_CRC32C_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        return crc32c_sse42;
+#elif defined(CIALLO_CRC32C_ARM)
+    return crc32c_arm;
+#endif
+    return crc32c_scalar;
 }
 
-size_t deflate_compress_data(const uint8_t *pSrc, uint8_t *pDst, size_t size, uint32_t& adler)
+uint32_t crc32c_of(const uint8_t *pData, size_t size)
 {
-    ::z_stream stream;
+    static const Crc32cProc proc = select_crc32c();
+    return ~proc(~0U, pData, size);
+}
+
+/* Shared by all the snapshots, so that loading many small files doesn't spawn threads */
+ThreadPool& snapshot_thread_pool()
+{
+    static ThreadPool pool("Snapshot", 0);
+    return pool;
+}
+
+/* Compresses a chunk as a raw deflate stream, or copies it if it doesn't shrink */
+bool deflate_chunk(const uint8_t *pSrc, uint32_t size, std::vector<uint8_t>& out)
+{
+    ::z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out.resize(deflateBound(&stream, size));
     stream.next_in = const_cast<uint8_t*>(pSrc);
     stream.avail_in = size;
+    stream.next_out = out.data();
+    stream.avail_out = static_cast<uInt>(out.size());
+    int err = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+
+    if (err != Z_STREAM_END)
+        return false;
+    if (stream.total_out >= size)
+        out.assign(pSrc, pSrc + size);
+    else
+        out.resize(stream.total_out);
+    return true;
+}
+
+bool inflate_chunk(const uint8_t *pSrc, const cskp_chunk& chunk, uint8_t *pDst)
+{
+    if (chunk.compressedSize == chunk.rawSize)
+    {
+        std::memcpy(pDst, pSrc, chunk.rawSize);
+        return true;
+    }
+
+    ::z_stream stream{};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return false;
+    stream.next_in = const_cast<uint8_t*>(pSrc);
+    stream.avail_in = chunk.compressedSize;
     stream.next_out = pDst;
-    stream.avail_out = size;
-    stream.zalloc = nullptr;
-    stream.zfree = nullptr;
-    stream.opaque = nullptr;
+    stream.avail_out = chunk.rawSize;
+    int err = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    return err == Z_STREAM_END && stream.total_out == chunk.rawSize;
+}
 
-    int err = 0;
-    err = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-                       MAX_WBITS + -1, 8, Z_DEFAULT_STRATEGY);
-    if (err != Z_OK)
+/**
+ * Compresses @a pSrc chunk by chunk in parallel. @a index is followed
+ * by @a chunks in the file, and the chunks are located in order.
+ */
+bool deflate_chunked_data(const uint8_t *pSrc, uint64_t size, std::vector<cskp_chunk>& index,
+                          std::vector<std::vector<uint8_t>>& chunks)
+{
+    auto count = static_cast<uint32_t>((size + kChunkSize - 1) / kChunkSize);
+    index.resize(count);
+    chunks.resize(count);
+
+    std::atomic<bool> failed(false);
+    snapshot_thread_pool().parallelFor(static_cast<int32_t>(count), [&](int32_t i) {
+        cskp_chunk& chunk = index[i];
+        chunk.rawOffset = static_cast<uint64_t>(i) * kChunkSize;
+        chunk.rawSize = static_cast<uint32_t>(std::min<uint64_t>(kChunkSize, size - chunk.rawOffset));
+        chunk.rawCrc32c = crc32c_of(pSrc + chunk.rawOffset, chunk.rawSize);
+        if (!deflate_chunk(pSrc + chunk.rawOffset, chunk.rawSize, chunks[i]))
+            failed = true;
+        chunk.compressedSize = static_cast<uint32_t>(chunks[i].size());
+    });
+    if (failed)
+        return false;
+
+    uint64_t offset = 0;
+    for (cskp_chunk& chunk : index)
     {
-        deflateEnd(&stream);
-        return 0;
+        chunk.offset = offset;
+        offset += chunk.compressedSize;
     }
+    return true;
+}
 
-    err = deflate(&stream, Z_FINISH);
-    deflateEnd(&stream);
-    if (err != Z_STREAM_END)
-        return 0;
+/* Decompresses and verifies all the chunks into @a pDst in parallel */
+bool inflate_chunked_data(const uint8_t *pSrc, uint64_t srcSize, uint8_t *pDst, uint64_t dstSize)
+{
+    if (srcSize < sizeof(cskp_chunk_index))
+        return false;
+    const auto *index = reinterpret_cast<const cskp_chunk_index*>(pSrc);
+    uint64_t indexSize = sizeof(cskp_chunk_index) + static_cast<uint64_t>(index->chunkCount) * sizeof(cskp_chunk);
+    if (indexSize > srcSize)
+        return false;
 
-    adler = stream.adler;
-    return stream.total_out;
+    /* Chunks must cover the whole picture without overlapping */
+    const uint8_t *pChunks = pSrc + indexSize;
+    uint64_t chunksSize = srcSize - indexSize;
+    uint64_t rawOffset = 0;
+    for (uint32_t i = 0; i < index->chunkCount; i++)
+    {
+        const cskp_chunk& chunk = index->chunks[i];
+        if (chunk.rawOffset != rawOffset || chunk.rawSize > kChunkSize
+            || chunk.compressedSize > chunk.rawSize
+            || !MappedFile::InRange(chunk.offset, chunk.compressedSize, chunksSize))
+            return false;
+        rawOffset += chunk.rawSize;
+    }
+    if (rawOffset != dstSize)
+        return false;
+
+    std::atomic<bool> failed(false);
+    snapshot_thread_pool().parallelFor(static_cast<int32_t>(index->chunkCount), [&](int32_t i) {
+        const cskp_chunk& chunk = index->chunks[i];
+        uint8_t *pOut = pDst + chunk.rawOffset;
+        if (!inflate_chunk(pChunks + chunk.offset, chunk, pOut)
+            || crc32c_of(pOut, chunk.rawSize) != chunk.rawCrc32c)
+            failed = true;
+    });
+    return !failed;
 }
 
-size_t process_skp_data(const std::unique_ptr<uint8_t>& out, const sk_sp<SkData>& in,
-                        SkpSnapshotCompress compress,
-                        uint32_t& adler32)
+/* Inflates the whole compressed data into @a pDst, which has exactly @a dstSize bytes */
+bool inflate_data(const uint8_t *pSrc, uint64_t srcSize, uint8_t *pDst, uint64_t dstSize)
 {
+    ::z_stream stream{};
+    if (inflateInit(&stream) != Z_OK)
+        return false;
+
+    stream.next_in = const_cast<uint8_t*>(pSrc);
+    stream.next_out = pDst;
+    uint64_t inLeft = srcSize, outLeft = dstSize;
+    int err;
+    do
+    {
+        if (stream.avail_in == 0)
+        {
+            stream.avail_in = static_cast<uInt>(std::min<uint64_t>(inLeft, std::numeric_limits<uInt>::max()));
+            inLeft -= stream.avail_in;
+        }
+        if (stream.avail_out == 0)
+        {
+            stream.avail_out = static_cast<uInt>(std::min<uint64_t>(outLeft, std::numeric_limits<uInt>::max()));
+            outLeft -= stream.avail_out;
+        }
+        err = inflate(&stream, Z_NO_FLUSH);
+    } while (err == Z_OK);
+    inflateEnd(&stream);
+
+    /* zlib verifies adler32 of the inflated data itself */
+    return err == Z_STREAM_END && stream.total_out == dstSize;
+}
+
+template<typename T>
+void write_pod(std::ofstream& fs, const T& value)
+{
+    fs.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+/* Strings are located relative to @a pSection, which begins with the kind of section */
+bool load_metadata(const uint8_t *pSection, uint64_t size, SkpSnapshotMetadata *metadata)
+{
+    const auto *sec = reinterpret_cast<const cskp_metadata_section*>(pSection + kSectionKindSize);
+    if (size < kSectionKindSize + sizeof(cskp_metadata_section) ||
+        !MappedFile::InRange(sec->pictNameLocator.offset, sec->pictNameLocator.size, size) ||
+        !MappedFile::InRange(sec->packagerNameLocator.offset, sec->packagerNameLocator.size, size))
+        return false;
+
+    if (metadata != nullptr)
+    {
+        metadata->timestamp = sec->timestamp;
+        metadata->pictureName.assign(reinterpret_cast<const char*>(pSection + sec->pictNameLocator.offset),
+                                     sec->pictNameLocator.size);
+        metadata->packagerName.assign(reinterpret_cast<const char*>(pSection + sec->packagerNameLocator.offset),
+                                      sec->packagerNameLocator.size);
+    }
+    return true;
+}
+
+bool check_resources(const uint8_t *pSection, uint64_t size)
+{
+    if (size < sizeof(cskp_resources_section))
+        return false;
+
+    const auto *sec = reinterpret_cast<const cskp_resources_section*>(pSection);
+    uint64_t offset = sizeof(cskp_resources_section);
+    for (uint32_t i = 0; i < sec->resourceCount; i++)
+    {
+        if (!MappedFile::InRange(offset, sizeof(cskp_resource), size))
+            return false;
+        const auto *res = reinterpret_cast<const cskp_resource*>(pSection + offset);
+        if (res->type > cskp_resource::QWORD_TYPE)
+            return false;
+        uint64_t valuesSize = static_cast<uint64_t>(res->count) << res->type;
+        offset += sizeof(cskp_resource);
+        if (!MappedFile::InRange(offset, valuesSize, size))
+            return false;
+        offset += valuesSize;
+    }
+    return true;
+}
+
+sk_sp<SkPicture> load_skp_data(const uint8_t *pSection, uint64_t size)
+{
+    const auto *sec = reinterpret_cast<const cskp_skp_data_section*>(pSection);
+    if (size < sizeof(cskp_skp_data_section) || sec->dataSize > size - sizeof(cskp_skp_data_section))
+        return nullptr;
+
+    sk_sp<SkData> data;
+    switch (sec->algorithm)
+    {
+    case cskp_skp_data_section::COMPRESS_RAW:
+        if (sec->rawSize != sec->dataSize || adler32_of(sec->data, sec->dataSize) != sec->dataAdler32)
+            return nullptr;
+        /* A view of the mapping, SkPicture copies what it keeps while deserializing */
+        data = SkData::MakeWithoutCopy(sec->data, sec->dataSize);
+        break;
+
+    case cskp_skp_data_section::COMPRESS_ZLIB:
+        data = SkData::MakeUninitialized(sec->rawSize);
+        if (!inflate_data(sec->data, sec->dataSize,
+                          static_cast<uint8_t*>(data->writable_data()), sec->rawSize))
+            return nullptr;
+        break;
+
+    case cskp_skp_data_section::COMPRESS_ZLIB_CHUNKED:
+        data = SkData::MakeUninitialized(sec->rawSize);
+        if (!inflate_chunked_data(sec->data, sec->dataSize,
+                                  static_cast<uint8_t*>(data->writable_data()), sec->rawSize))
+            return nullptr;
+        break;
+
+    default:
+        return nullptr;
+    }
+
+    return SkPicture::MakeFromData(data.get());
 }
 
 } // namespace anonymous
 
 bool SkpSnapshotWriteToFile(const sk_sp<SkPicture>& picture, const std::string& path,
-                            SkpSnapshotCompress compress)
+                            SkpSnapshotCompress compress,
+                            const SkpSnapshotMetadata& metadata)
 {
     if (picture == nullptr)
         return false;
 
-    std::ofstream fs(path);
-    if (!fs.is_open())
-        return false;
-
     sk_sp<SkData> rawData(picture->serialize());
     if (rawData == nullptr || rawData->size() == 0)
         return false;
+    const auto *rawBytes = static_cast<const uint8_t*>(rawData->data());
 
     cskp_skp_data_section skpDataSec{};
     skpDataSec.algorithm = cvt_algorithm_flag(compress);
-    std::unique_ptr<uint8_t> skpDataBuffer(new uint8_t[rawData->size()]);
-    skpDataSec.dataSize = process_skp_data(skpDataBuffer, rawData, compress, skpDataSec.dataAdler32);
-    if (skpDataSec.dataSize == 0)
+    skpDataSec.rawSize = rawData->size();
+    skpDataSec.dataSize = rawData->size();
+
+    cskp_chunk_index chunkIndex{};
+    std::vector<cskp_chunk> chunks;
+    std::vector<std::vector<uint8_t>> compressedChunks;
+    if (compress == SkpSnapshotCompress::kZlib)
+    {
+        if (!deflate_chunked_data(rawBytes, rawData->size(), chunks, compressedChunks))
+            return false;
+        chunkIndex.chunkCount = static_cast<uint32_t>(chunks.size());
+        skpDataSec.dataSize = sizeof(cskp_chunk_index) + chunks.size() * sizeof(cskp_chunk);
+        for (const auto& chunk : compressedChunks)
+            skpDataSec.dataSize += chunk.size();
+    }
+    else
+    {
+        skpDataSec.dataAdler32 = adler32_of(rawBytes, rawData->size());
+    }
+
+    cskp_metadata_section metadataSec{};
+    metadataSec.timestamp = metadata.timestamp ? metadata.timestamp : std::time(nullptr);
+    metadataSec.pictNameLocator.offset = kSectionKindSize + sizeof(cskp_metadata_section);
+    metadataSec.pictNameLocator.size = metadata.pictureName.size();
+    metadataSec.packagerNameLocator.offset = metadataSec.pictNameLocator.offset
+                                             + metadataSec.pictNameLocator.size;
+    metadataSec.packagerNameLocator.size = metadata.packagerName.size();
+
+    cskp_resources_section resourcesSec{};
+    resourcesSec.resourceCount = 0;
+
+    cskp_header hdr{};
+    std::memcpy(hdr.magic, CSKP_HDR_MAGIC, sizeof(CSKP_HDR_MAGIC) - 1);
+    hdr.version = CSKP_HDR_VERSION;
+    hdr.sectionCount = kSectionCount;
+
+    cskp_relative_locator locators[kSectionCount];
+    locators[0].offset = sizeof(cskp_header) + sizeof(locators);
+    locators[0].size = metadataSec.packagerNameLocator.offset + metadataSec.packagerNameLocator.size;
+    locators[1].offset = locators[0].offset + locators[0].size;
+    locators[1].size = kSectionKindSize + sizeof(cskp_resources_section);
+    locators[2].offset = locators[1].offset + locators[1].size;
+    locators[2].size = kSectionKindSize + sizeof(cskp_skp_data_section) + skpDataSec.dataSize;
+
+    std::ofstream fs(path, std::ios::binary | std::ios::trunc);
+    if (!fs.is_open())
         return false;
 
-    constexpr uint64_t hdrSize = sizeof(cskp_header) + 3 * sizeof(cskp_relative_locator);
-    std::unique_ptr<cskp_header> hdr(reinterpret_cast<cskp_header*>(new uint8_t[hdrSize]));
-    std::strncpy(reinterpret_cast<char*>(hdr->magic), CSKP_HDR_MAGIC, 8);
-    hdr->version = CSKP_HDR_VERSION;
-    hdr->sectionCount = 3;
+    write_pod(fs, hdr);
+    write_pod(fs, locators);
+
+    write_pod(fs, static_cast<uint8_t>(cskp_section::CSKP_SEC_METADATA));
+    write_pod(fs, metadataSec);
+    fs.write(metadata.pictureName.data(), static_cast<std::streamsize>(metadata.pictureName.size()));
+    fs.write(metadata.packagerName.data(), static_cast<std::streamsize>(metadata.packagerName.size()));
 
-    cskp_metadata_section metadata{};
-    metadata.timestamp = std::time(nullptr);
+    write_pod(fs, static_cast<uint8_t>(cskp_section::CSKP_SEC_RESOURCES));
+    write_pod(fs, resourcesSec);
+
+    write_pod(fs, static_cast<uint8_t>(cskp_section::CSKP_SEC_SKP_DATA));
+    write_pod(fs, skpDataSec);
+    if (compress == SkpSnapshotCompress::kZlib)
+    {
+        write_pod(fs, chunkIndex);
+        fs.write(reinterpret_cast<const char*>(chunks.data()),
+                 static_cast<std::streamsize>(chunks.size() * sizeof(cskp_chunk)));
+        for (const auto& chunk : compressedChunks)
+            fs.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+    }
+    else
+    {
+        fs.write(reinterpret_cast<const char*>(rawBytes), static_cast<std::streamsize>(skpDataSec.dataSize));
+    }
+
+    fs.close();
+    return fs.good();
 }
 
-sk_sp<SkPicture> SkpSnapshotLoad(const std::string& path)
+sk_sp<SkPicture> SkpSnapshotLoad(const std::string& path, SkpSnapshotMetadata *metadata)
 {
+    MappedFile file(path);
+    if (file.data() == nullptr)
+    {
+        log_write(LOG_ERROR) << "Failed to map CSKP file " << path << log_endl;
+        return nullptr;
+    }
+
+    const auto *hdr = reinterpret_cast<const cskp_header*>(file.data());
+    if (file.size() < sizeof(cskp_header)
+        || std::memcmp(hdr->magic, CSKP_HDR_MAGIC, sizeof(CSKP_HDR_MAGIC) - 1) != 0
+        || hdr->version != CSKP_HDR_VERSION
+        || !MappedFile::InRange(sizeof(cskp_header),
+                                static_cast<uint64_t>(hdr->sectionCount) * sizeof(cskp_relative_locator),
+                                file.size()))
+    {
+        log_write(LOG_ERROR) << "Not a CSKP file or unsupported version: " << path << log_endl;
+        return nullptr;
+    }
+
+    sk_sp<SkPicture> picture;
+    for (uint32_t i = 0; i < hdr->sectionCount; i++)
+    {
+        const auto *sec = cast_from_relative_locator<uint8_t>(file.data(), file.size(), hdr->sections[i]);
+        if (sec == nullptr)
+            break;
+
+        const uint8_t *content = sec + kSectionKindSize;
+        uint64_t contentSize = hdr->sections[i].size - kSectionKindSize;
+        bool ok = true;
+        switch (*sec)
+        {
+        case cskp_section::CSKP_SEC_METADATA:
+            ok = load_metadata(sec, hdr->sections[i].size, metadata);
+            break;
+        case cskp_section::CSKP_SEC_RESOURCES:
+            ok = check_resources(content, contentSize);
+            break;
+        case cskp_section::CSKP_SEC_SKP_DATA:
+            picture = load_skp_data(content, contentSize);
+            ok = picture != nullptr;
+            break;
+        default:
+            /* Unknown sections are skipped for compatibility */
+            break;
+        }
+        if (!ok)
+        {
+            log_write(LOG_ERROR) << "Corrupted section #" << i << " in CSKP file " << path << log_endl;
+            return nullptr;
+        }
+    }
+
+    if (picture == nullptr)
+        log_write(LOG_ERROR) << "No picture in CSKP file " << path << log_endl;
+    return picture;
 }
 
 CIALLO_END_NS
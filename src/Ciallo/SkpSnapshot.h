@@ -15,9 +15,30 @@ enum class SkpSnapshotCompress
     kZlib
 };
 
-sk_sp<SkPicture> SkpSnapshotLoad(const std::string& path);
+struct SkpSnapshotMetadata
+{
+    /* Seconds since epoch, 0 means the time of writing */
+    uint64_t        timestamp = 0;
+    std::string     pictureName;
+    std::string     packagerName;
+};
+
+/**
+ * @brief Loads a picture from a CSKP file.
+ *
+ * The file is mapped into memory. A raw picture is deserialized from
+ * the mapping directly, and the chunks of a compressed one are inflated
+ * from the mapping into a single buffer in parallel.
+ *
+ * @param metadata: Filled with the metadata section if not nullptr.
+ * @return nullptr if the file can't be read or is corrupted.
+ */
+sk_sp<SkPicture> SkpSnapshotLoad(const std::string& path,
+                                 SkpSnapshotMetadata *metadata = nullptr);
+
 bool SkpSnapshotWriteToFile(const sk_sp<SkPicture>& picture, const std::string& path,
-                            SkpSnapshotCompress compress);
+                            SkpSnapshotCompress compress,
+                            const SkpSnapshotMetadata& metadata = SkpSnapshotMetadata());
 
 CIALLO_END_NS
 #endif //COCOA_SKPSNAPSHOT_H
@@ -29,7 +29,8 @@ void Thread::Fence::signal()
 {
     std::scoped_lock<std::mutex> scopedLock(fMutex);
     fCount++;
-    fCondition.notify_one();
+    /* Several threads may wait for the same fence */
+    fCondition.notify_all();
 }
 
 // --------------------------------------------------------------
@@ -129,7 +130,8 @@ void Thread::thread_worker_entry()
             fQueueMutex.unlock();
 
             status = cmdExecute(currentTask);
-            currentTask.notifyFinish();
+            if (status != CmdExecuteResult::kDeferredFinish)
+                currentTask.notifyFinish();
         }
     }
 
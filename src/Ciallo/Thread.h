@@ -27,7 +27,9 @@ public:
     enum class CmdExecuteResult
     {
         kNormal,
-        kStopExecution
+        kStopExecution,
+        /* Worker signals the fence of command by itself later */
+        kDeferredFinish
     };
     
     class Fence
@@ -66,7 +68,7 @@ public:
         inline const Poco::Dynamic::Var& userdata() const
         { return fUserdata; }
 
-        inline std::shared_ptr<Fence> fence()
+        inline std::shared_ptr<Fence> fence() const
         { return fFence; }
 
         void notifyFinish();
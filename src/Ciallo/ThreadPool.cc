@@ -0,0 +1,127 @@
+#include <pthread.h>
+
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+
+#include "Ciallo/ThreadPool.h"
+CIALLO_BEGIN_NS
+
+ThreadPool::ThreadPool(const std::string& name, int32_t threads)
+    : fName(name),
+      fExiting(false)
+{
+    if (threads <= 0)
+        threads = static_cast<int32_t>(std::thread::hardware_concurrency());
+    if (threads <= 0)
+        threads = 1;
+
+    for (int32_t i = 0; i < threads; i++)
+        fThreads.emplace_back(&ThreadPool::workerEntry, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::scoped_lock<std::mutex> scopedLock(fQueueMutex);
+        fExiting = true;
+    }
+    fQueueCondition.notify_all();
+
+    for (std::thread& thread : fThreads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+}
+
+std::shared_ptr<Thread::Fence> ThreadPool::enqueue(Task task)
+{
+    auto fence = std::make_shared<Thread::Fence>();
+    post([task = std::move(task), fence]() {
+        task();
+        fence->signal();
+    });
+    return fence;
+}
+
+void ThreadPool::post(Task task)
+{
+    {
+        std::scoped_lock<std::mutex> scopedLock(fQueueMutex);
+        fTasks.push(std::move(task));
+    }
+    fQueueCondition.notify_one();
+}
+
+void ThreadPool::parallelFor(int32_t count, const std::function<void(int32_t)>& func)
+{
+    if (count <= 0)
+        return;
+
+    std::atomic<int32_t> next(0);
+    std::exception_ptr exception;
+    std::mutex exceptionMutex;
+
+    auto body = [&]() {
+        int32_t i;
+        while ((i = next.fetch_add(1)) < count)
+        {
+            try
+            {
+                func(i);
+            }
+            catch (...)
+            {
+                std::scoped_lock<std::mutex> scopedLock(exceptionMutex);
+                if (!exception)
+                    exception = std::current_exception();
+                /* Skip remaining work */
+                next.store(count);
+            }
+        }
+    };
+
+    int32_t helpers = std::min(size(), count - 1);
+    std::vector<std::shared_ptr<Thread::Fence>> fences;
+    for (int32_t i = 0; i < helpers; i++)
+        fences.push_back(enqueue(body));
+
+    body();
+    for (auto& fence : fences)
+        fence->wait();
+
+    if (exception)
+        std::rethrow_exception(exception);
+}
+
+void ThreadPool::workerEntry(int32_t index)
+{
+    std::string name = fName + "#" + std::to_string(index);
+    /* Length of thread name is restricted to 16 characters */
+    if (name.length() > 15)
+        name.resize(15);
+    pthread_setname_np(pthread_self(), name.c_str());
+
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> scopedLock(fQueueMutex);
+            fQueueCondition.wait(scopedLock, [this]() {
+                return fExiting || !fTasks.empty();
+            });
+            if (fExiting && fTasks.empty())
+                return;
+
+            task = std::move(fTasks.front());
+            fTasks.pop();
+        }
+        task();
+    }
+}
+
+CIALLO_END_NS
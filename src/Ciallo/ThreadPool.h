@@ -0,0 +1,71 @@
+#ifndef COCOA_THREADPOOL_H
+#define COCOA_THREADPOOL_H
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+#include "Ciallo/GrBase.h"
+#include "Ciallo/Thread.h"
+CIALLO_BEGIN_NS
+
+/**
+ * ThreadPool runs independent tasks on a fixed number of worker
+ * threads. Unlike Thread, tasks are plain closures and may run
+ * in any order and on any worker.
+ */
+class ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * @param name: Prefix of worker threads' name.
+     * @param threads: Number of workers, 0 means the number of CPU cores.
+     */
+    ThreadPool(const std::string& name, int32_t threads);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    inline int32_t size() const
+    { return static_cast<int32_t>(fThreads.size()); }
+
+    /* The returned fence will be signaled after the task finished */
+    std::shared_ptr<Thread::Fence> enqueue(Task task);
+
+    /**
+     * Runs a task without a fence, the caller tracks completion by itself.
+     * A task which only captures a pointer doesn't allocate memory.
+     */
+    void post(Task task);
+
+    /**
+     * @brief Calls @a func with indices [0, count) in parallel and
+     *        waits until all of them finished.
+     *
+     * The calling thread also takes part in the work. If any call
+     * throws an exception, the first one will be rethrown after
+     * all the workers stopped.
+     */
+    void parallelFor(int32_t count, const std::function<void(int32_t)>& func);
+
+private:
+    void workerEntry(int32_t index);
+
+private:
+    std::string                 fName;
+    std::vector<std::thread>    fThreads;
+    std::mutex                  fQueueMutex;
+    std::condition_variable     fQueueCondition;
+    std::queue<Task>            fTasks;
+    bool                        fExiting;
+};
+
+CIALLO_END_NS
+#endif //COCOA_THREADPOOL_H
@@ -1,6 +1,9 @@
 #include <pthread.h>
 #include <xcb/xcb.h>
 
+#include <cstdlib>
+#include <string>
+
 #include "Core/PropertyTree.h"
 #include "Core/Journal.h"
 #include "Ciallo/DDR/GrXcbPlatform.h"
@@ -10,6 +13,18 @@ CIALLO_BEGIN_NS
 
 namespace {
 
+/* "<cache>" refers to the per-user cache directory */
+std::string ResolveCacheDir(const std::string& value)
+{
+    if (value != "<cache>")
+        return value;
+    if (char const *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        return std::string(xdg) + "/cocoa/opencl";
+    if (char const *home = std::getenv("HOME"); home && *home)
+        return std::string(home) + "/.cache/cocoa/opencl";
+    return "";
+}
+
 void PopulatePlatformOptions(GrPlatformOptions& opts)
 {
     opts.vulkan_debug = PropertyTree::Instance()->asNode("/runtime/features/enableGpuDebugJournal")
@@ -20,6 +35,33 @@ void PopulatePlatformOptions(GrPlatformOptions& opts)
                                 ->cast<PropertyTreeDataNode>()->extract<bool>();
     opts.use_opencl_accel = PropertyTree::Instance()->asNode("/runtime/features/useOpenCl")
                                 ->cast<PropertyTreeDataNode>()->extract<bool>();
+    if (auto *node = PropertyTree::Instance()->asNode("/runtime/features/openClBinaryCacheDir"))
+    {
+        opts.opencl_binary_cache_dir = ResolveCacheDir(node->cast<PropertyTreeDataNode>()
+                                                           ->extract<std::string>());
+    }
+    opts.cpu_tiled_composite = PropertyTree::Instance()->asNode("/runtime/features/useTiledCpuComposite")
+                                ->cast<PropertyTreeDataNode>()->extract<bool>();
+    opts.cpu_tile_size = PropertyTree::Instance()->asNode("/runtime/features/cpuCompositeTileSize")
+                                ->cast<PropertyTreeDataNode>()->extract<long>();
+    opts.cpu_composite_threads = PropertyTree::Instance()->asNode("/runtime/features/cpuCompositeThreads")
+                                ->cast<PropertyTreeDataNode>()->extract<long>();
+    opts.cpu_tiled_raster = PropertyTree::Instance()->asNode("/runtime/features/useTiledCpuRaster")
+                                ->cast<PropertyTreeDataNode>()->extract<bool>();
+    opts.cpu_raster_tile_size = PropertyTree::Instance()->asNode("/runtime/features/cpuRasterTileSize")
+                                ->cast<PropertyTreeDataNode>()->extract<long>();
+    opts.raster_threads = PropertyTree::Instance()->asNode("/runtime/features/rasterThreads")
+                                ->cast<PropertyTreeDataNode>()->extract<long>();
+    opts.raster_cache_budget = PropertyTree::Instance()->asNode("/runtime/features/rasterCacheBudgetMB")
+                                ->cast<PropertyTreeDataNode>()->extract<long>() << 20;
+    opts.raster_cache_stable_frames = PropertyTree::Instance()->asNode("/runtime/features/rasterCacheStableFrames")
+                                ->cast<PropertyTreeDataNode>()->extract<long>();
+    opts.zero_copy_present = PropertyTree::Instance()->asNode("/runtime/features/useZeroCopyPresent")
+                                ->cast<PropertyTreeDataNode>()->extract<bool>();
+    opts.xcb_use_shm = PropertyTree::Instance()->asNode("/runtime/features/useXcbSharedMemory")
+                                ->cast<PropertyTreeDataNode>()->extract<bool>();
+    if (auto *node = PropertyTree::Instance()->asNode("/runtime/features/frameCaptureDir"))
+        opts.frame_capture_dir = node->cast<PropertyTreeDataNode>()->extract<std::string>();
 
     /* TODO: Support OpenCL platform and device keyword */
 }
@@ -140,7 +182,13 @@ XCBWindow::EventResponse XCBWindow::threadHandleExpose(xcb_expose_event_t *ev)
     {
         /* Here we must wait until the composition is done. */
         GContext()->emitCmdPresent()->wait();
-        GContext()->asPlatform()->expose();
+
+        /* Synthetic events are sent by onWindowExpose() to display new frames,
+           others mean that the window system lost some contents of window. */
+        SkIRect exposed = SkIRect::MakeEmpty();
+        if (!(ev->response_type & 0x80))
+            exposed = SkIRect::MakeXYWH(ev->x, ev->y, ev->width, ev->height);
+        GContext()->asPlatform()->expose(exposed);
     }
     return EventResponse::kNormal;
 }
@@ -0,0 +1,367 @@
+/**
+ * Micro-benchmark of compositors. It runs on GrHeadlessPlatform and
+ * sweeps layer count, layer size, dirty ratio (area of the changed
+ * rectangle in each layer per frame), visible ratio of layers and
+ * backend. Results are written as JSON.
+ *
+ * Usage: ciallo_bench [options]
+ *   --frames <n>              Measured frames of each case (default 200)
+ *   --warmup <n>              Frames before measuring (default 20)
+ *   --size <w>x<h>            Size of frame (default 1920x1080), layer sizes larger
+ *                             than the shorter side are clamped to it
+ *   --backends <list>         Comma separated, cpu,cpu-tiled,cpu-tiled-raster,opencl
+ *                             (default cpu,opencl)
+ *   --opencl-platform <kw>    Keyword of OpenCL platform, "Portable" selects pocl
+ *   --opencl-device <kw>      Keyword of OpenCL device
+ *   --updates-per-present <n> Times each layer is updated before a frame is presented,
+ *                             submissions replaced before presenting are reported as
+ *                             "dropped_frames" (default 1)
+ *   --presents-per-expose <n> Frames presented before one is exposed, frames which are
+ *                             never exposed are reported as "skipped_frames" (default 1)
+ *   --output <file>           Write JSON into file instead of stdout
+ */
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Poco/JSON/Object.h>
+#include <Poco/JSON/Array.h>
+
+#include "include/core/SkCanvas.h"
+#include "include/core/SkPaint.h"
+#include "include/core/SkPicture.h"
+#include "include/core/SkPictureRecorder.h"
+
+#include "Core/Journal.h"
+#include "Core/Exception.h"
+#include "Ciallo/DDR/GrBaseCompositor.h"
+#include "Ciallo/DDR/GrBaseRenderLayer.h"
+#include "Ciallo/DDR/GrBasePlatform.h"
+#include "Ciallo/DDR/GrHeadlessPlatform.h"
+#include "Ciallo/DDR/GrOpenCLCompositor.h"
+
+using namespace cocoa;
+using namespace cocoa::ciallo;
+
+namespace {
+
+struct BenchOptions
+{
+    int32_t frames = 200;
+    int32_t warmup = 20;
+    int32_t width = 1920;
+    int32_t height = 1080;
+    std::vector<std::string> backends = { "cpu", "opencl" };
+    std::string openclPlatform;
+    std::string openclDevice;
+    int32_t updatesPerPresent = 1;
+    int32_t presentsPerExpose = 1;
+    std::string output;
+};
+
+struct BenchCase
+{
+    std::string backend;
+    int32_t layers;
+    int32_t layerSize;
+    double dirtyRatio;
+    double visibleRatio;
+};
+
+std::vector<std::string> split(const std::string& str, char delim)
+{
+    std::vector<std::string> result;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, delim))
+    {
+        if (!item.empty())
+            result.push_back(item);
+    }
+    return result;
+}
+
+bool parse_options(int argc, char const **argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value of " << arg << std::endl;
+            return false;
+        }
+
+        std::string value(argv[++i]);
+        if (arg == "--frames")
+            options.frames = std::atoi(value.c_str());
+        else if (arg == "--warmup")
+            options.warmup = std::atoi(value.c_str());
+        else if (arg == "--size")
+        {
+            if (std::sscanf(value.c_str(), "%dx%d", &options.width, &options.height) != 2)
+            {
+                std::cerr << "Invalid size: " << value << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--backends")
+            options.backends = split(value, ',');
+        else if (arg == "--opencl-platform")
+            options.openclPlatform = value;
+        else if (arg == "--opencl-device")
+            options.openclDevice = value;
+        else if (arg == "--updates-per-present")
+            options.updatesPerPresent = std::atoi(value.c_str());
+        else if (arg == "--presents-per-expose")
+            options.presentsPerExpose = std::atoi(value.c_str());
+        else if (arg == "--output")
+            options.output = value;
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return options.frames > 0 && options.warmup >= 0
+           && options.width > 0 && options.height > 0
+           && options.updatesPerPresent > 0 && options.presentsPerExpose > 0;
+}
+
+sk_sp<SkPicture> make_dirty_picture(int32_t size, SkColor color)
+{
+    SkPictureRecorder recorder;
+    SkCanvas *canvas = recorder.beginRecording(SkRect::MakeWH(size, size));
+
+    SkPaint paint;
+    paint.setAntiAlias(true);
+    paint.setColor(color);
+    canvas->clear(SkColorSetA(color, 0x80));
+    canvas->drawCircle(size / 2.0f, size / 2.0f, size / 3.0f, paint);
+    return recorder.finishRecordingAsPicture();
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    auto index = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::clamp<size_t>(index, 1, sorted.size()) - 1];
+}
+
+Poco::JSON::Object::Ptr run_case(const BenchOptions& options, const BenchCase& c)
+{
+    Poco::JSON::Object::Ptr result = new Poco::JSON::Object();
+    result->set("backend", c.backend);
+    result->set("layers", c.layers);
+    result->set("layer_size", c.layerSize);
+    result->set("dirty_ratio", c.dirtyRatio);
+    result->set("visible_ratio", c.visibleRatio);
+
+    GrPlatformOptions platformOptions;
+    platformOptions.use_gpu_accel = false;
+    platformOptions.use_opencl_accel = (c.backend == "opencl");
+    platformOptions.use_strict_accel = true;
+    platformOptions.opencl_platform_keyword = options.openclPlatform;
+    platformOptions.opencl_device_keyword = options.openclDevice;
+    platformOptions.cpu_tiled_composite = (c.backend == "cpu-tiled");
+    platformOptions.cpu_tiled_raster = (c.backend == "cpu-tiled-raster");
+
+    auto platform = GrHeadlessPlatform::MakeHeadless(options.width, options.height,
+                                                     GrColorFormat::kColor_BGRA_8888,
+                                                     platformOptions);
+    std::shared_ptr<GrBaseCompositor> compositor = platform->compositor();
+    if (compositor == nullptr)
+    {
+        result->set("error", "Backend is unavailable");
+        return result;
+    }
+    result->set("device", compositor->getDeviceName());
+
+    /* Layers are spread diagonally over the frame and overlap each other */
+    std::vector<std::shared_ptr<GrBaseRenderLayer>> layers;
+    int32_t visibleLayers = static_cast<int32_t>(std::lround(c.layers * c.visibleRatio));
+    int32_t spanX = std::max(options.width - c.layerSize, 0);
+    int32_t spanY = std::max(options.height - c.layerSize, 0);
+    for (int32_t i = 0; i < c.layers; i++)
+    {
+        int32_t left = c.layers > 1 ? spanX * i / (c.layers - 1) : 0;
+        int32_t top = c.layers > 1 ? spanY * i / (c.layers - 1) : 0;
+        auto layer = compositor->newRenderLayer(c.layerSize, c.layerSize, left, top, i);
+        layer->setVisibility(i < visibleLayers);
+        layers.push_back(layer);
+    }
+
+    int32_t dirtySize = std::max(1, static_cast<int32_t>(std::lround(c.layerSize * std::sqrt(c.dirtyRatio))));
+    sk_sp<SkPicture> pictures[2] = {
+        make_dirty_picture(dirtySize, SK_ColorRED),
+        make_dirty_picture(dirtySize, SK_ColorBLUE)
+    };
+
+    /* Layers are fully drawn once, so that the first measured frame is not special */
+    sk_sp<SkPicture> background = make_dirty_picture(c.layerSize, SK_ColorGREEN);
+    for (auto& layer : layers)
+    {
+        layer->paint(background, 0, 0);
+        layer->update();
+    }
+    compositor->present();
+    compositor->waitForPublished();
+    platform->expose();
+
+    std::vector<double> frameTimes;
+    frameTimes.reserve(options.frames);
+    int64_t dirtyPixels = 0;
+    int64_t droppedBefore = compositor->droppedFrames();
+    uint64_t skippedBefore = platform->skippedFrames();
+    int32_t moveRange = c.layerSize - dirtySize;
+
+    for (int32_t frame = 0; frame < options.warmup + options.frames; frame++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int32_t update = 0; update < options.updatesPerPresent; update++)
+        {
+            int32_t step = frame * options.updatesPerPresent + update;
+            for (size_t i = 0; i < layers.size(); i++)
+            {
+                /* Dirty rectangle moves inside the layer update by update */
+                int32_t offset = moveRange > 0 ? (step * 7 + static_cast<int32_t>(i) * 13) % (moveRange + 1) : 0;
+                layers[i]->paint(pictures[step & 1], offset, offset);
+                layers[i]->update();
+            }
+        }
+        compositor->present();
+        /* Frame time includes the asynchronous readback of OpenCL compositor */
+        compositor->waitForPublished();
+        if ((frame + 1) % options.presentsPerExpose == 0)
+            platform->expose();
+        auto end = std::chrono::steady_clock::now();
+
+        if (frame < options.warmup)
+            continue;
+        frameTimes.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        dirtyPixels += static_cast<int64_t>(dirtySize) * dirtySize * visibleLayers * options.updatesPerPresent;
+    }
+
+    double total = 0;
+    for (double t : frameTimes)
+        total += t;
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+    Poco::JSON::Object::Ptr frameTime = new Poco::JSON::Object();
+    frameTime->set("mean", total / frameTimes.size());
+    frameTime->set("p50", percentile(frameTimes, 50));
+    frameTime->set("p90", percentile(frameTimes, 90));
+    frameTime->set("p99", percentile(frameTimes, 99));
+    frameTime->set("max", frameTimes.back());
+    result->set("frame_time_us", frameTime);
+    result->set("dirty_pixels_per_second", dirtyPixels / (total / 1e6));
+    /* Both are zero if every update is presented and every frame is exposed */
+    result->set("dropped_frames", compositor->droppedFrames() - droppedBefore);
+    result->set("skipped_frames", platform->skippedFrames() - skippedBefore);
+
+    auto clCompositor = std::dynamic_pointer_cast<GrOpenCLCompositor>(compositor);
+    if (clCompositor != nullptr)
+    {
+        ClReadbackStats stats = clCompositor->readbackStats();
+        Poco::JSON::Object::Ptr readback = new Poco::JSON::Object();
+        readback->set("frames", stats.fFrames);
+        readback->set("mean_ms", stats.fFrames ? stats.fReadbackTime / stats.fFrames : 0.0);
+        readback->set("wait_ms", stats.fWaitTime);
+        readback->set("upload_wait_ms", stats.fUploadWaitTime);
+        readback->set("map_wait_ms", stats.fMapWaitTime);
+        readback->set("overlap", stats.overlap());
+        result->set("readback", readback);
+    }
+
+    layers.clear();
+    return result;
+}
+
+} // namespace anonymous
+
+int main(int argc, char const **argv)
+{
+    BenchOptions options;
+    if (!parse_options(argc, argv, options))
+        return 1;
+
+    Journal::New(STDERR_FILENO, LOG_LEVEL_QUIET, false);
+
+    constexpr int32_t layerCounts[] = { 1, 4, 16 };
+    constexpr int32_t layerSizes[] = { 256, 512, 1024 };
+    constexpr double dirtyRatios[] = { 0.01, 0.1, 1.0 };
+    constexpr double visibleRatios[] = { 0.5, 1.0 };
+
+    /* Layers can't be larger than the frame, sizes which don't fit are
+       clamped to the shorter side of frame */
+    std::vector<int32_t> fittingSizes;
+    int32_t maxLayerSize = std::min(options.width, options.height);
+    for (int32_t layerSize : layerSizes)
+    {
+        int32_t size = std::min(layerSize, maxLayerSize);
+        if (size != layerSize)
+            std::cerr << "Layer size " << layerSize << " is clamped to " << size << std::endl;
+        if (std::find(fittingSizes.begin(), fittingSizes.end(), size) == fittingSizes.end())
+            fittingSizes.push_back(size);
+    }
+
+    Poco::JSON::Array::Ptr results = new Poco::JSON::Array();
+    for (const std::string& backend : options.backends)
+    {
+        for (int32_t layers : layerCounts)
+        for (int32_t layerSize : fittingSizes)
+        for (double dirtyRatio : dirtyRatios)
+        for (double visibleRatio : visibleRatios)
+        {
+            BenchCase benchCase{ backend, layers, layerSize, dirtyRatio, visibleRatio };
+            try
+            {
+                results->add(run_case(options, benchCase));
+            }
+            catch (const RuntimeException& e)
+            {
+                std::cerr << "Case failed: " << e.who() << ": " << e.what() << std::endl;
+                Journal::Delete();
+                return 1;
+            }
+        }
+    }
+
+    Poco::JSON::Object root;
+    root.set("frame_width", options.width);
+    root.set("frame_height", options.height);
+    root.set("frames", options.frames);
+    root.set("warmup", options.warmup);
+    root.set("updates_per_present", options.updatesPerPresent);
+    root.set("presents_per_expose", options.presentsPerExpose);
+    root.set("results", results);
+
+    if (options.output.empty())
+    {
+        root.stringify(std::cout, 2);
+        std::cout << std::endl;
+    }
+    else
+    {
+        std::ofstream fs(options.output);
+        if (!fs.is_open())
+        {
+            std::cerr << "Failed to open " << options.output << std::endl;
+            Journal::Delete();
+            return 1;
+        }
+        root.stringify(fs, 2);
+    }
+
+    Journal::Delete();
+    return 0;
+}
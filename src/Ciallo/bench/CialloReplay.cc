@@ -0,0 +1,435 @@
+/**
+ * Plays a frame capture (see FrameCapture and GraphicsContext::startCapture())
+ * back on GrHeadlessPlatform as fast as possible. Captured layers and paint
+ * nodes are rebuilt on a GraphicsContext, so that rasterization goes through
+ * the same Renderer thread, raster threads and raster cache as the captured
+ * application. Times of each frame are written as JSON:
+ *   raster_us     Updating the render nodes painted in the frame
+ *   composite_us  Composition of the frame until it is published
+ *                 (GraphicsContext::emitCmdPresent, GrBaseCompositor::waitForPublished)
+ *   present_us    Displaying the frame (GrBasePlatform::expose)
+ *
+ * Usage: ciallo_replay --capture <dir> [options]
+ *   --backend <name>          cpu, cpu-tiled, cpu-tiled-raster or opencl (default cpu)
+ *   --opencl-platform <kw>    Keyword of OpenCL platform, "Portable" selects pocl
+ *   --opencl-device <kw>      Keyword of OpenCL device
+ *   --raster-threads <n>      Number of raster threads, 0 means the number of CPU cores
+ *   --raster-cache-mb <n>     Budget of raster cache in MiB, 0 disables it (default 64)
+ *   --loops <n>               Times to play the capture (default 1)
+ *   --output <file>           Write JSON into file instead of stdout
+ */
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <Poco/JSON/Object.h>
+#include <Poco/JSON/Array.h>
+#include <Poco/JSON/Parser.h>
+
+#include "include/core/SkPicture.h"
+
+#include "Core/Journal.h"
+#include "Core/Exception.h"
+#include "Ciallo/GraphicsContext.h"
+#include "Ciallo/FrameCapture.h"
+#include "Ciallo/SkpSnapshot.h"
+#include "Ciallo/DIR/PaintNode.h"
+#include "Ciallo/DDR/GrBasePlatform.h"
+#include "Ciallo/DDR/GrHeadlessPlatform.h"
+
+using namespace cocoa;
+using namespace cocoa::ciallo;
+
+namespace {
+
+struct ReplayOptions
+{
+    std::string capture;
+    std::string backend = "cpu";
+    std::string openclPlatform;
+    std::string openclDevice;
+    int32_t rasterThreads = 0;
+    int64_t rasterCacheMB = 64;
+    int32_t loops = 1;
+    std::string output;
+};
+
+struct Capture
+{
+    int32_t frameWidth = 0;
+    int32_t frameHeight = 0;
+    std::vector<Poco::JSON::Object::Ptr> frames;
+    std::unordered_map<int32_t, sk_sp<SkPicture>> pictures;
+};
+
+struct ReplayLayer
+{
+    RenderNodeHandle            handle;
+    RenderNode                 *renderNode = nullptr;
+    std::vector<PaintNode*>     paintNodes;
+};
+
+struct FrameTimes
+{
+    double raster = 0;
+    double composite = 0;
+    double present = 0;
+};
+
+bool parse_options(int argc, char const **argv, ReplayOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value of " << arg << std::endl;
+            return false;
+        }
+
+        std::string value(argv[++i]);
+        if (arg == "--capture")
+            options.capture = value;
+        else if (arg == "--backend")
+            options.backend = value;
+        else if (arg == "--opencl-platform")
+            options.openclPlatform = value;
+        else if (arg == "--opencl-device")
+            options.openclDevice = value;
+        else if (arg == "--raster-threads")
+            options.rasterThreads = std::atoi(value.c_str());
+        else if (arg == "--raster-cache-mb")
+            options.rasterCacheMB = std::atoll(value.c_str());
+        else if (arg == "--loops")
+            options.loops = std::atoi(value.c_str());
+        else if (arg == "--output")
+            options.output = value;
+        else
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    if (options.capture.empty())
+    {
+        std::cerr << "A capture must be specified by --capture" << std::endl;
+        return false;
+    }
+    return options.loops > 0 && options.rasterThreads >= 0 && options.rasterCacheMB >= 0;
+}
+
+/* Pictures are all loaded before playing, so that loading is not measured */
+bool load_capture(const std::string& directory, Capture& capture)
+{
+    std::ifstream fs(directory + "/capture.jsonl");
+    if (!fs.is_open())
+    {
+        std::cerr << "Failed to open " << directory << "/capture.jsonl" << std::endl;
+        return false;
+    }
+
+    Poco::JSON::Parser parser;
+    std::string line;
+    if (!std::getline(fs, line))
+    {
+        std::cerr << "Empty capture" << std::endl;
+        return false;
+    }
+    auto header = parser.parse(line).extract<Poco::JSON::Object::Ptr>();
+    if (header->getValue<int32_t>("version") != FrameCapture::kVersion)
+    {
+        std::cerr << "Unsupported capture version " << header->getValue<int32_t>("version") << std::endl;
+        return false;
+    }
+    capture.frameWidth = header->getValue<int32_t>("frame_width");
+    capture.frameHeight = header->getValue<int32_t>("frame_height");
+
+    while (std::getline(fs, line))
+    {
+        if (line.empty())
+            continue;
+        parser.reset();
+        auto frame = parser.parse(line).extract<Poco::JSON::Object::Ptr>();
+        capture.frames.push_back(frame);
+
+        Poco::JSON::Array::Ptr events = frame->getArray("events");
+        for (size_t i = 0; i < events->size(); i++)
+        {
+            Poco::JSON::Object::Ptr event = events->getObject(i);
+            if (event->getValue<std::string>("type") != "paint")
+                continue;
+
+            Poco::JSON::Array::Ptr nodes = event->getArray("nodes");
+            for (size_t j = 0; j < nodes->size(); j++)
+            {
+                auto index = nodes->getObject(j)->getValue<int32_t>("picture");
+                if (index < 0 || capture.pictures.contains(index))
+                    continue;
+
+                std::string path = directory + "/pictures/" + std::to_string(index) + ".cskp";
+                sk_sp<SkPicture> picture = SkpSnapshotLoad(path);
+                if (picture == nullptr)
+                {
+                    std::cerr << "Failed to load picture " << path << std::endl;
+                    return false;
+                }
+                capture.pictures[index] = picture;
+            }
+        }
+    }
+    return true;
+}
+
+void apply_paint(const Capture& capture, ReplayLayer& layer, const Poco::JSON::Array::Ptr& nodes)
+{
+    /* Paint nodes are matched by their order in the layer */
+    while (layer.paintNodes.size() > nodes->size())
+    {
+        BaseNode::Delete(layer.paintNodes.back());
+        layer.paintNodes.pop_back();
+    }
+    while (layer.paintNodes.size() < nodes->size())
+    {
+        auto renderLayer = layer.renderNode->asRenderLayer();
+        layer.paintNodes.push_back(PaintNode::MakeFromParent(layer.renderNode,
+                                                             renderLayer->width(),
+                                                             renderLayer->height(), 0, 0));
+    }
+
+    for (size_t i = 0; i < nodes->size(); i++)
+    {
+        Poco::JSON::Object::Ptr node = nodes->getObject(i);
+        PaintNode *paintNode = layer.paintNodes[i];
+
+        auto index = node->getValue<int32_t>("picture");
+        sk_sp<SkPicture> picture = index < 0 ? nullptr : capture.pictures.at(index);
+        if (picture != paintNode->asPicture())
+            paintNode->setPicture(picture);
+        paintNode->moveTo(node->getValue<int32_t>("x"), node->getValue<int32_t>("y"));
+    }
+}
+
+FrameTimes play_frame(GraphicsContext& context, const Capture& capture,
+                      std::unordered_map<int32_t, ReplayLayer>& layers,
+                      const Poco::JSON::Object::Ptr& frame)
+{
+    std::vector<RenderNodeHandle> painted;
+    Poco::JSON::Array::Ptr events = frame->getArray("events");
+    for (size_t i = 0; i < events->size(); i++)
+    {
+        Poco::JSON::Object::Ptr event = events->getObject(i);
+        auto type = event->getValue<std::string>("type");
+        auto index = event->getValue<int32_t>("layer");
+
+        if (type == "create")
+        {
+            RenderNodeHandle handle = context.createRenderNode(event->getValue<std::string>("name"),
+                                                              event->getValue<int32_t>("width"),
+                                                              event->getValue<int32_t>("height"),
+                                                              event->getValue<int32_t>("x"),
+                                                              event->getValue<int32_t>("y"),
+                                                              event->getValue<int>("zindex"));
+            if (!handle.valid())
+            {
+                throw RuntimeException::Builder(__FUNCTION__)
+                        .append("Failed to create layer ")
+                        .append(index)
+                        .make<RuntimeException>();
+            }
+            RenderNode *renderNode = context.getRenderNode(handle);
+            renderNode->asRenderLayer()->setVisibility(event->getValue<bool>("visible"));
+            layers[index].handle = handle;
+            layers[index].renderNode = renderNode;
+            continue;
+        }
+
+        auto itr = layers.find(index);
+        if (itr == layers.end())
+        {
+            throw RuntimeException::Builder(__FUNCTION__)
+                    .append("Event refers to an unknown layer ")
+                    .append(index)
+                    .make<RuntimeException>();
+        }
+
+        ReplayLayer& layer = itr->second;
+        if (type == "destroy")
+        {
+            std::erase(painted, layer.handle);
+            context.destroyRenderNode(layer.handle);
+            layers.erase(itr);
+        }
+        else if (type == "layer")
+        {
+            auto renderLayer = layer.renderNode->asRenderLayer();
+            renderLayer->moveTo(event->getValue<int32_t>("x"), event->getValue<int32_t>("y"));
+            renderLayer->setVisibility(event->getValue<bool>("visible"));
+        }
+        else if (type == "paint")
+        {
+            apply_paint(capture, layer, event->getArray("nodes"));
+            if (std::find(painted.begin(), painted.end(), layer.handle) == painted.end())
+                painted.push_back(layer.handle);
+        }
+    }
+
+    using Clock = std::chrono::steady_clock;
+    using Micro = std::chrono::duration<double, std::micro>;
+    FrameTimes times;
+
+    auto start = Clock::now();
+    if (!painted.empty())
+        context.emitCmdRenderNodesUpdate(painted)->wait();
+    auto rasterized = Clock::now();
+    context.emitCmdPresent()->wait();
+    context.asNode()->asCompositor()->waitForPublished();
+    auto composited = Clock::now();
+    context.asPlatform()->expose();
+    auto presented = Clock::now();
+
+    times.raster = Micro(rasterized - start).count();
+    times.composite = Micro(composited - rasterized).count();
+    times.present = Micro(presented - composited).count();
+    return times;
+}
+
+double percentile(const std::vector<double>& sorted, double p)
+{
+    auto index = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::clamp<size_t>(index, 1, sorted.size()) - 1];
+}
+
+Poco::JSON::Object::Ptr summarize(std::vector<double> values)
+{
+    Poco::JSON::Object::Ptr result = new Poco::JSON::Object();
+    if (values.empty())
+        return result;
+
+    double total = 0;
+    for (double v : values)
+        total += v;
+    std::sort(values.begin(), values.end());
+
+    result->set("mean", total / values.size());
+    result->set("p50", percentile(values, 50));
+    result->set("p90", percentile(values, 90));
+    result->set("p99", percentile(values, 99));
+    result->set("max", values.back());
+    return result;
+}
+
+} // namespace anonymous
+
+int main(int argc, char const **argv)
+{
+    ReplayOptions options;
+    if (!parse_options(argc, argv, options))
+        return 1;
+
+    Journal::New(STDERR_FILENO, LOG_LEVEL_QUIET, false);
+
+    Capture capture;
+    if (!load_capture(options.capture, capture))
+    {
+        Journal::Delete();
+        return 1;
+    }
+
+    GrPlatformOptions platformOptions;
+    platformOptions.use_gpu_accel = false;
+    platformOptions.use_opencl_accel = (options.backend == "opencl");
+    platformOptions.use_strict_accel = true;
+    platformOptions.opencl_platform_keyword = options.openclPlatform;
+    platformOptions.opencl_device_keyword = options.openclDevice;
+    platformOptions.cpu_tiled_composite = (options.backend == "cpu-tiled");
+    platformOptions.cpu_tiled_raster = (options.backend == "cpu-tiled-raster");
+    platformOptions.raster_threads = options.rasterThreads;
+    platformOptions.raster_cache_budget = options.rasterCacheMB << 20;
+
+    auto platform = GrHeadlessPlatform::MakeHeadless(capture.frameWidth, capture.frameHeight,
+                                                     GrColorFormat::kColor_BGRA_8888,
+                                                     platformOptions);
+    if (platform == nullptr || platform->compositor() == nullptr)
+    {
+        std::cerr << "Backend " << options.backend << " is unavailable" << std::endl;
+        Journal::Delete();
+        return 1;
+    }
+
+    Poco::JSON::Object root;
+    root.set("capture", options.capture);
+    root.set("backend", options.backend);
+    root.set("device", platform->compositor()->getDeviceName());
+    root.set("frame_width", capture.frameWidth);
+    root.set("frame_height", capture.frameHeight);
+    root.set("loops", options.loops);
+
+    Poco::JSON::Array::Ptr frames = new Poco::JSON::Array();
+    std::vector<double> rasterTimes, compositeTimes, presentTimes;
+    try
+    {
+        GraphicsContext context(std::move(platform));
+        for (int32_t loop = 0; loop < options.loops; loop++)
+        {
+            std::unordered_map<int32_t, ReplayLayer> layers;
+            for (const Poco::JSON::Object::Ptr& frame : capture.frames)
+            {
+                FrameTimes times = play_frame(context, capture, layers, frame);
+                rasterTimes.push_back(times.raster);
+                compositeTimes.push_back(times.composite);
+                presentTimes.push_back(times.present);
+
+                Poco::JSON::Object::Ptr result = new Poco::JSON::Object();
+                result->set("loop", loop);
+                result->set("frame", frame->getValue<uint64_t>("frame"));
+                result->set("raster_us", times.raster);
+                result->set("composite_us", times.composite);
+                result->set("present_us", times.present);
+                frames->add(result);
+            }
+            context.resetScene();
+        }
+        root.set("dropped_frames", context.asNode()->asCompositor()->droppedFrames());
+        root.set("skipped_frames", context.asPlatform()->skippedFrames());
+    }
+    catch (const RuntimeException& e)
+    {
+        std::cerr << "Replay failed: " << e.who() << ": " << e.what() << std::endl;
+        Journal::Delete();
+        return 1;
+    }
+
+    root.set("raster_us", summarize(rasterTimes));
+    root.set("composite_us", summarize(compositeTimes));
+    root.set("present_us", summarize(presentTimes));
+    root.set("frames", frames);
+
+    if (options.output.empty())
+    {
+        root.stringify(std::cout, 2);
+        std::cout << std::endl;
+    }
+    else
+    {
+        std::ofstream fs(options.output);
+        if (!fs.is_open())
+        {
+            std::cerr << "Failed to open " << options.output << std::endl;
+            Journal::Delete();
+            return 1;
+        }
+        root.stringify(fs, 2);
+    }
+
+    Journal::Delete();
+    return 0;
+}
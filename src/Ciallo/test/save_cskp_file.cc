@@ -1,3 +1,5 @@
+#include <iostream>
+
 #include "Ciallo/SkpSnapshot.h"
 
 #include "include/core/SkPictureRecorder.h"
@@ -102,14 +104,59 @@ void draw(SkCanvas* canvas)
     canvas->drawRRect(rrect, p);
 }
 
+/* Large enough to be compressed as several chunks */
+void draw_many_rects(SkCanvas* canvas)
+{
+    SkPaint p;
+    uint32_t seed = 2233;
+    for (int i = 0; i < 40000; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        p.setColor(0xff000000 | (seed >> 8));
+        canvas->drawRect(SkRect::MakeXYWH(seed % 800, (seed >> 16) % 600, i % 97, i % 89), p);
+    }
+}
+
+bool round_trip(const sk_sp<SkPicture>& picture)
+{
+    sk_sp<SkData> expected = picture->serialize();
+
+    /* Every format should load the same picture back */
+    using cocoa::ciallo::SkpSnapshotCompress;
+    for (SkpSnapshotCompress compress : { SkpSnapshotCompress::kRaw, SkpSnapshotCompress::kZlib })
+    {
+        cocoa::ciallo::SkpSnapshotMetadata metadata;
+        metadata.pictureName = "logo";
+        metadata.packagerName = "save_cskp_file";
+        if (!cocoa::ciallo::SkpSnapshotWriteToFile(picture, "logo.cskp", compress, metadata))
+        {
+            std::cerr << "Failed to write logo.cskp" << std::endl;
+            return false;
+        }
+
+        cocoa::ciallo::SkpSnapshotMetadata loadedMetadata;
+        sk_sp<SkPicture> loaded = cocoa::ciallo::SkpSnapshotLoad("logo.cskp", &loadedMetadata);
+        if (loaded == nullptr || !loaded->serialize()->equals(expected.get())
+            || loadedMetadata.pictureName != "logo" || loadedMetadata.packagerName != "save_cskp_file")
+        {
+            std::cerr << "Mismatched picture loaded from logo.cskp" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 int main()
 {
     SkPictureRecorder rec;
-    SkCanvas *canvas = rec.beginRecording(800, 600);
+    draw(rec.beginRecording(800, 600));
+    if (!round_trip(rec.finishRecordingAsPicture()))
+        return 1;
 
-    draw(canvas);
+    draw_many_rects(rec.beginRecording(800, 600));
+    if (!round_trip(rec.finishRecordingAsPicture()))
+        return 1;
 
-    sk_sp<SkPicture> picture = rec.finishRecordingAsPicture();
-    cocoa::ciallo::SkpSnapshotWriteToFile(picture, "logo.cskp", cocoa::ciallo::SkpSnapshotCompress::kZlib);
+    std::cout << "PASS" << std::endl;
     return 0;
 }
@@ -66,6 +66,18 @@ FINAL_VALUE_TEMPLATE(true, enableGpuDebugJournal, Boolean)
 FINAL_VALUE_TEMPLATE(true, useOpenCl, Boolean)
 FINAL_VALUE_TEMPLATE(true, useOpenClPlatformKeyword, String)
 FINAL_VALUE_TEMPLATE(true, useOpenClDeviceKeyword, String)
+FINAL_VALUE_TEMPLATE(true, openClBinaryCacheDir, String)
+FINAL_VALUE_TEMPLATE(true, useTiledCpuComposite, Boolean)
+FINAL_VALUE_TEMPLATE(true, cpuCompositeTileSize, Integer)
+FINAL_VALUE_TEMPLATE(true, cpuCompositeThreads, Integer)
+FINAL_VALUE_TEMPLATE(true, useTiledCpuRaster, Boolean)
+FINAL_VALUE_TEMPLATE(true, cpuRasterTileSize, Integer)
+FINAL_VALUE_TEMPLATE(true, rasterThreads, Integer)
+FINAL_VALUE_TEMPLATE(true, rasterCacheBudgetMB, Integer)
+FINAL_VALUE_TEMPLATE(true, rasterCacheStableFrames, Integer)
+FINAL_VALUE_TEMPLATE(true, useZeroCopyPresent, Boolean)
+FINAL_VALUE_TEMPLATE(true, useXcbSharedMemory, Boolean)
+FINAL_VALUE_TEMPLATE(true, frameCaptureDir, String)
 OBJECT_TEMPLATE(true, features, {
     FINAL_VALUE_MEMBER(useStrictHardwareDraw)
     FINAL_VALUE_MEMBER(useGpuDraw)
@@ -73,6 +85,18 @@ OBJECT_TEMPLATE(true, features, {
     FINAL_VALUE_MEMBER(useOpenCl)
     FINAL_VALUE_MEMBER(useOpenClPlatformKeyword)
     FINAL_VALUE_MEMBER(useOpenClDeviceKeyword)
+    FINAL_VALUE_MEMBER(openClBinaryCacheDir)
+    FINAL_VALUE_MEMBER(useTiledCpuComposite)
+    FINAL_VALUE_MEMBER(cpuCompositeTileSize)
+    FINAL_VALUE_MEMBER(cpuCompositeThreads)
+    FINAL_VALUE_MEMBER(useTiledCpuRaster)
+    FINAL_VALUE_MEMBER(cpuRasterTileSize)
+    FINAL_VALUE_MEMBER(rasterThreads)
+    FINAL_VALUE_MEMBER(rasterCacheBudgetMB)
+    FINAL_VALUE_MEMBER(rasterCacheStableFrames)
+    FINAL_VALUE_MEMBER(useZeroCopyPresent)
+    FINAL_VALUE_MEMBER(useXcbSharedMemory)
+    FINAL_VALUE_MEMBER(frameCaptureDir)
 })
 
 OBJECT_TEMPLATE(true, root, {
@@ -227,7 +251,19 @@ const std::string defaultJSON = R"(
     "useStrictHardwareDraw": false,
     "useGpuDraw": true,
     "enableGpuDebugJournal": false,
-    "useOpenCl": false
+    "useOpenCl": false,
+    "openClBinaryCacheDir": "<cache>",
+    "useTiledCpuComposite": false,
+    "cpuCompositeTileSize": 256,
+    "cpuCompositeThreads": 0,
+    "useTiledCpuRaster": false,
+    "cpuRasterTileSize": 256,
+    "rasterThreads": 0,
+    "rasterCacheBudgetMB": 64,
+    "rasterCacheStableFrames": 3,
+    "useZeroCopyPresent": false,
+    "useXcbSharedMemory": true,
+    "frameCaptureDir": ""
   }
 })";
 
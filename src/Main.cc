@@ -97,8 +97,9 @@ void xcbRender()
     window.createWindow();
     window.setWindowTitle("Ciallo Test");
 
-    RenderNode *renderNode = window.GContext()->createRenderNode("#front",
-                                                                 800, 600, 50, 20, 1);
+    RenderNodeHandle handle = window.GContext()->createRenderNode("#front",
+                                                                  800, 600, 50, 20, 1);
+    RenderNode *renderNode = window.GContext()->getRenderNode(handle);
 
     PaintNode *paintNode = PaintNode::MakeFromParent(renderNode, 800, 600, 0, 0);
     renderNode->asRenderLayer()->setVisibility(true);
@@ -106,7 +107,7 @@ void xcbRender()
     while (!window.isClosed())
     {
         draw(paintNode, nullptr);
-        window.GContext()->emitCmdRenderNodeUpdate(renderNode)->wait();
+        window.GContext()->emitCmdRenderNodeUpdate(handle)->wait();
         window.update();
     }
 }